@@ -15,7 +15,7 @@ void tcp_handler(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint8_t *src_i
 #endif
 
 int main(int argc, char const *argv[]) {
-    if (net_init() == -1) {  // 初始化协议栈
+    if (net_fork() == -1 || net_init() == -1) {  // 按NET_WORKERS创建worker进程，各自初始化协议栈
         printf("net init failed.");
         return -1;
     }
@@ -24,9 +24,7 @@ int main(int argc, char const *argv[]) {
     tcp_open(60000, tcp_handler);  // 注册端口的tcp监听回调
 #endif
 
-    while (1) {
-        net_poll();  // 一次主循环
-    }
+    net_run();  // 事件循环，空闲时阻塞等待
 
     return 0;
 }
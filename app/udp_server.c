@@ -13,7 +13,7 @@ void udp_handler(uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port)
 #endif
 
 int main(int argc, char const *argv[]) {
-    if (net_init() == -1) {  // 初始化协议栈
+    if (net_fork() == -1 || net_init() == -1) {  // 按NET_WORKERS创建worker进程，各自初始化协议栈
         printf("net init failed.");
         return -1;
     }
@@ -22,9 +22,7 @@ int main(int argc, char const *argv[]) {
     udp_open(60000, udp_handler);  // 注册端口的udp监听回调
 #endif
 
-    while (1) {
-        net_poll();  // 一次主循环
-    }
+    net_run();  // 事件循环，空闲时阻塞等待
 
     return 0;
 }
@@ -146,16 +146,14 @@ void http_request_handler(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint8
 }
 
 int main(int argc, char const *argv[]) {
-    if (net_init() == -1) {  // 初始化协议栈
+    if (net_fork() == -1 || net_init() == -1) {  // 按NET_WORKERS创建worker进程，各自初始化协议栈
         printf("net init failed.");
         return -1;
     }
 
     tcp_open(HTTP_LISTEN_PORT, http_request_handler);  // 注册端口的tcp监听回调
 
-    while (1) {
-        net_poll();  // 一次主循环
-    }
+    net_run();  // 事件循环，空闲时阻塞等待
 
     return 0;
 }
@@ -8,16 +8,51 @@
 
 typedef struct buf  // 协议栈的通用数据包buffer, 可以在头部装卸数据，以供协议头的添加和去除
 {
-    size_t len;                    // 包中有效数据大小
-    uint8_t *data;                 // 包的数据起始地址
-    uint8_t payload[BUF_MAX_LEN];  // 最大负载数据量
+    size_t len;        // 包中有效数据大小
+    uint8_t *data;     // 包的数据起始地址
+    uint8_t *payload;  // 负载数据区起始地址，为缓冲池中的一块
+    size_t cap;        // 负载数据区大小，只读引用外部内存的段和只读视图为0
+    struct buf *next;  // 分散聚集链中的下一段，为NULL表示最后一段
+    uint8_t flags;     // 校验和与分段卸载标志，BUF_FLAG_*，只在首段上有效
 } buf_t;
 
+#define BUF_FLAG_CSUM_VERIFIED (1 << 0)  // 接收：驱动已确认传输层校验和正确，无需软件校验，IP头部仍由ip_in校验
+#define BUF_FLAG_CSUM_PARTIAL (1 << 1)   // 发送：传输层校验和字段只含伪头部的和，由驱动/网卡补全
+#define BUF_FLAG_GSO_TCP (1 << 2)        // 发送：超过MTU的TCP报文段，由驱动/网卡按MSS分段
+
+typedef struct buf_stat  // buf拷贝统计
+{
+    size_t copy_num;    // 深拷贝次数
+    size_t copy_bytes;  // 深拷贝字节数
+    size_t clone_num;   // 共享克隆次数
+    size_t cow_num;     // 写时拷贝次数
+    size_t cow_bytes;   // 写时拷贝字节数
+} buf_stat_t;
+
+extern buf_stat_t buf_stat;
+
+buf_t *buf_alloc(size_t len);
+void buf_free(buf_t *buf);
+buf_t *buf_ref(const uint8_t *data, size_t len);
+void buf_attach(buf_t *buf, uint8_t *mem, size_t cap, size_t offset, size_t len);
+void buf_view(buf_t *buf, const uint8_t *mem, size_t len);
+uint8_t *buf_block_area(size_t *num);
+uint8_t *buf_block_get();
+void buf_block_hold(uint8_t *block);
+void buf_block_put(uint8_t *block);
+buf_t *buf_slice(const buf_t *buf, size_t offset, size_t len);
+void buf_chain(buf_t *buf, buf_t *seg);
+size_t buf_chain_len(const buf_t *buf);
+int buf_pooled(const buf_t *buf);
+int buf_shared(const buf_t *buf);
+int buf_linearize(buf_t *buf);
 int buf_init(buf_t *buf, size_t len);
 int buf_add_header(buf_t *buf, size_t len);
 int buf_remove_header(buf_t *buf, size_t len);
 int buf_add_padding(buf_t *buf, size_t len);
 int buf_remove_padding(buf_t *buf, size_t len);
 void buf_copy(void *pdst, const void *psrc, size_t len);
+void buf_clone(void *pdst, const void *psrc, size_t len);
+int buf_unshare(buf_t *buf);
 
-#endif
\ No newline at end of file
+#endif
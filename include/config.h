@@ -21,14 +21,66 @@
     }  // 自定义网卡mac地址
 #endif
 
+#ifdef TEST
+#define NET_DRIVER_DEFAULT "pcapfile"  // 测试默认使用回放pcap文件的驱动
+#else
+#define NET_DRIVER_DEFAULT "pcap"  // 默认驱动后端，可由环境变量NET_DRIVER覆盖，格式为"名称[:参数]"
+#endif
+#define NET_DRIVER_MAX_NUM 16  // 可注册的驱动后端最大数量
+
+#define DRIVER_PACKET_BLOCK_SIZE (1 << 18)  // AF_PACKET接收环的块大小，须为页大小的整数倍
+#define DRIVER_PACKET_BLOCK_NUM 64          // AF_PACKET接收环的块数
+#define DRIVER_PACKET_BLOCK_TIMEOUT 1       // 未满的接收块最多等待多少毫秒即交给用户
+#define DRIVER_PACKET_FRAME_SIZE 2048       // AF_PACKET发送环的帧槽大小
+#define DRIVER_PACKET_TX_FRAME_NUM 512      // AF_PACKET发送环的帧槽数
+
+#define DRIVER_FILTER_EXP_LEN 4096  // 按打开的端口生成的过滤表达式的最大长度
+#define DRIVER_FILTER_MAX_PORTS 64  // 过滤器逐个列出的端口数上限，超过时放行该协议的全部端口
+
+#define DRIVER_TAP_NAME "tap0"  // TAP驱动默认打开的网卡名
+
+#define DRIVER_URING_BUF_NUM 512   // io_uring模式注册的接收缓冲区数，须为2的幂，从常规块中借出，BUF_MTU_NUM为此预留
+#define DRIVER_URING_RX_DEPTH 32   // io_uring模式接收提交队列大小，不支持多发读时即预投递的单发读数
+#define DRIVER_URING_TX_DEPTH 64   // io_uring模式一次提交的最大发送帧数
+#define DRIVER_URING_SQ_IDLE 1000  // SQPOLL内核线程空闲多少毫秒后休眠
+
+#define DRIVER_XDP_RING_SIZE 2048  // AF_XDP各环的大小，须为2的幂，UMEM即缓冲池的常规块存储区
+#define DRIVER_XDP_FILL_NUM 1024   // AF_XDP填充环上最多借给内核的常规块数，BUF_MTU_NUM为此预留
+#define DRIVER_XDP_QUEUE 0         // AF_XDP绑定的网卡队列
+
+#define DRIVER_WIRE_RING_SIZE 1024         // 内存连线每个方向的环大小，须为2的幂
+#define DRIVER_WIRE_FRAME_SIZE 2048        // 内存连线的帧槽大小，含帧长字段
+#define DRIVER_WIRE_HEADROOM BUF_HEADROOM  // 内存连线帧槽中数据帧之前预留的头部空间
+
+#define DRIVER_NETEM_LIMIT 1000        // 网络仿真每个方向默认最多排队的帧数，可由选项limit覆盖
+#define DRIVER_NETEM_FRAME_SIZE 1536   // 网络仿真队列的帧槽大小，容纳一个完整以太网帧
+
 #define ETHERNET_MAX_TRANSPORT_UNIT 1500  // 以太网最大传输单元
 
+#define NET_POLL_BUDGET 32   // 每次轮询最多批量接收的数据帧数
+#define NET_TX_RING_SIZE 32  // 发送队列长度，每次轮询结束或队列满时批量发送
+#define NET_IDLE_US 200      // net_run连续空轮询超过多少微秒后转入阻塞等待，可由环境变量NET_IDLE_US覆盖
+
 #define ARP_TIMEOUT_SEC (60 * 5)  // arp表过期时间
 #define ARP_MIN_INTERVAL 1        // 向相同地址发送arp请求的最小间隔
+#define ARP_BUF_MAX_NUM 256       // 等待arp应答的数据包的最大数量，满时淘汰最早的，避免占满缓冲池
 
 #define IP_DEFALUT_TTL 64  // IP默认TTL
 
-#define BUF_MAX_LEN (2 * UINT16_MAX + UINT8_MAX)  // buf最大长度
+#define BUF_HEADROOM 128                                     // buf头部预留空间，容纳以太网+IP+TCP等协议头
+#define BUF_MTU_LEN 2048                                     // 常规块大小，可容纳一个完整以太网帧
+#define BUF_MAX_LEN (BUF_HEADROOM + UINT16_MAX + UINT8_MAX)  // buf最大长度，即巨型块大小
+#define BUF_JUMBO_NUM 8                                      // 巨型块数量
+#ifdef __linux__
+#define BUF_MTU_LEND_NUM (DRIVER_XDP_FILL_NUM > DRIVER_URING_BUF_NUM ? DRIVER_XDP_FILL_NUM : DRIVER_URING_BUF_NUM)  // 接收时借给内核的常规块数，io_uring的提供缓冲区与AF_XDP的填充环同一时刻只用其一
+#define BUF_MTU_NUM (1024 + BUF_MTU_LEND_NUM)                                                                // 常规块数量，另加接收时借给内核的块
+#else
+#define BUF_MTU_NUM 1024  // 常规块数量
+#endif
 
-#define MAP_MAX_LEN (16 * BUF_MAX_LEN)  // map最大长度
+#define MAP_INIT_SIZE 8                // map初始容量
+#define MAP_DEFAULT_MAX_SIZE (1 << 16)  // map默认最大容量
+#define MAP_WHEEL_SIZE 256              // 超时时间轮的槽数，每槽对应1秒
+#define MAP_TIMED_MAX 16                // 参与定时清理的带超时map的最大数量
+#define MAP_EXPIRE_BUDGET 64            // 每次轮询清理过期键值对时最多检查的键值对数
 #endif
\ No newline at end of file
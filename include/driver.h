@@ -6,8 +6,97 @@
 #ifndef PCAP_BUF_SIZE
 #define PCAP_BUF_SIZE 1024
 #endif
+
+#define DRIVER_CAP_RECV_BURST (1 << 0)    // 原生支持批量接收
+#define DRIVER_CAP_SEND_BURST (1 << 1)    // 原生支持批量发送
+#define DRIVER_CAP_FD (1 << 2)            // 提供可等待的文件描述符
+#define DRIVER_CAP_RECV_INPLACE (1 << 3)  // 收到的数据帧直接引用驱动的内存，只在下一次接收前有效
+#define DRIVER_CAP_TX_CSUM (1 << 4)       // 可补全BUF_FLAG_CSUM_PARTIAL的传输层校验和
+#define DRIVER_CAP_TSO (1 << 5)           // 可将BUF_FLAG_GSO_TCP的报文段按MSS分段
+#define DRIVER_CAP_FANOUT (1 << 6)        // 可由多个进程加入同一个fanout组，按流分担接收
+
+typedef struct net_driver_ops  // 驱动后端的操作表
+{
+    const char *name;                        // 后端名，用于启动时选择
+    uint32_t caps;                           // 能力标志，DRIVER_CAP_*
+    int (*open)(const char *arg);            // 打开设备，arg为后端参数，可为NULL
+    int (*recv)(buf_t *buf);                 // 接收一个数据包
+    int (*recv_burst)(buf_t *bufs, int n);   // 批量接收，可为NULL，此时逐个调用recv
+    int (*send)(buf_t *buf);                 // 发送一个数据包
+    int (*send_burst)(buf_t *bufs, int n);   // 批量发送，可为NULL，此时逐个调用send
+    void (*close)();                         // 关闭设备
+    int (*fd)();                             // 获取可等待的文件描述符，可为NULL
+    int (*filter)(const char *filter_exp);   // 编译并替换内核中的过滤器，可为NULL
+} net_driver_ops_t;
+
+typedef struct driver_stat  // 驱动收发路径上由驱动直接发起的系统调用统计，以及过滤器的更新统计
+{
+    size_t rx_syscalls;       // 接收路径上的系统调用次数
+    size_t tx_syscalls;       // 发送路径上的系统调用次数
+    size_t filter_num;        // 过滤器重新生成的次数
+    uint64_t filter_ns;       // 重新生成过滤器的总耗时，平均耗时为filter_ns / filter_num
+    uint64_t filter_max_ns;   // 重新生成过滤器的最大耗时
+} driver_stat_t;
+
+extern driver_stat_t driver_stat;
+
+typedef struct driver_fanout  // 多进程扩展时本进程在fanout组中的身份，由net_fork设置
+{
+    int num;         // worker进程数，不大于1时不加入fanout组
+    int index;       // 本进程的序号，0号负责应答ARP
+    uint16_t group;  // 所有worker共用的fanout组号
+} driver_fanout_t;
+
+extern driver_fanout_t driver_fanout;
+
+typedef struct driver_replay_stat  // replay后端的回放统计
+{
+    size_t rx_frames;  // 交给协议栈的帧数
+    size_t tx_frames;  // 协议栈发出的帧数
+    size_t tx_dumped;  // 其中按采样写入文件的帧数
+    size_t loops;      // 已完成的回放轮数
+    int done;          // 回放已结束，之后的接收不再交出数据帧
+} driver_replay_stat_t;
+
+extern driver_replay_stat_t driver_replay_stat;
+
+typedef struct driver_netem_link_stat  // netem后端一个方向的统计
+{
+    size_t frames;      // 进入该方向的帧数
+    size_t delivered;   // 交出的帧数，含重复的帧
+    size_t lost;        // 按丢包率丢弃的帧数
+    size_t overflow;    // 因队列满、帧过长或内层后端发送失败而丢弃的帧数
+    size_t reordered;   // 不经时延越过队列的帧数
+    size_t duplicated;  // 被重复的帧数
+} driver_netem_link_stat_t;
+
+typedef struct driver_netem_stat  // netem后端的统计，rx为内层后端到协议栈，tx为协议栈到内层后端
+{
+    driver_netem_link_stat_t rx;
+    driver_netem_link_stat_t tx;
+} driver_netem_stat_t;
+
+extern driver_netem_stat_t driver_netem_stat;
+
+int driver_register(const net_driver_ops_t *ops);
+int driver_select(const char *spec);
+const net_driver_ops_t *driver_current();
+const net_driver_ops_t *driver_lookup(const char *name);
+int driver_recv_with(const net_driver_ops_t *ops, buf_t *bufs, int n);
+int driver_send_with(const net_driver_ops_t *ops, buf_t *bufs, int n);
+int driver_find(uint8_t *ip, char *if_name, uint8_t *mask);
+void driver_filter_exp(char *filter_exp, size_t len);
+struct bpf_program;
+int driver_filter_compile(const char *filter_exp, struct bpf_program *fp);
+int driver_wire_create();
+
 int driver_open();
 int driver_recv(buf_t *buf);
+int driver_recv_burst(buf_t *bufs, int n);
 int driver_send(buf_t *buf);
+int driver_send_burst(buf_t *bufs, int n);
 void driver_close();
-#endif
\ No newline at end of file
+int driver_fd();
+int driver_filter(const char *filter_exp);
+uint32_t driver_caps();
+#endif
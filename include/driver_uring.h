@@ -0,0 +1,12 @@
+#ifndef DRIVER_URING_H
+#define DRIVER_URING_H
+
+#include "driver.h"
+
+int driver_uring_open(int fd, size_t hdr_len, int sqpoll);
+int driver_uring_recv_burst(buf_t *bufs, int n);
+int driver_uring_send(const void *hdr, buf_t *buf);
+int driver_uring_flush();
+void driver_uring_close();
+int driver_uring_fd();
+#endif
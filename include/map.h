@@ -9,25 +9,52 @@
 
 typedef int (*map_compare_t)(const void *a, const void *b, size_t n);
 typedef void (*map_constuctor_t)(void *dst, const void *src, size_t len);
+typedef void (*map_destructor_t)(void *value);
 typedef void (*map_entry_handler_t)(void *key, void *value, time_t *timestamp);
 
+typedef enum map_policy {
+    MAP_EVICT_NONE,    // 满时插入失败
+    MAP_EVICT_LRU,     // 满时淘汰最久未访问的键值对，查找与更新均算访问
+    MAP_EVICT_OLDEST,  // 满时淘汰更新时间最早的键值对
+} map_policy_t;
+
 typedef struct map  // 协议栈的通用泛型map，即键值对的容器，支持超时时间与非平凡值类型
-{
+{                   // 以开放寻址的哈希索引定位键值对，键值对按插入顺序紧凑存放
     size_t key_len;                     // 键的长度
     size_t value_len;                   // 值的长度
     size_t size;                        // 当前大小
-    size_t max_size;                    // 最大容量
+    size_t max_size;                    // 最大容量，存储空间倍增的上限
+    size_t capacity;                    // 当前存储空间可容纳的键值对数
+    size_t index_cap;                   // 哈希索引的槽数，为2的幂
+    size_t tombstones;                  // 哈希索引中已删除的槽数，探测不会在此停止，过多时原容量重建索引
+    size_t tail;                        // 已使用的键值对位置数，包括已删除的位置
     time_t timeout;                     // 超时时间，0为永不超时
+    map_policy_t policy;                // 满时的淘汰策略
+    uint32_t lru_head;                  // 淘汰顺序链表头，即最近访问的键值对序号+1
+    uint32_t lru_tail;                  // 淘汰顺序链表尾，即下一个被淘汰的键值对序号+1
     map_compare_t key_compare;          // 形如memcmp/strncmp的值构造函数，用于比较两个key的大小
     map_constuctor_t value_constuctor;  // 形如memcpy的值构造函数，用于拷贝非平凡数据结构到容器中，如buf_copy
-    uint8_t data[MAP_MAX_LEN];          // 数据
+    map_destructor_t value_destructor;  // 值析构函数，用于释放非平凡数据结构持有的资源，如buf_free，可为NULL
+    map_entry_handler_t expire_handler; // 过期回调，在过期键值对被回收前调用，可为NULL
+    map_entry_handler_t evict_handler;  // 淘汰回调，在有效键值对被淘汰前调用，可为NULL
+    time_t wheel_time;                  // 时间轮已清理到的时间
+    uint32_t wheel_cursor;              // 时间轮当前槽中下次继续清理的键值对序号+1，0为从槽首开始
+    uint32_t wheel[MAP_WHEEL_SIZE];     // 时间轮，按过期时间散列，每个槽为键值对的双向链表，存放序号+1
+    uint8_t *data;                      // 数据，依次为哈希索引与键值对，按需重新分配
 } map_t;
 
-void map_init(map_t *map, size_t key_len, size_t value_len, size_t max_size, time_t timeout, map_compare_t key_compare, map_constuctor_t value_constuctor);
+void map_init(map_t *map, size_t key_len, size_t value_len, size_t max_size, time_t timeout, map_policy_t policy, map_compare_t key_compare, map_constuctor_t value_constuctor, map_destructor_t value_destructor);
+void map_destroy(map_t *map);
+int map_reset(map_t *map);
 size_t map_size(map_t *map);
 void *map_get(map_t *map, const void *key);
 int map_set(map_t *map, const void *key, const void *value);
 void map_delete(map_t *map, const void *key);
 void map_foreach(map_t *map, map_entry_handler_t handler);
+void map_set_expire_handler(map_t *map, map_entry_handler_t handler);
+void map_set_evict_handler(map_t *map, map_entry_handler_t handler);
+size_t map_expire(map_t *map, size_t budget);
+void map_poll(size_t budget);
+time_t map_next_expire();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,196 @@
+#ifndef MAP_TYPED_H
+#define MAP_TYPED_H
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAP_TYPED_EMPTY 0    // 槽为空，探测到此为止
+#define MAP_TYPED_USED 1     // 槽中存放有效键值对
+#define MAP_TYPED_DELETED 2  // 槽中键值对已删除，探测时需跳过而不能停止
+
+/**
+ * @brief 端口号的哈希函数（乘法散列）
+ *
+ * @param port 端口号指针
+ * @return uint32_t 哈希值
+ */
+static inline uint32_t map_hash_port(const uint16_t *port) {
+    uint32_t hash = *port * 2654435761u;
+    return hash ^ (hash >> 16);
+}
+
+/**
+ * @brief 端口号的相等比较
+ *
+ * @param a 端口号指针
+ * @param b 端口号指针
+ * @return int 相等为1，否则为0
+ */
+static inline int map_eq_port(const uint16_t *a, const uint16_t *b) {
+    return *a == *b;
+}
+
+/**
+ * @brief ip地址的哈希函数，ip地址按4字节整数存放
+ *        网络序下变化的低位字节落在整数高位，需先右移混合，再乘法散列（murmur3的fmix32）
+ *
+ * @param ip ip地址指针
+ * @return uint32_t 哈希值
+ */
+static inline uint32_t map_hash_ip(const uint32_t *ip) {
+    uint32_t hash = *ip;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    return hash ^ (hash >> 16);
+}
+
+/**
+ * @brief ip地址的相等比较
+ *
+ * @param a ip地址指针
+ * @param b ip地址指针
+ * @return int 相等为1，否则为0
+ */
+static inline int map_eq_ip(const uint32_t *a, const uint32_t *b) {
+    return *a == *b;
+}
+
+/**
+ * @brief 生成静态类型的map，哈希与比较函数可被内联，键值对直接存放在开放寻址的槽中
+ *        生成的类型为name_t，函数为name_init/destroy/size/get/set/delete/foreach，用法与map_t一致
+ *        name_keys(map, keys, max)取出至多max个键，返回键的总数，可能大于max
+ *        不支持超时与淘汰，需要这些功能的表仍使用map_t
+ *
+ * @param name 生成的类型与函数的前缀
+ * @param key_type 键类型，须可直接赋值
+ * @param value_type 值类型，须可直接赋值
+ * @param hash 形如uint32_t hash(const key_type *)的哈希函数
+ * @param eq 形如int eq(const key_type *, const key_type *)的相等比较函数
+ */
+#define MAP_DEFINE(name, key_type, value_type, hash, eq)                                           \
+    typedef struct name##_slot {                                                                   \
+        key_type key;                                                                              \
+        value_type value;                                                                          \
+    } name##_slot_t;                                                                               \
+                                                                                                   \
+    typedef struct name {                                                                          \
+        size_t size;           /* 当前大小 */                                                      \
+        size_t used;           /* 非空槽数，包括已删除的槽 */                                      \
+        size_t cap;            /* 槽数，为2的幂 */                                                 \
+        size_t max_size;       /* 最大容量 */                                                      \
+        uint8_t *state;        /* 每个槽的状态 */                                                  \
+        name##_slot_t *slots;  /* 键值对槽 */                                                      \
+    } name##_t;                                                                                    \
+                                                                                                   \
+    static inline int name##_rehash(name##_t *map, size_t cap) {                                   \
+        uint8_t *state = calloc(cap, sizeof(uint8_t) + sizeof(name##_slot_t));                     \
+        if (state == NULL) {                                                                       \
+            fprintf(stderr, "Error in " #name "_rehash: failed to allocate %zu slots.\n", cap);    \
+            return -1;                                                                             \
+        }                                                                                          \
+        name##_slot_t *slots = (name##_slot_t *)(state + cap);                                     \
+        for (size_t i = 0; i < map->cap; i++) {                                                    \
+            if (map->state[i] != MAP_TYPED_USED)                                                   \
+                continue;                                                                          \
+            size_t j = hash(&map->slots[i].key) & (cap - 1);                                       \
+            while (state[j] != MAP_TYPED_EMPTY)                                                    \
+                j = (j + 1) & (cap - 1);                                                           \
+            state[j] = MAP_TYPED_USED;                                                             \
+            memcpy(&slots[j], &map->slots[i], sizeof(name##_slot_t));                              \
+        }                                                                                          \
+        free(map->state);                                                                          \
+        map->state = state;                                                                        \
+        map->slots = slots;                                                                        \
+        map->cap = cap;                                                                            \
+        map->used = map->size;                                                                     \
+        return 0;                                                                                  \
+    }                                                                                              \
+                                                                                                   \
+    static inline int name##_init(name##_t *map, size_t max_size) {                                \
+        memset(map, 0, sizeof(name##_t));                                                          \
+        map->max_size = max_size ? max_size : MAP_DEFAULT_MAX_SIZE;                                \
+        return name##_rehash(map, 2 * MAP_INIT_SIZE);                                              \
+    }                                                                                              \
+                                                                                                   \
+    static inline void name##_destroy(name##_t *map) {                                             \
+        free(map->state);                                                                          \
+        memset(map, 0, sizeof(name##_t));                                                          \
+    }                                                                                              \
+                                                                                                   \
+    static inline size_t name##_size(name##_t *map) {                                              \
+        return map->size;                                                                          \
+    }                                                                                              \
+                                                                                                   \
+    static inline size_t name##_find(name##_t *map, const key_type *key) {                         \
+        size_t mask = map->cap - 1;                                                                \
+        for (size_t i = hash(key) & mask; map->cap; i = (i + 1) & mask) {                          \
+            if (map->state[i] == MAP_TYPED_EMPTY)                                                  \
+                break;                                                                             \
+            if (map->state[i] == MAP_TYPED_USED && eq(key, &map->slots[i].key))                    \
+                return i;                                                                          \
+        }                                                                                          \
+        return map->cap;                                                                           \
+    }                                                                                              \
+                                                                                                   \
+    static inline value_type *name##_get(name##_t *map, const key_type *key) {                     \
+        size_t i = name##_find(map, key);                                                          \
+        return i == map->cap ? NULL : &map->slots[i].value;                                       \
+    }                                                                                              \
+                                                                                                   \
+    static inline int name##_set(name##_t *map, const key_type *key, const value_type *value) {    \
+        size_t i = name##_find(map, key);                                                          \
+        if (i != map->cap) {                                                                       \
+            map->slots[i].value = *value;                                                          \
+            return 0;                                                                              \
+        }                                                                                          \
+        if (map->size == map->max_size)                                                            \
+            return -1;                                                                             \
+        if ((map->used + 1) * 2 > map->cap) {                                                      \
+            /* 装载因子超过1/2时重建，有效键值对较多时倍增，否则只清除已删除的槽 */                \
+            size_t cap = map->cap ? map->cap : 2 * MAP_INIT_SIZE;                                  \
+            if ((map->size + 1) * 4 > cap)                                                         \
+                cap *= 2;                                                                          \
+            if (name##_rehash(map, cap) == -1)                                                     \
+                return -1;                                                                         \
+        }                                                                                          \
+        size_t mask = map->cap - 1;                                                                \
+        for (i = hash(key) & mask; map->state[i] == MAP_TYPED_USED; i = (i + 1) & mask)            \
+            ;                                                                                      \
+        if (map->state[i] == MAP_TYPED_EMPTY)                                                      \
+            map->used++;                                                                           \
+        map->state[i] = MAP_TYPED_USED;                                                            \
+        map->slots[i].key = *key;                                                                  \
+        map->slots[i].value = *value;                                                              \
+        map->size++;                                                                               \
+        return 0;                                                                                  \
+    }                                                                                              \
+                                                                                                   \
+    static inline void name##_delete(name##_t *map, const key_type *key) {                         \
+        size_t i = name##_find(map, key);                                                          \
+        if (i == map->cap)                                                                         \
+            return;                                                                                \
+        map->state[i] = MAP_TYPED_DELETED;                                                         \
+        map->size--;                                                                               \
+    }                                                                                              \
+                                                                                                   \
+    static inline void name##_foreach(name##_t *map, void (*handler)(key_type *, value_type *)) {  \
+        for (size_t i = 0; i < map->cap; i++)                                                      \
+            if (map->state[i] == MAP_TYPED_USED)                                                   \
+                handler(&map->slots[i].key, &map->slots[i].value);                                 \
+    }                                                                                              \
+                                                                                                   \
+    static inline size_t name##_keys(name##_t *map, key_type *keys, size_t max) {                  \
+        size_t num = 0;                                                                            \
+        for (size_t i = 0; i < map->cap && num < max; i++)                                         \
+            if (map->state[i] == MAP_TYPED_USED)                                                   \
+                keys[num++] = map->slots[i].key;                                                   \
+        return map->size;                                                                          \
+    }
+
+#endif
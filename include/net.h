@@ -29,15 +29,44 @@ typedef enum net_protocol {
 
 typedef void (*net_handler_t)(buf_t *buf, uint8_t *src);
 
+typedef struct net_dispatch  // 协议表项
+{
+    net_handler_t handler;  // 该协议的in处理程序，为NULL表示未注册
+    size_t count;           // 已分发给该协议的数据包数
+} net_dispatch_t;
+
+#define NET_IP_PROTOCOL_NUM 256   // IP协议号的个数，协议号小于此值时按IP协议号分发
+#define NET_ETHER_PROTOCOL_NUM 2  // 支持的以太网类型个数，即ARP与IP
+
 #define NET_MAC_LEN 6  // mac地址长度
 #define NET_IP_LEN 4   // ip地址长度
 
+typedef struct net_stat  // 轮询统计，平均接收批量为frame_num / burst_num，平均发送批量为tx_frame_num / flush_num
+{
+    size_t poll_num;      // 轮询次数
+    size_t burst_num;     // 收到数据帧的轮询次数
+    size_t frame_num;     // 收到的数据帧数
+    size_t flush_num;     // 批量发送次数，包括引用外部内存的帧的直接发送
+    size_t flush_full;    // 其中因队列满而提前发送的次数
+    size_t tx_frame_num;  // 驱动实际发出的数据帧数
+    size_t tx_drop_num;   // 驱动未能发出或缓冲池耗尽而丢弃的数据帧数
+    size_t tx_depth_max;  // 发送队列的最大深度
+    size_t block_num;     // net_run转入阻塞等待的次数
+} net_stat_t;
+
 extern uint8_t net_if_mac[NET_MAC_LEN];
 extern uint8_t net_if_ip[NET_IP_LEN];
-extern buf_t rxbuf, txbuf;  // 一个buf足够单线程使用
+extern buf_t rxbuf[NET_POLL_BUDGET], txbuf;  // 一次轮询批量接收的数据帧，发送用一个buf足够单线程使用
+extern net_stat_t net_stat;
 
+int net_fork();
 int net_init();
-void net_poll();
+int net_poll();
+void net_run();
 int net_in(buf_t *buf, uint16_t protocol, uint8_t *src);
 void net_add_protocol(uint16_t protocol, net_handler_t handler);
+size_t net_protocol_count(uint16_t protocol);
+void net_set_ip(const uint8_t *ip);
+void net_filter_changed();
+int net_filter_update();
 #endif
\ No newline at end of file
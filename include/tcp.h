@@ -23,6 +23,30 @@ typedef struct tcp_key {
     uint16_t host_port;
 } tcp_key_t;
 
+/**
+ * @brief 三元组键的哈希函数，键恰为8字节，按整数做乘法散列
+ *
+ * @param key 三元组键指针
+ * @return uint32_t 哈希值
+ */
+static inline uint32_t tcp_key_hash(const tcp_key_t *key) {
+    uint64_t hash;
+    memcpy(&hash, key, sizeof(hash));
+    hash *= 0x9E3779B97F4A7C15ull;
+    return hash >> 32;
+}
+
+/**
+ * @brief 三元组键的相等比较
+ *
+ * @param a 三元组键指针
+ * @param b 三元组键指针
+ * @return int 相等为1，否则为0
+ */
+static inline int tcp_key_eq(const tcp_key_t *a, const tcp_key_t *b) {
+    return !memcmp(a, b, sizeof(tcp_key_t));
+}
+
 typedef enum tcp_state {
     TCP_STATE_CLOSED,
     TCP_STATE_LISTEN,
@@ -60,13 +84,16 @@ typedef struct tcp_connection {
 #define TCP_HEADER_LEN 20
 #define TCP_RETRANSMISSON_TIMEOUT 3
 #define TCP_MAX_WINDOW_SIZE UINT16_MAX
-#define TCP_MAX_CONN_NUM (MAP_MAX_LEN / (sizeof(tcp_key_t) + sizeof(tcp_conn_t) + sizeof(time_t)))
+#ifndef TCP_MAX_CONN_NUM
+#define TCP_MAX_CONN_NUM (1 << 20)  // 连接表容量上限，存储按需倍增，满时按LRU淘汰最久未活动的连接，可在编译时覆盖
+#endif
 
 typedef void (*tcp_handler_t)(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port);
 
 void tcp_init();
 int tcp_open(uint16_t port, tcp_handler_t handler);
 void tcp_close(uint16_t port);
+size_t tcp_ports(uint16_t *ports, size_t max);
 
 void tcp_in(buf_t *buf, uint8_t *src_ip);
 void tcp_out(tcp_conn_t *tcp_conn, buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port, uint8_t flags);
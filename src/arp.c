@@ -1,5 +1,6 @@
 #include "arp.h"
 
+#include "driver.h"
 #include "ethernet.h"
 #include "net.h"
 
@@ -18,6 +19,17 @@ static const arp_pkt_t arp_init_pkt = {
     .sender_mac = NET_IF_MAC,
     .target_mac = {0}};
 
+/**
+ * @brief 以模板初始化arp包，本机地址按当前的net_if_ip与net_if_mac填写，二者可能与编译时的默认值不同
+ *
+ * @param arp_pkt 要填写的arp包
+ */
+static void arp_pkt_init(arp_pkt_t *arp_pkt) {
+    memcpy(arp_pkt, &arp_init_pkt, sizeof(arp_pkt_t));
+    memcpy(arp_pkt->sender_ip, net_if_ip, NET_IP_LEN);
+    memcpy(arp_pkt->sender_mac, net_if_mac, NET_MAC_LEN);
+}
+
 /**
  * @brief arp地址转换表，<ip,mac>的容器
  *
@@ -30,15 +42,21 @@ map_t arp_table;
  */
 map_t arp_buf;
 
+/**
+ * @brief 发送arp请求用的buffer，不用txbuf：过期回调可能在arp_out查找arp_buf时被调用，此时txbuf可能正装着要发送的数据包
+ *
+ */
+static buf_t arp_req_buf;
+
 /**
  * @brief 打印一条arp表项
  *
  * @param ip 表项的ip地址
  * @param mac 表项的mac地址
- * @param timestamp 表项的更新时间
+ * @param timestamp 表项的更新时间，为协议栈时钟，打印时换算为日历时间
  */
 void arp_entry_print(void *ip, void *mac, time_t *timestamp) {
-    printf("%s | %s | %s\n", iptos(ip), mactos(mac), timetos(*timestamp));
+    printf("%s | %s | %s\n", iptos(ip), mactos(mac), timetos(time(NULL) - (net_now() - *timestamp)));
 }
 
 /**
@@ -57,14 +75,15 @@ void arp_print() {
  * @param target_ip 想要知道的目标的ip地址
  */
 void arp_req(uint8_t *target_ip) {
-    // Step1. 初始化缓冲区
-    buf_init(&txbuf, sizeof(arp_pkt_t));
+    // Step1. 初始化缓冲区，缓冲池耗尽时放弃
+    if (buf_init(&arp_req_buf, sizeof(arp_pkt_t)) < 0)
+        return;
     
     // Step2. 填写ARP报头
-    arp_pkt_t *arp_pkt = (arp_pkt_t *)txbuf.data;
+    arp_pkt_t *arp_pkt = (arp_pkt_t *)arp_req_buf.data;
     
     // 复制初始化模板到缓冲区
-    memcpy(arp_pkt, &arp_init_pkt, sizeof(arp_pkt_t));
+    arp_pkt_init(arp_pkt);
     
     // 设置目标IP地址
     memcpy(arp_pkt->target_ip, target_ip, NET_IP_LEN);
@@ -75,7 +94,29 @@ void arp_req(uint8_t *target_ip) {
     // Step4. 发送 ARP 报文
     // 调用 ethernet_out 函数将 ARP 报文发送出去
     // ARP 请求报文为广播报文，目标 MAC 地址设置为广播地址
-    ethernet_out(&txbuf, ether_broadcast_mac, NET_PROTOCOL_ARP);
+    ethernet_out(&arp_req_buf, ether_broadcast_mac, NET_PROTOCOL_ARP);
+}
+
+/**
+ * @brief 过期回调最近一次重发请求的ip地址，arp_out中的查找惰性清除过期缓存时，arp_out不再为同一地址发送请求
+ *
+ */
+static uint8_t arp_resent_ip[NET_IP_LEN];
+static int arp_resent;
+
+/**
+ * @brief arp_buf的过期回调，等待超过ARP_MIN_INTERVAL仍未收到应答时，缓存的数据包随后被丢弃
+ *        再发送一次arp请求，对方迟到的应答仍可填入arp表，之后发往该地址的数据包不必再等待
+ *        每个缓存的数据包只重发一次，不会因无人应答的地址而反复发送
+ *
+ * @param ip 等待解析的ip地址
+ * @param buf 缓存的数据包
+ * @param timestamp 缓存的时间
+ */
+static void arp_buf_expire(void *ip, void *buf, time_t *timestamp) {
+    arp_req(ip);
+    memcpy(arp_resent_ip, ip, NET_IP_LEN);
+    arp_resent = 1;
 }
 
 /**
@@ -85,12 +126,13 @@ void arp_req(uint8_t *target_ip) {
  * @param target_mac 目标mac地址
  */
 void arp_resp(uint8_t *target_ip, uint8_t *target_mac) {
-    // Step1. 初始化缓冲区
-    buf_init(&txbuf, sizeof(arp_pkt_t));
+    // Step1. 初始化缓冲区，缓冲池耗尽时放弃
+    if (buf_init(&txbuf, sizeof(arp_pkt_t)) < 0)
+        return;
     
     // Step2. 填写 ARP 报头首部
     arp_pkt_t *arp_pkt = (arp_pkt_t *)txbuf.data;
-    memcpy(arp_pkt, &arp_init_pkt, sizeof(arp_pkt_t));
+    arp_pkt_init(arp_pkt);
     // 设置操作类型为 ARP_REPLY（注意字节序转换）
     arp_pkt->opcode16 = swap16(ARP_REPLY);
     // 设置目标IP地址（要回应给谁）
@@ -156,8 +198,8 @@ void arp_in(buf_t *buf, uint8_t *src_mac) {
         // 若该接收报文的 IP 地址没有对应的 arp_buf 缓存
         // 判断接收到的报文是否为 ARP_REQUEST 请求报文
         if (opcode == ARP_REQUEST) {
-            // 检查目标IP是否是本机IP
-            if (memcmp(arp_pkt->target_ip, net_if_ip, NET_IP_LEN) == 0) {
+            // 检查目标IP是否是本机IP，多个worker共用ip/mac时只由0号worker应答，其余worker只更新ARP表
+            if (memcmp(arp_pkt->target_ip, net_if_ip, NET_IP_LEN) == 0 && driver_fanout.index == 0) {
                 // 若是，则认为是请求本主机 MAC 地址的 ARP 请求报文
                 // 调用 arp_resp() 函数回应一个响应报文
                 arp_resp(arp_pkt->sender_ip, arp_pkt->sender_mac);
@@ -186,6 +228,8 @@ void arp_out(buf_t *buf, uint8_t *ip) {
     
     // Step3. 若未找到对应的 MAC 地址，需进一步判断 arp_buf 中是否已经有包
     // 检查 arp_buf 中是否已经有缓存的数据包
+    // 查找时若该地址缓存的包已过期，过期回调已重发了请求
+    arp_resent = 0;
     buf_t *cached_buf = map_get(&arp_buf, ip);
     
     if (cached_buf != NULL) {
@@ -199,7 +243,9 @@ void arp_out(buf_t *buf, uint8_t *ip) {
         map_set(&arp_buf, ip, buf);
         
         // 调用 arp_req() 函数，发送一个请求目标 IP 地址对应的 MAC 地址的 ARP request 报文
-        arp_req(ip);
+        // 过期回调刚为该地址发过请求时不再发送，避免连续两个广播
+        if (!arp_resent || memcmp(arp_resent_ip, ip, NET_IP_LEN) != 0)
+            arp_req(ip);
     }
 }
 
@@ -208,8 +254,10 @@ void arp_out(buf_t *buf, uint8_t *ip) {
  *
  */
 void arp_init() {
-    map_init(&arp_table, NET_IP_LEN, NET_MAC_LEN, 0, ARP_TIMEOUT_SEC, NULL, NULL);
-    map_init(&arp_buf, NET_IP_LEN, sizeof(buf_t), 0, ARP_MIN_INTERVAL, NULL, buf_copy);
+    map_init(&arp_table, NET_IP_LEN, NET_MAC_LEN, 0, ARP_TIMEOUT_SEC, MAP_EVICT_LRU, NULL, NULL, NULL);
+    map_init(&arp_buf, NET_IP_LEN, sizeof(buf_t), ARP_BUF_MAX_NUM, ARP_MIN_INTERVAL, MAP_EVICT_OLDEST, NULL, buf_clone, (map_destructor_t)buf_free);
+    map_set_expire_handler(&arp_buf, arp_buf_expire);
     net_add_protocol(NET_PROTOCOL_ARP, arp_in);
-    arp_req(net_if_ip);
+    if (driver_fanout.index == 0)
+        arp_req(net_if_ip);  // 无偿ARP只由0号worker发出
 }
\ No newline at end of file
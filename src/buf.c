@@ -1,34 +1,460 @@
 #include "buf.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+
+typedef struct buf_pool  // 定长块缓冲池，预先分配，按后进先出复用以保持缓存热度
+{
+    size_t block_len;     // 块大小
+    size_t block_num;     // 块数量
+    size_t used;          // 已启用过的块数量
+    size_t free_num;      // 空闲栈中的块数量
+    uint8_t *blocks;      // 块存储区
+    uint8_t **free_list;  // 空闲块栈
+    uint16_t *refs;       // 各块的引用计数，被多个buf共享时大于1
+} buf_pool_t;
+
+#ifdef __linux__
+#define BUF_BLOCK_ALIGN __attribute__((aligned(4096)))  // 常规块存储区按页对齐，以便整体注册为AF_XDP的UMEM
+#else
+#define BUF_BLOCK_ALIGN
+#endif
+
+static uint8_t buf_mtu_blocks[BUF_MTU_NUM][BUF_MTU_LEN] BUF_BLOCK_ALIGN;
+static uint8_t *buf_mtu_free[BUF_MTU_NUM];
+static uint16_t buf_mtu_refs[BUF_MTU_NUM];
+static uint8_t buf_jumbo_blocks[BUF_JUMBO_NUM][BUF_MAX_LEN];
+static uint8_t *buf_jumbo_free[BUF_JUMBO_NUM];
+static uint16_t buf_jumbo_refs[BUF_JUMBO_NUM];
+
+/**
+ * @brief 缓冲池，按块大小从小到大排列
+ *
+ */
+static buf_pool_t buf_pools[] = {
+    {BUF_MTU_LEN, BUF_MTU_NUM, 0, 0, (uint8_t *)buf_mtu_blocks, buf_mtu_free, buf_mtu_refs},
+    {BUF_MAX_LEN, BUF_JUMBO_NUM, 0, 0, (uint8_t *)buf_jumbo_blocks, buf_jumbo_free, buf_jumbo_refs},
+};
+
+/**
+ * @brief buf拷贝统计
+ *
+ */
+buf_stat_t buf_stat;
+
+#define BUF_POOL_NUM (sizeof(buf_pools) / sizeof(buf_pool_t))
+#define BUF_HANDLE_NUM (2 * (BUF_MTU_NUM + BUF_JUMBO_NUM))  // 引用外部内存的段也占用句柄
+
+/**
+ * @brief buf_alloc分配的buf句柄
+ *
+ */
+static buf_t buf_handles[BUF_HANDLE_NUM];
+static buf_t *buf_handle_free[BUF_HANDLE_NUM];
+static uint8_t buf_handle_freed[BUF_HANDLE_NUM];  // 句柄是否在空闲栈中，用于发现重复释放
+static size_t buf_handle_used, buf_handle_free_num;
+
+/**
+ * @brief 内部函数，为给定大小选取合适的缓冲池
+ *
+ * @param size 所需块大小，包括头部预留空间
+ * @return buf_pool_t* 缓冲池，大小过大为NULL
+ */
+static buf_pool_t *buf_pool_select(size_t size) {
+    for (size_t i = 0; i < BUF_POOL_NUM; i++)
+        if (size <= buf_pools[i].block_len)
+            return &buf_pools[i];
+    return NULL;
+}
+
+/**
+ * @brief 内部函数，查找块所属的缓冲池
+ *
+ * @param block 块起始地址
+ * @return buf_pool_t* 缓冲池，不属于任何缓冲池为NULL
+ */
+static buf_pool_t *buf_pool_of(const uint8_t *block) {
+    for (size_t i = 0; i < BUF_POOL_NUM; i++) {
+        buf_pool_t *pool = &buf_pools[i];
+        if (block >= pool->blocks && block < pool->blocks + pool->block_len * pool->block_num)
+            return pool;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 内部函数，获取块的引用计数
+ *
+ * @param pool 块所属的缓冲池
+ * @param block 块起始地址
+ * @return uint16_t* 引用计数指针
+ */
+static inline uint16_t *buf_block_ref(buf_pool_t *pool, const uint8_t *block) {
+    return &pool->refs[(block - pool->blocks) / pool->block_len];
+}
+
+/**
+ * @brief 内部函数，从缓冲池取出一块，引用计数置为1
+ *
+ * @param pool 缓冲池
+ * @return uint8_t* 块起始地址，缓冲池耗尽为NULL
+ */
+static uint8_t *buf_pool_get(buf_pool_t *pool) {
+    uint8_t *block = NULL;
+    if (pool->free_num)
+        block = pool->free_list[--pool->free_num];
+    else if (pool->used < pool->block_num)
+        block = pool->blocks + pool->block_len * pool->used++;
+    if (block)
+        *buf_block_ref(pool, block) = 1;
+    return block;
+}
+
+/**
+ * @brief 内部函数，释放块的一个引用，引用归零时归还缓冲池
+ *        释放引用已归零的块说明重复释放，该块已在空闲栈中，继续运行会把同一块交给两个buffer，因此直接终止
+ *
+ * @param block 块起始地址
+ */
+static void buf_pool_put(uint8_t *block) {
+    buf_pool_t *pool = buf_pool_of(block);
+    if (pool == NULL)
+        return;
+    uint16_t *ref = buf_block_ref(pool, block);
+    if (*ref == 0) {
+        fprintf(stderr, "Error in buf_pool_put, double free of block %p\n", (void *)block);
+        abort();
+    }
+    if (--*ref == 0)
+        pool->free_list[pool->free_num++] = block;
+}
+
+/**
+ * @brief 判断buffer的块是否被多个buf或驱动共享，共享的块在写入前须拷贝
+ *
+ * @param buf 要判断的buffer
+ * @return int 共享为1，独占或不在缓冲池中为0
+ */
+int buf_shared(const buf_t *buf) {
+    buf_pool_t *pool = buf_pool_of(buf->payload);
+    return pool && *buf_block_ref(pool, buf->payload) > 1;
+}
+
+/**
+ * @brief 内部函数，复制单个段的描述符并增加块的引用计数，不包括链上的后续段
+ *
+ * @param dst 目的段
+ * @param src 源段
+ */
+static void buf_seg_clone(buf_t *dst, const buf_t *src) {
+    buf_pool_t *pool = buf_pool_of(src->payload);
+    memcpy(dst, src, sizeof(buf_t));
+    dst->next = NULL;
+    if (pool)
+        (*buf_block_ref(pool, src->payload))++;
+}
+
+/**
+ * @brief 内部函数，取一个空闲的buf句柄
+ *
+ * @return buf_t* 全零的句柄，耗尽为NULL
+ */
+static buf_t *buf_handle_get() {
+    buf_t *buf;
+    if (buf_handle_free_num)
+        buf = buf_handle_free[--buf_handle_free_num];
+    else if (buf_handle_used < BUF_HANDLE_NUM)
+        buf = &buf_handles[buf_handle_used++];
+    else {
+        fprintf(stderr, "Error in buf_handle_get, no free handle\n");
+        return NULL;
+    }
+    buf_handle_freed[buf - buf_handles] = 0;
+    memset(buf, 0, sizeof(buf_t));
+    return buf;
+}
+
+/**
+ * @brief 内部函数，释放buffer持有的块以及链上的后续各段，buffer本身置零
+ *
+ * @param buf 要释放的buffer
+ */
+static void buf_release(buf_t *buf) {
+    if (buf->payload)
+        buf_pool_put(buf->payload);
+    if (buf->next)
+        buf_free(buf->next);
+    memset(buf, 0, sizeof(buf_t));
+}
+
 /**
  * @brief 初始化buffer为给定的长度，用于装载数据包
+ *        buffer须为全零或已初始化过的，原有的块属于所需的缓冲池且未被共享时复用，链上的后续段被释放
+ *        指向驱动内存（buf_attach/buf_view）的buffer即使容量相同也不复用，改取新块
  *
  * @param buf 要初始化的buffer
  * @param len 数据初始长度
  * @return int 成功为0，失败为-1
  */
 int buf_init(buf_t *buf, size_t len) {
-    if (len >= BUF_MAX_LEN / 2) {
+    buf_pool_t *pool = buf_pool_select(BUF_HEADROOM + len);
+    if (pool == NULL) {
         fprintf(stderr, "Error in buf_init:%zu\n", len);
         return -1;
     }
 
+    if (buf->next) {
+        buf_free(buf->next);
+        buf->next = NULL;
+    }
+
+    if (buf->payload == NULL || buf_pool_of(buf->payload) != pool || buf_shared(buf)) {
+        if (buf->payload)
+            buf_pool_put(buf->payload);
+        buf->payload = buf_pool_get(pool);
+        buf->cap = buf->payload ? pool->block_len : 0;
+        if (buf->payload == NULL) {
+            buf->len = 0;
+            buf->data = NULL;
+            fprintf(stderr, "Error in buf_init, pool exhausted:%zu\n", len);
+            return -1;
+        }
+    }
+
+    buf->len = len;
+    buf->data = buf->payload + BUF_HEADROOM;
+    buf->flags = 0;
+    return 0;
+}
+
+/**
+ * @brief 从缓冲池分配一个buffer
+ *
+ * @param len 数据初始长度
+ * @return buf_t* 分配的buffer，失败为NULL
+ */
+buf_t *buf_alloc(size_t len) {
+    buf_t *buf = buf_handle_get();
+    if (buf == NULL)
+        return NULL;
+    if (buf_init(buf, len) < 0) {
+        buf_handle_free[buf_handle_free_num++] = buf;
+        return NULL;
+    }
+    return buf;
+}
+
+/**
+ * @brief 引用一段外部内存（如应用数据或文件映射）作为链中的一段，不拷贝数据
+ *        该段没有头部空间且不可写，被引用的内存须在数据包发出前保持有效
+ *
+ * @param data 外部内存地址
+ * @param len 长度
+ * @return buf_t* 引用该内存的段，失败为NULL
+ */
+buf_t *buf_ref(const uint8_t *data, size_t len) {
+    buf_t *buf = buf_handle_get();
+    if (buf == NULL)
+        return NULL;
+    buf->data = (uint8_t *)data;
+    buf->len = len;
+    return buf;
+}
+
+/**
+ * @brief 将buffer指向驱动持有的一段可写内存（如接收环中的数据帧），不拷贝数据，原有的块被释放
+ *        [mem, mem+offset)作为头部空间，该内存的生命周期由驱动控制，克隆时退化为拷贝
+ *        mem为buf_block_get取得的常规块时，buffer接管该块的一个引用，之后与普通buffer无异
+ *
+ * @param buf 要设置的buffer
+ * @param mem 内存起始地址
+ * @param cap 内存大小
+ * @param offset 数据相对mem的偏移
+ * @param len 数据长度
+ */
+void buf_attach(buf_t *buf, uint8_t *mem, size_t cap, size_t offset, size_t len) {
+    buf_release(buf);
+    buf->payload = mem;
+    buf->cap = cap;
+    buf->data = mem + offset;
+    buf->len = len;
+}
+
+/**
+ * @brief 将buffer设为驱动内存的只读视图（如pcap_next_ex返回的数据帧），不拷贝数据，原有的块被释放
+ *        视图只在驱动下一次接收前有效，各层去除的协议头仍留在[payload, data)中，恢复协议头只需移动data
+ *        写入（buf_add_header/buf_add_padding/buf_unshare）时连同已去除的协议头拷贝到缓冲池，克隆时退化为拷贝
+ *
+ * @param buf 要设置的buffer
+ * @param mem 数据帧起始地址
+ * @param len 数据帧长度
+ */
+void buf_view(buf_t *buf, const uint8_t *mem, size_t len) {
+    buf_release(buf);
+    buf->payload = (uint8_t *)mem;
+    buf->data = (uint8_t *)mem;
     buf->len = len;
-    buf->data = buf->payload + BUF_MAX_LEN / 2 - len;
+}
+
+/**
+ * @brief 获取常规块的存储区，供驱动整体注册给内核（如AF_XDP的UMEM），块大小为BUF_MTU_LEN
+ *
+ * @param num 出口参数，块数量
+ * @return uint8_t* 存储区起始地址
+ */
+uint8_t *buf_block_area(size_t *num) {
+    *num = BUF_MTU_NUM;
+    return (uint8_t *)buf_mtu_blocks;
+}
+
+/**
+ * @brief 取出一个常规块交给驱动，引用计数为1，可经buf_attach交给buffer或经buf_block_put归还
+ *
+ * @return uint8_t* 块起始地址，缓冲池耗尽为NULL
+ */
+uint8_t *buf_block_get() {
+    return buf_pool_get(&buf_pools[0]);
+}
+
+/**
+ * @brief 增加块的一个引用，如驱动在内核发送完成前持有buffer的块，协议栈之后写入该块时写时拷贝
+ *
+ * @param block 块起始地址，不属于缓冲池时忽略
+ */
+void buf_block_hold(uint8_t *block) {
+    buf_pool_t *pool = buf_pool_of(block);
+    if (pool)
+        (*buf_block_ref(pool, block))++;
+}
+
+/**
+ * @brief 释放块的一个引用，引用归零时归还缓冲池
+ *
+ * @param block 块起始地址，不属于缓冲池时忽略
+ */
+void buf_block_put(uint8_t *block) {
+    buf_pool_put(block);
+}
+
+/**
+ * @brief 生成引用buffer链中[offset, offset+len)区间的新链，块以引用计数共享，不拷贝数据
+ *
+ * @param buf 源buffer链
+ * @param offset 区间起始偏移
+ * @param len 区间长度
+ * @return buf_t* 新链的首段，失败为NULL
+ */
+buf_t *buf_slice(const buf_t *buf, size_t offset, size_t len) {
+    buf_t *head = NULL, **tail = &head;
+    for (; buf && len; buf = buf->next) {
+        if (offset >= buf->len) {
+            offset -= buf->len;
+            continue;
+        }
+        buf_t *seg = buf_handle_get();
+        if (seg == NULL)
+            break;
+        size_t seg_len = buf->len - offset < len ? buf->len - offset : len;
+        buf_seg_clone(seg, buf);
+        seg->data += offset;
+        seg->len = seg_len;
+        *tail = seg;
+        tail = &seg->next;
+        offset = 0;
+        len -= seg_len;
+    }
+    if (len && head) {
+        buf_free(head);
+        return NULL;
+    }
+    return head;
+}
+
+/**
+ * @brief 将一段（或一条链）追加到buffer链的末尾，其所有权随之转移
+ *
+ * @param buf buffer链
+ * @param seg 要追加的段
+ */
+void buf_chain(buf_t *buf, buf_t *seg) {
+    while (buf->next)
+        buf = buf->next;
+    buf->next = seg;
+}
+
+/**
+ * @brief 获取buffer链的总长度
+ *
+ * @param buf buffer链
+ * @return size_t 各段长度之和
+ */
+size_t buf_chain_len(const buf_t *buf) {
+    size_t len = 0;
+    for (; buf; buf = buf->next)
+        len += buf->len;
+    return len;
+}
+
+/**
+ * @brief 判断buffer链的各段是否都位于缓冲池中，此时buf_clone只共享块而不拷贝
+ *
+ * @param buf buffer链
+ * @return int 都在缓冲池中为1，有段引用外部内存或驱动内存为0
+ */
+int buf_pooled(const buf_t *buf) {
+    for (; buf; buf = buf->next)
+        if (buf_pool_of(buf->payload) == NULL)
+            return 0;
+    return 1;
+}
+
+/**
+ * @brief 将buffer链合并为单个连续的块，保留首段的头部空间
+ *
+ * @param buf 要合并的buffer链
+ * @return int 成功为0，失败为-1
+ */
+int buf_linearize(buf_t *buf) {
+    if (buf->next == NULL)
+        return 0;
+    buf_t flat;
+    buf_copy(&flat, buf, 0);
+    if (flat.payload == NULL)
+        return -1;
+    buf_release(buf);
+    memcpy(buf, &flat, sizeof(buf_t));
     return 0;
 }
 
 /**
- * @brief 为buffer在头部增加一段长度，用于添加协议头
+ * @brief 释放buffer链占用的块和句柄，由buf_alloc等分配的句柄被归还，静态的buffer只释放其块
+ *        重复释放句柄或块时终止程序
+ *
+ * @param buf 要释放的buffer
+ */
+void buf_free(buf_t *buf) {
+    int handle = buf >= buf_handles && buf < buf_handles + BUF_HANDLE_NUM;
+    if (handle && buf_handle_freed[buf - buf_handles]) {
+        fprintf(stderr, "Error in buf_free, double free of handle %p\n", (void *)buf);
+        abort();
+    }
+    buf_release(buf);
+    if (handle) {
+        buf_handle_freed[buf - buf_handles] = 1;
+        buf_handle_free[buf_handle_free_num++] = buf;
+    }
+}
+
+/**
+ * @brief 为buffer在头部增加一段长度，用于添加协议头，块被共享或为只读视图时先写时拷贝
  *
  * @param buf 要修改的buffer
  * @param len 增加的长度
  * @return int 成功为0，失败为-1
  */
 int buf_add_header(buf_t *buf, size_t len) {
-    if (buf->data - len < buf->payload) {
+    if (buf->payload == NULL || buf->data < buf->payload + len || buf_unshare(buf) < 0) {
         fprintf(stderr, "Error in buf_add_header:%zu+%zu\n", buf->len, len);
         return -1;
     }
@@ -55,14 +481,15 @@ int buf_remove_header(buf_t *buf, size_t len) {
 }
 
 /**
- * @brief 为buffer在尾部添加一段长度，填充0
+ * @brief 为buffer在尾部添加一段长度，填充0，块被共享或为只读视图时先写时拷贝
  *
  * @param buf 要修改的buffer
  * @param len 添加的长度
  * @return int 成功为0，失败为-1
  */
 int buf_add_padding(buf_t *buf, size_t len) {
-    if (buf->data + buf->len + len >= buf->payload + BUF_MAX_LEN) {
+    // 只读视图没有尾部空间，先拷贝到缓冲池再检查
+    if (buf->payload == NULL || buf_unshare(buf) < 0 || buf->data + buf->len + len >= buf->payload + buf->cap) {
         fprintf(stderr, "Error in buf_add_padding:%zu+%zu\n", buf->len, len);
         return -1;
     }
@@ -88,7 +515,8 @@ int buf_remove_padding(buf_t *buf, size_t len) {
 }
 
 /**
- * @brief buf拷贝构造函数
+ * @brief buf拷贝构造函数，目的buffer视为未初始化，从缓冲池取新块并拷贝有效数据
+ *        源buffer为链时各段被合并到同一块中，源buffer引用外部内存时留出默认的头部空间
  *
  * @param pdst 目的buffer
  * @param psrc 源buffer
@@ -97,6 +525,123 @@ int buf_remove_padding(buf_t *buf, size_t len) {
 void buf_copy(void *pdst, const void *psrc, size_t len) {
     buf_t *dst = pdst;
     const buf_t *src = psrc;
-    buf_init(dst, src->len);
-    memcpy(dst->payload, src->payload, BUF_MAX_LEN);
+    size_t offset = buf_pool_of(src->payload) ? src->data - src->payload : BUF_HEADROOM;
+    size_t total = buf_chain_len(src);
+    buf_pool_t *pool = buf_pool_select(offset + total);
+    memset(dst, 0, sizeof(buf_t));
+    if (pool == NULL || (dst->payload = buf_pool_get(pool)) == NULL) {
+        fprintf(stderr, "Error in buf_copy, pool exhausted:%zu\n", total);
+        return;
+    }
+    dst->cap = pool->block_len;
+    dst->len = total;
+    dst->flags = src->flags;
+    dst->data = dst->payload + offset;
+    for (uint8_t *p = dst->data; src; p += src->len, src = src->next)
+        memcpy(p, src->data, src->len);
+    buf_stat.copy_num++;
+    buf_stat.copy_bytes += total;
+}
+
+/**
+ * @brief 内部函数，克隆单个段，不包括链上的后续段
+ *        缓冲池中的块以引用计数共享；外部内存（buf_ref的段、驱动内存）的生命周期不受协议栈控制，拷贝到缓冲池
+ *
+ * @param dst 目的段，视为未初始化
+ * @param src 源段
+ * @param headroom 拷贝时在数据前留出的头部空间
+ * @return int 成功为0，缓冲池耗尽为-1
+ */
+static int buf_seg_dup(buf_t *dst, const buf_t *src, size_t headroom) {
+    if (buf_pool_of(src->payload)) {
+        buf_seg_clone(dst, src);
+        return 0;
+    }
+    buf_pool_t *pool = buf_pool_select(headroom + src->len);
+    uint8_t *block = pool ? buf_pool_get(pool) : NULL;
+    memset(dst, 0, sizeof(buf_t));
+    if (block == NULL) {
+        fprintf(stderr, "Error in buf_clone, pool exhausted:%zu\n", src->len);
+        return -1;
+    }
+    dst->payload = block;
+    dst->cap = pool->block_len;
+    dst->data = block + headroom;
+    dst->len = src->len;
+    memcpy(dst->data, src->data, src->len);
+    buf_stat.copy_num++;
+    buf_stat.copy_bytes += src->len;
+    return 0;
+}
+
+/**
+ * @brief buf克隆构造函数，目的buffer视为未初始化，与源buffer共享块，只持有各自的data/len窗口
+ *        之后任一方通过buf_add_header/buf_add_padding写入时才进行拷贝，直接写data前须调用buf_unshare
+ *        源buffer为链时逐段克隆，链的结构保持不变；引用外部内存的段退化为拷贝，首段留出默认的头部空间
+ *        失败时目的buffer的payload为NULL
+ *
+ * @param pdst 目的buffer
+ * @param psrc 源buffer
+ * @param len 占位用，与memcpy保持形式一致，无意义
+ */
+void buf_clone(void *pdst, const void *psrc, size_t len) {
+    buf_t *dst = pdst;
+    const buf_t *src = psrc;
+    if (buf_seg_dup(dst, src, BUF_HEADROOM) < 0)
+        return;
+    dst->flags = src->flags;
+    buf_t **tail = &dst->next;
+    for (src = src->next; src; src = src->next) {
+        buf_t *seg = buf_handle_get();
+        if (seg == NULL || buf_seg_dup(seg, src, 0) < 0) {
+            if (seg)
+                buf_free(seg);
+            buf_release(dst);
+            return;
+        }
+        *tail = seg;
+        tail = &seg->next;
+    }
+    buf_stat.clone_num++;
+}
+
+/**
+ * @brief 若buffer的块被共享或为只读视图，为其拷贝出一个独占的块，用于写入前
+ *
+ * @param buf 要处理的buffer
+ * @return int 成功为0，失败为-1
+ */
+int buf_unshare(buf_t *buf) {
+    if (buf->payload && buf->cap == 0) {
+        // 只读视图：连同已去除的协议头一起拷贝，各层恢复协议头时偏移不变
+        size_t offset = buf->data - buf->payload;
+        buf_pool_t *pool = buf_pool_select(BUF_HEADROOM + offset + buf->len);
+        uint8_t *block = pool ? buf_pool_get(pool) : NULL;
+        if (block == NULL) {
+            fprintf(stderr, "Error in buf_unshare, pool exhausted:%zu\n", buf->len);
+            return -1;
+        }
+        memcpy(block + BUF_HEADROOM, buf->payload, offset + buf->len);
+        buf->payload = block;
+        buf->cap = pool->block_len;
+        buf->data = block + BUF_HEADROOM + offset;
+        buf_stat.cow_num++;
+        buf_stat.cow_bytes += offset + buf->len;
+        return 0;
+    }
+    if (!buf_shared(buf))
+        return 0;
+    uint8_t *block = buf_pool_get(buf_pool_of(buf->payload));
+    if (block == NULL) {
+        fprintf(stderr, "Error in buf_unshare, pool exhausted:%zu\n", buf->len);
+        return -1;
+    }
+    size_t offset = buf->data - buf->payload;
+    memcpy(block + offset, buf->data, buf->len);
+    buf_pool_put(buf->payload);
+    buf->payload = block;
+    buf->data = block + offset;
+    buf_stat.cow_num++;
+    buf_stat.cow_bytes += buf->len;
+    return 0;
 }
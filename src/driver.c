@@ -1,36 +1,61 @@
 #include "driver.h"
 
 #include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern const net_driver_ops_t driver_pcap_ops;
+extern const net_driver_ops_t driver_replay_ops;
+extern const net_driver_ops_t driver_netem_ops;
+#ifdef __linux__
+extern const net_driver_ops_t driver_packet_ops;
+extern const net_driver_ops_t driver_tap_ops;
+extern const net_driver_ops_t driver_xdp_ops;
+extern const net_driver_ops_t driver_wire_ops;
+#endif
+#ifdef TEST
+extern const net_driver_ops_t driver_pcapfile_ops;
+#endif
 
-#ifdef _WIN32
-#include <tchar.h>
 /**
- * @brief npcp官方提供的加载npcap的dll库函数
+ * @brief 已注册的驱动后端，内置后端在此静态注册，其余后端在net_init前调用driver_register
  *
- * @return BOOL 是否成功
  */
-BOOL LoadNpcapDlls() {
-    _TCHAR npcap_dir[512];
-    UINT len;
-    len = GetSystemDirectory(npcap_dir, 480);
-    if (!len) {
-        fprintf(stderr, "Error in GetSystemDirectory: %lx", GetLastError());
-        return FALSE;
-    }
-    _tcscat_s(npcap_dir, 512, _T("\\Npcap"));
-    if (SetDllDirectory(npcap_dir) == 0) {
-        fprintf(stderr, "Error in SetDllDirectory: %lx", GetLastError());
-        return FALSE;
-    }
-    return TRUE;
-}
+static const net_driver_ops_t *driver_table[NET_DRIVER_MAX_NUM] = {
+    &driver_pcap_ops,
+    &driver_replay_ops,
+    &driver_netem_ops,
+#ifdef __linux__
+    &driver_packet_ops,
+    &driver_tap_ops,
+    &driver_xdp_ops,
+    &driver_wire_ops,
+#endif
+#ifdef TEST
+    &driver_pcapfile_ops,
 #endif
+};
+
+/**
+ * @brief 驱动系统调用统计
+ *
+ */
+driver_stat_t driver_stat;
+
+/**
+ * @brief 本进程在fanout组中的身份
+ *
+ */
+driver_fanout_t driver_fanout;
 
-pcap_t *pcap;
-char pcap_errbuf[PCAP_ERRBUF_SIZE];
+static const net_driver_ops_t *driver;   // 当前选用的后端
+static char driver_arg[PCAP_BUF_SIZE];   // 传给后端open的参数
+static int driver_has_arg;               // 是否指定了参数
 
 /**
- * @brief 根据ip进行前缀匹配，选取最长前缀匹配的网卡
+ * @brief 根据ip进行前缀匹配，选取最长前缀匹配的网卡，供需要网卡名的后端在未指定网卡时使用
  *
  * @param ip ip地址
  * @param if_name 出口参数，选取的网卡名
@@ -45,8 +70,9 @@ int driver_find(uint8_t *ip, char *if_name, uint8_t *mask) {
     uint8_t match[PCAP_BUF_SIZE] = {0};
     size_t if_num = 0;
     uint32_t mask_all = PCAP_NETMASK_UNKNOWN;
-    if (pcap_findalldevs(&alldevs, pcap_errbuf) == -1) {
-        fprintf(stderr, "Error in pcap_findalldevs: %s\n", pcap_errbuf);
+    char errbuf[PCAP_ERRBUF_SIZE];
+    if (pcap_findalldevs(&alldevs, errbuf) == -1) {
+        fprintf(stderr, "Error in pcap_findalldevs: %s\n", errbuf);
         return -1;
     }
 
@@ -86,102 +112,235 @@ int driver_find(uint8_t *ip, char *if_name, uint8_t *mask) {
 }
 
 /**
- * @brief 打开网卡
+ * @brief 注册一个驱动后端
  *
- * @return int 成功为0，失败为-1
+ * @param ops 后端操作表，须在程序运行期间保持有效
+ * @return int 成功为0，重名或已满为-1
  */
-int driver_open() {
-#ifdef _WIN32
-    /* Load Npcap and its functions. */
-    if (!LoadNpcapDlls()) {
-        fprintf(stderr, "Couldn't load Npcap\n");
-        return -1;
+int driver_register(const net_driver_ops_t *ops) {
+    for (int i = 0; i < NET_DRIVER_MAX_NUM; i++) {
+        if (driver_table[i] == NULL) {
+            driver_table[i] = ops;
+            return 0;
+        }
+        if (strcmp(driver_table[i]->name, ops->name) == 0) {
+            fprintf(stderr, "Error in driver_register: driver %s already registered.\n", ops->name);
+            return -1;
+        }
     }
-#endif
+    fprintf(stderr, "Error in driver_register: too many drivers.\n");
+    return -1;
+}
 
-    char if_name[PCAP_BUF_SIZE];
-    uint32_t mask;
-    if (driver_find(net_if_ip, if_name, (uint8_t *)&mask) < 0) {
-        fprintf(stderr, "Error in driver find.\n");
-        return -1;
-    }
-    printf("Using interface %s, my ip is %s.\n", if_name, iptos(net_if_ip));
+/**
+ * @brief 按名称查找已注册的驱动后端，供包装其他后端的后端使用
+ *
+ * @param name 后端名
+ * @return const net_driver_ops_t* 后端操作表，未找到为NULL
+ */
+const net_driver_ops_t *driver_lookup(const char *name) {
+    for (int i = 0; i < NET_DRIVER_MAX_NUM && driver_table[i]; i++)
+        if (strcmp(driver_table[i]->name, name) == 0)
+            return driver_table[i];
+    return NULL;
+}
 
-    if ((pcap = pcap_open_live(if_name, 65536, 1, 10, pcap_errbuf)) == NULL)  // 混杂模式打开网卡
-    {
-        fprintf(stderr, "Error in pcap_open_live.\n%s.\n", pcap_errbuf);
-        return -1;
-    }
-    if (pcap_setnonblock(pcap, 1, pcap_errbuf) < 0)  // 设置非阻塞模式
-    {
-        fprintf(stderr, "Error in pcap_setnonblock. %s.\n", pcap_errbuf);
-        return -1;
+/**
+ * @brief 按名称选择驱动后端，须在driver_open前调用
+ *
+ * @param spec 形如"名称"或"名称:参数"，参数原样传给后端的open
+ * @return int 成功为0，未找到为-1
+ */
+int driver_select(const char *spec) {
+    const char *sep = strchr(spec, ':');
+    size_t len = sep ? (size_t)(sep - spec) : strlen(spec);
+    for (int i = 0; i < NET_DRIVER_MAX_NUM && driver_table[i]; i++) {
+        if (strlen(driver_table[i]->name) == len && strncmp(driver_table[i]->name, spec, len) == 0) {
+            driver = driver_table[i];
+            driver_has_arg = sep != NULL;
+            snprintf(driver_arg, sizeof(driver_arg), "%s", sep ? sep + 1 : "");
+            return 0;
+        }
     }
-    char filter_exp[PCAP_BUF_SIZE];
-    struct bpf_program fp;
-    uint8_t mac_addr[6] = NET_IF_MAC;
-    sprintf(filter_exp,  // 过滤数据包
-            "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
-            mac_addr[0],
-            mac_addr[1],
-            mac_addr[2],
-            mac_addr[3],
-            mac_addr[4],
-            mac_addr[5],
-            mac_addr[0],
-            mac_addr[1],
-            mac_addr[2],
-            mac_addr[3],
-            mac_addr[4],
-            mac_addr[5]);
-    if (pcap_compile(pcap, &fp, filter_exp, 0, mask) < 0) {
-        fprintf(stderr, "Error in pcap_compile.\n%s.\n", pcap_geterr(pcap));
-        return -1;
+    fprintf(stderr, "Error in driver_select: no driver named %.*s, available:", (int)len, spec);
+    for (int i = 0; i < NET_DRIVER_MAX_NUM && driver_table[i]; i++)
+        fprintf(stderr, " %s", driver_table[i]->name);
+    fprintf(stderr, ".\n");
+    return -1;
+}
+
+/**
+ * @brief 获取当前选用的驱动后端
+ *
+ * @return const net_driver_ops_t* 后端操作表，未选择时为NULL
+ */
+const net_driver_ops_t *driver_current() {
+    return driver;
+}
+
+/**
+ * @brief 打开网卡，未调用driver_select时按环境变量NET_DRIVER或NET_DRIVER_DEFAULT选择后端
+ *
+ * @return int 成功为0，失败为-1
+ */
+int driver_open() {
+    if (driver == NULL) {
+        const char *spec = getenv("NET_DRIVER");
+        if (driver_select(spec && *spec ? spec : NET_DRIVER_DEFAULT) < 0)
+            return -1;
     }
-    if (pcap_setfilter(pcap, &fp) < 0) {
-        fprintf(stderr, "Error in pcap_setfilter.\n%s.\n", pcap_geterr(pcap));
+    if (driver_fanout.num > 1 && !(driver->caps & DRIVER_CAP_FANOUT)) {
+        // 不支持fanout的后端会使每个worker都收到全部数据帧
+        fprintf(stderr, "Error in driver_open: driver %s does not support multiple workers.\n", driver->name);
         return -1;
     }
-    return 0;
+    return driver->open(driver_has_arg ? driver_arg : NULL);
 }
+
 /**
  * @brief 试图从网卡接收数据包
  *
  * @param buf 收到的数据包
- * @return int 数据包的长度，未收到为0，错误为-1
+ * @return int 数据包的长度，未收到为0，错误或未选择后端为-1
  */
 int driver_recv(buf_t *buf) {
-    struct pcap_pkthdr *pkt_hdr;
-    const uint8_t *pkt_data;
-    int ret = pcap_next_ex(pcap, &pkt_hdr, &pkt_data);
-    if (ret == 0)
-        return 0;
-    else if (ret == 1) {
-        memcpy(buf->data, pkt_data, pkt_hdr->len);
-        buf->len = pkt_hdr->len;
-        return pkt_hdr->len;
-    }
-    fprintf(stderr, "Error in driver_recv.\n%s.\n", pcap_geterr(pcap));
-    return -1;
+    if (driver == NULL)
+        return -1;
+    return driver->recv(buf);
 }
+
+/**
+ * @brief 试图从网卡批量接收数据包，一次调用至多接收n个
+ *
+ * @param bufs 收到的数据包
+ * @param n 最多接收的数据包数
+ * @return int 收到的数据包数，未收到为0，错误为-1
+ */
+int driver_recv_burst(buf_t *bufs, int n) {
+    return driver_recv_with(driver, bufs, n);
+}
+
+/**
+ * @brief 使用指定的后端批量接收数据包，后端不支持批量接收时逐个调用recv
+ *
+ * @param ops 后端操作表，为NULL时返回-1
+ * @param bufs 收到的数据包
+ * @param n 最多接收的数据包数
+ * @return int 收到的数据包数，未收到为0，错误为-1
+ */
+int driver_recv_with(const net_driver_ops_t *ops, buf_t *bufs, int n) {
+    if (ops == NULL)
+        return -1;
+    if (ops->recv_burst)
+        return ops->recv_burst(bufs, n);
+    int num = 0;
+    for (int ret; num < n; num++)
+        if ((ret = ops->recv(&bufs[num])) <= 0)
+            return (ret < 0 && num == 0) ? -1 : num;
+    return num;
+}
+
 /**
  * @brief 使用网卡发送一个数据包
  *
- * @param buf 要发送的数据包
- * @return int 成功为0，失败为-1
+ * @param buf 要发送的数据包，可以是buffer链
+ * @return int 成功为0，失败或未选择后端为-1
  */
 int driver_send(buf_t *buf) {
-    if (pcap_sendpacket(pcap, buf->data, buf->len) == -1) {
-        fprintf(stderr, "Error in driver_send.\n%s.\n", pcap_geterr(pcap));
+    if (driver == NULL)
         return -1;
-    }
+    return driver->send(buf);
+}
 
-    return 0;
+/**
+ * @brief 使用网卡批量发送数据包
+ *
+ * @param bufs 要发送的数据包，可以是buffer链
+ * @param n 数据包数
+ * @return int 发送成功的数据包数，全部失败为-1
+ */
+int driver_send_burst(buf_t *bufs, int n) {
+    return driver_send_with(driver, bufs, n);
+}
+
+/**
+ * @brief 使用指定的后端批量发送数据包，后端不支持批量发送时逐个调用send
+ *
+ * @param ops 后端操作表，为NULL时返回-1
+ * @param bufs 要发送的数据包，可以是buffer链
+ * @param n 数据包数
+ * @return int 发送成功的数据包数，全部失败为-1
+ */
+int driver_send_with(const net_driver_ops_t *ops, buf_t *bufs, int n) {
+    if (ops == NULL)
+        return -1;
+    if (ops->send_burst)
+        return ops->send_burst(bufs, n);
+    for (int i = 0; i < n; i++)
+        if (ops->send(&bufs[i]) < 0)
+            return i ? i : -1;
+    return n;
 }
+
 /**
- * @brief 关闭网卡
+ * @brief 关闭网卡，未选择后端时不做处理
  *
  */
 void driver_close() {
-    pcap_close(pcap);
+    if (driver)
+        driver->close();
+}
+
+/**
+ * @brief 获取可用于select/epoll等待的文件描述符
+ *
+ * @return int 文件描述符，后端不支持时为-1
+ */
+int driver_fd() {
+    return (driver && driver->fd) ? driver->fd() : -1;
+}
+
+/**
+ * @brief 获取单调时钟，单位为纳秒，用于统计耗时，不受系统时间调整影响
+ *
+ * @return uint64_t 当前时间
+ */
+static uint64_t driver_clock_ns() {
+    struct timespec ts;
+#ifdef __linux__
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief 重新编译并替换内核中的过滤器，计入重新生成的次数与耗时
+ *
+ * @param filter_exp pcap过滤表达式
+ * @return int 成功为0，后端不支持过滤时为0且不计数，失败为-1
+ */
+int driver_filter(const char *filter_exp) {
+    if (driver == NULL || driver->filter == NULL)
+        return 0;
+    uint64_t start = driver_clock_ns();
+    if (driver->filter(filter_exp) < 0)
+        return -1;
+    uint64_t ns = driver_clock_ns() - start;
+    driver_stat.filter_num++;
+    driver_stat.filter_ns += ns;
+    if (ns > driver_stat.filter_max_ns)
+        driver_stat.filter_max_ns = ns;
+    return 0;
 }
+
+/**
+ * @brief 获取当前后端的能力标志
+ *
+ * @return uint32_t DRIVER_CAP_*的组合
+ */
+uint32_t driver_caps() {
+    return driver ? driver->caps : 0;
+}
+
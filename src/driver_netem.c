@@ -0,0 +1,549 @@
+#include "driver.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+typedef struct driver_netem_slot  // 队列中等待到期的一帧
+{
+    uint64_t due_us;                          // 到期时刻，协议栈时钟，单位为微秒
+    uint64_t seq;                             // 入队序号，同时到期的帧按入队顺序交出
+    uint32_t len;                             // 帧长
+    uint8_t data[DRIVER_NETEM_FRAME_SIZE];    // 数据帧
+} driver_netem_slot_t;
+
+typedef struct driver_netem_link  // 一个方向的损伤参数与队列
+{
+    double delay_us;                  // 固定时延
+    double jitter_us;                 // 时延在±jitter_us内均匀抖动，可能使帧乱序
+    double loss;                      // 丢包率
+    double burst;                     // 平均连续丢包数，不大于1时各帧独立丢弃
+    double reorder;                   // 不经时延直接交出、越过队列中的帧的比例
+    double dup;                       // 重复的比例
+    double rate;                      // 带宽上限，字节每微秒，0为不限
+    double bucket;                    // 令牌桶深度，字节
+    size_t limit;                     // 队列最多容纳的帧数
+    uint64_t rng;                     // 随机数状态，两个方向各自独立，结果只取决于种子与帧序列
+    int bad;                          // 突发丢包模型处于坏状态
+    double tokens;                    // 令牌桶在tb_us时刻的令牌数
+    double tb_us;                     // 令牌桶上次结算的时刻，即上一帧离开的时刻
+    uint64_t seq;                     // 下一个入队序号
+    driver_netem_slot_t *slots;       // 帧槽
+    uint32_t *heap;                   // 按到期时刻排列的最小堆，元素为帧槽下标
+    size_t heap_num;                  // 堆中的帧数
+    uint32_t *free;                   // 空闲帧槽下标的栈
+    size_t free_num;                  // 空闲帧槽数
+    driver_netem_link_stat_t *stat;   // 该方向的统计
+} driver_netem_link_t;
+
+typedef struct driver_netem  // 网络仿真后端的状态
+{
+    const net_driver_ops_t *inner;          // 被包装的后端
+    driver_netem_link_t rx;                 // 接收方向，内层后端收到的帧经此交给协议栈
+    driver_netem_link_t tx;                 // 发送方向，协议栈发出的帧经此交给内层后端
+    buf_t inner_bufs[NET_POLL_BUDGET];      // 从内层后端接收的帧，拷贝入队后即可复用
+    uint32_t rx_taken[NET_POLL_BUDGET];     // 上一次接收交出、尚未归还的帧槽
+    int rx_taken_num;                       // 上一次接收交出的帧数
+    int epoll_fd;                           // 合并内层后端的文件描述符与定时器，供net_run等待
+    int timer_fd;                           // 在最早的帧到期时可读
+    uint64_t timer_ms;                      // 定时器当前设定的到期时刻，0为未设定
+} driver_netem_t;
+
+/**
+ * @brief 网络仿真统计
+ *
+ */
+driver_netem_stat_t driver_netem_stat;
+
+static driver_netem_t netem = {.epoll_fd = -1, .timer_fd = -1};
+
+/**
+ * @brief 生成[0, 1)内均匀分布的随机数，xorshift64*
+ *
+ * @param link 方向
+ * @return double 随机数
+ */
+static double driver_netem_rand(driver_netem_link_t *link) {
+    link->rng ^= link->rng >> 12;
+    link->rng ^= link->rng << 25;
+    link->rng ^= link->rng >> 27;
+    return ((link->rng * 0x2545F4914F6CDD1Dull) >> 11) * (1.0 / (1ull << 53));
+}
+
+/**
+ * @brief 判断帧a是否应先于帧b交出
+ *
+ * @param link 方向
+ * @param a 帧槽下标
+ * @param b 帧槽下标
+ * @return int 是为1
+ */
+static int driver_netem_before(driver_netem_link_t *link, uint32_t a, uint32_t b) {
+    driver_netem_slot_t *sa = &link->slots[a], *sb = &link->slots[b];
+    return sa->due_us < sb->due_us || (sa->due_us == sb->due_us && sa->seq < sb->seq);
+}
+
+/**
+ * @brief 将帧槽放入到期时刻的最小堆
+ *
+ * @param link 方向
+ * @param slot 帧槽下标
+ */
+static void driver_netem_push(driver_netem_link_t *link, uint32_t slot) {
+    size_t i = link->heap_num++;
+    for (; i && driver_netem_before(link, slot, link->heap[(i - 1) / 2]); i = (i - 1) / 2)
+        link->heap[i] = link->heap[(i - 1) / 2];
+    link->heap[i] = slot;
+}
+
+/**
+ * @brief 取出最早到期的帧槽
+ *
+ * @param link 方向，堆不为空
+ * @return uint32_t 帧槽下标
+ */
+static uint32_t driver_netem_pop(driver_netem_link_t *link) {
+    uint32_t top = link->heap[0], last = link->heap[--link->heap_num];
+    size_t i = 0;
+    for (size_t child; (child = 2 * i + 1) < link->heap_num; i = child) {
+        if (child + 1 < link->heap_num && driver_netem_before(link, link->heap[child + 1], link->heap[child]))
+            child++;
+        if (!driver_netem_before(link, link->heap[child], last))
+            break;
+        link->heap[i] = link->heap[child];
+    }
+    link->heap[i] = last;
+    return top;
+}
+
+/**
+ * @brief 判断队首的帧是否已到期
+ *
+ * @param link 方向
+ * @param now_us 当前时刻
+ * @return int 是为1
+ */
+static int driver_netem_due(driver_netem_link_t *link, uint64_t now_us) {
+    return link->heap_num && link->slots[link->heap[0]].due_us <= now_us;
+}
+
+/**
+ * @brief 按丢包率决定是否丢弃一帧
+ *        burst大于1时使用两状态模型：好状态以p进入坏状态，坏状态每帧以1/burst回到好状态，坏状态中的帧全部丢弃
+ *        取p = loss / (burst * (1 - loss))，使稳态丢包率为loss，平均连续丢包数为burst
+ *
+ * @param link 方向
+ * @return int 丢弃为1
+ */
+static int driver_netem_lose(driver_netem_link_t *link) {
+    if (link->loss <= 0)
+        return 0;
+    if (link->burst <= 1 || link->loss >= 1)
+        return driver_netem_rand(link) < link->loss;
+    if (link->bad)
+        link->bad = driver_netem_rand(link) >= 1 / link->burst;
+    else
+        link->bad = driver_netem_rand(link) < link->loss / (link->burst * (1 - link->loss));
+    return link->bad;
+}
+
+/**
+ * @brief 令牌桶限速，帧在令牌足够时离开，令牌不足时等待补足，之后的帧排在其后
+ *
+ * @param link 方向
+ * @param now_us 帧到达的时刻
+ * @param len 帧长
+ * @return double 帧离开的时刻
+ */
+static double driver_netem_shape(driver_netem_link_t *link, double now_us, size_t len) {
+    if (link->rate <= 0)
+        return now_us;
+    double t = now_us > link->tb_us ? now_us : link->tb_us;
+    double tokens = link->tokens + (t - link->tb_us) * link->rate;
+    if (tokens > link->bucket)
+        tokens = link->bucket;
+    if (tokens >= len) {
+        link->tokens = tokens - len;
+    } else {
+        t += (len - tokens) / link->rate;
+        link->tokens = 0;
+    }
+    link->tb_us = t;
+    return t;
+}
+
+/**
+ * @brief 一帧进入一个方向：按丢包率丢弃，按重复率复制，限速后加上时延与抖动放入队列
+ *
+ * @param link 方向
+ * @param buf 数据帧，可以是buffer链
+ * @param now_us 当前时刻
+ */
+static void driver_netem_enqueue(driver_netem_link_t *link, buf_t *buf, uint64_t now_us) {
+    link->stat->frames++;
+    if (driver_netem_lose(link)) {
+        link->stat->lost++;
+        return;
+    }
+    int copies = 1;
+    if (link->dup > 0 && driver_netem_rand(link) < link->dup) {
+        copies = 2;
+        link->stat->duplicated++;
+    }
+    size_t len = buf_chain_len(buf);
+    for (int i = 0; i < copies; i++) {
+        // Step1: 帧过长或队列已满时丢弃，如同路由器的队列溢出
+        if (len > DRIVER_NETEM_FRAME_SIZE || link->free_num == 0) {
+            link->stat->overflow++;
+            continue;
+        }
+        uint32_t index = link->free[--link->free_num];
+        driver_netem_slot_t *slot = &link->slots[index];
+        slot->len = 0;
+        for (buf_t *seg = buf; seg; seg = seg->next) {
+            memcpy(slot->data + slot->len, seg->data, seg->len);
+            slot->len += seg->len;
+        }
+
+        // Step2: 限速决定离开时刻，再加上时延与抖动，乱序的帧不经时延直接越过队列
+        double due = driver_netem_shape(link, now_us, len);
+        if (link->reorder > 0 && driver_netem_rand(link) < link->reorder) {
+            link->stat->reordered++;
+        } else {
+            double delay = link->delay_us + (link->jitter_us > 0 ? (2 * driver_netem_rand(link) - 1) * link->jitter_us : 0);
+            due += delay > 0 ? delay : 0;
+        }
+        slot->due_us = (uint64_t)due;
+        slot->seq = link->seq++;
+        driver_netem_push(link, index);
+    }
+}
+
+/**
+ * @brief 将发送方向已到期的帧交给内层后端
+ *
+ * @param now_us 当前时刻
+ */
+static void driver_netem_flush(uint64_t now_us) {
+    driver_netem_link_t *link = &netem.tx;
+    buf_t bufs[NET_TX_RING_SIZE];
+    uint32_t slots[NET_TX_RING_SIZE];
+    while (driver_netem_due(link, now_us)) {
+        int num = 0;
+        memset(bufs, 0, sizeof(bufs));
+        for (; num < NET_TX_RING_SIZE && driver_netem_due(link, now_us); num++) {
+            slots[num] = driver_netem_pop(link);
+            buf_view(&bufs[num], link->slots[slots[num]].data, link->slots[slots[num]].len);
+        }
+        int sent = driver_send_with(netem.inner, bufs, num);
+        link->stat->delivered += sent > 0 ? sent : 0;
+        link->stat->overflow += num - (sent > 0 ? sent : 0);
+        for (int i = 0; i < num; i++) {
+            buf_free(&bufs[i]);
+            link->free[link->free_num++] = slots[i];
+        }
+    }
+}
+
+/**
+ * @brief 将定时器设为两个方向中最早的帧的到期时刻，没有排队的帧时撤销
+ *        设定值不变时不发起系统调用，重新设定同时清除定时器的可读状态
+ *
+ * @param syscalls 计入的系统调用统计，接收或发送路径
+ */
+static void driver_netem_arm(size_t *syscalls) {
+#ifdef __linux__
+    if (netem.timer_fd < 0)
+        return;
+    uint64_t due_us = 0;
+    if (netem.rx.heap_num)
+        due_us = netem.rx.slots[netem.rx.heap[0]].due_us;
+    if (netem.tx.heap_num && (due_us == 0 || netem.tx.slots[netem.tx.heap[0]].due_us < due_us))
+        due_us = netem.tx.slots[netem.tx.heap[0]].due_us;
+    // 协议栈时钟为毫秒精度，向上取整，使定时器到期后协议栈时钟一定已越过帧的到期时刻
+    uint64_t due_ms = (due_us + 999) / 1000;
+    if (netem.rx.heap_num + netem.tx.heap_num == 0)
+        due_ms = 0;
+    if (due_ms == netem.timer_ms)
+        return;
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = due_ms / 1000;
+    spec.it_value.tv_nsec = due_ms % 1000 * 1000000;
+    (*syscalls)++;
+    if (timerfd_settime(netem.timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+        fprintf(stderr, "Error in driver_netem_arm: %s.\n", strerror(errno));
+    netem.timer_ms = due_ms;
+#endif
+}
+
+/**
+ * @brief 解析一个方向的损伤参数
+ *
+ * @param link 方向
+ * @param key 参数名，已去除方向前缀
+ * @param val 参数值
+ * @return int 成功为0，未知参数为-1
+ */
+static int driver_netem_option(driver_netem_link_t *link, const char *key, const char *val) {
+    double v = atof(val);
+    if (v < 0)
+        return -1;
+    if (strcmp(key, "delay") == 0)
+        link->delay_us = v * 1000;
+    else if (strcmp(key, "jitter") == 0)
+        link->jitter_us = v * 1000;
+    else if (strcmp(key, "loss") == 0)
+        link->loss = v / 100;
+    else if (strcmp(key, "burst") == 0)
+        link->burst = v;
+    else if (strcmp(key, "reorder") == 0)
+        link->reorder = v / 100;
+    else if (strcmp(key, "dup") == 0)
+        link->dup = v / 100;
+    else if (strcmp(key, "rate") == 0)
+        link->rate = v / 8;  // Mbit/s即每微秒v/8字节
+    else if (strcmp(key, "bucket") == 0)
+        link->bucket = v;
+    else if (strcmp(key, "limit") == 0 && v >= 1)
+        link->limit = (size_t)v;
+    else
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief 为一个方向分配队列并设置随机数种子
+ *
+ * @param link 方向
+ * @param stat 该方向的统计
+ * @param seed 随机数种子
+ * @return int 成功为0，失败为-1
+ */
+static int driver_netem_link_init(driver_netem_link_t *link, driver_netem_link_stat_t *stat, uint64_t seed) {
+    link->stat = stat;
+    link->rng = seed ? seed : 1;
+    if (link->rate > 0 && link->bucket < DRIVER_NETEM_FRAME_SIZE)
+        link->bucket = DRIVER_NETEM_FRAME_SIZE;  // 令牌桶至少容纳一个最长的帧
+    link->tokens = link->bucket;
+    link->slots = malloc(link->limit * sizeof(driver_netem_slot_t));
+    link->heap = malloc(link->limit * sizeof(uint32_t));
+    link->free = malloc(link->limit * sizeof(uint32_t));
+    if (link->slots == NULL || link->heap == NULL || link->free == NULL) {
+        fprintf(stderr, "Error in driver_netem_open: out of memory.\n");
+        return -1;
+    }
+    for (size_t i = 0; i < link->limit; i++)
+        link->free[i] = link->limit - 1 - i;
+    link->free_num = link->limit;
+    return 0;
+}
+
+/**
+ * @brief 关闭内层后端，释放队列与文件描述符
+ *
+ */
+static void driver_netem_close() {
+    if (netem.inner)
+        netem.inner->close();
+    for (int i = 0; i < NET_POLL_BUDGET; i++)
+        buf_free(&netem.inner_bufs[i]);
+    driver_netem_link_t *links[] = {&netem.rx, &netem.tx};
+    for (int i = 0; i < 2; i++) {
+        free(links[i]->slots);
+        free(links[i]->heap);
+        free(links[i]->free);
+    }
+#ifdef __linux__
+    if (netem.epoll_fd >= 0)
+        close(netem.epoll_fd);
+    if (netem.timer_fd >= 0)
+        close(netem.timer_fd);
+#endif
+    memset(&netem, 0, sizeof(netem));
+    netem.epoll_fd = netem.timer_fd = -1;
+}
+
+/**
+ * @brief 打开内层后端并设置两个方向的损伤
+ *
+ * @param arg 形如"内层后端[:参数][;选项,...]"，例如"wire:0;delay=10,jitter=2,loss=1,rate=100"
+ *            选项delay与jitter单位为毫秒，loss、reorder与dup为百分比，burst为平均连续丢包数，
+ *            rate为带宽上限(Mbit/s)，bucket为令牌桶深度(字节)，limit为队列长度(帧)，seed为随机数种子
+ *            选项加"rx_"或"tx_"前缀时只作用于接收或发送方向，否则作用于两个方向
+ * @return int 成功为0，失败为-1
+ */
+static int driver_netem_open(const char *arg) {
+    char spec[PCAP_BUF_SIZE];
+    snprintf(spec, sizeof(spec), "%s", arg ? arg : "");
+    char *opts = strchr(spec, ';');
+    if (opts)
+        *opts++ = '\0';
+
+    // Step1: 找到内层后端，网络仿真不能嵌套
+    char *inner_arg = strchr(spec, ':');
+    if (inner_arg)
+        *inner_arg++ = '\0';
+    driver_netem_close();
+    memset(&driver_netem_stat, 0, sizeof(driver_netem_stat));
+    netem.inner = driver_lookup(spec);
+    if (netem.inner == NULL || strcmp(netem.inner->name, "netem") == 0) {
+        fprintf(stderr, "Error in driver_netem_open: no inner driver named %s.\n", spec);
+        netem.inner = NULL;
+        return -1;
+    }
+
+    // Step2: 解析选项
+    uint64_t seed = 1;
+    netem.rx.limit = netem.tx.limit = DRIVER_NETEM_LIMIT;
+    for (char *opt = opts ? strtok(opts, ",") : NULL; opt; opt = strtok(NULL, ",")) {
+        char *val = strchr(opt, '=');
+        if (val)
+            *val++ = '\0';
+        int ret = -1;
+        if (val && strcmp(opt, "seed") == 0) {
+            seed = strtoull(val, NULL, 10);
+            ret = 0;
+        } else if (val && strncmp(opt, "rx_", 3) == 0)
+            ret = driver_netem_option(&netem.rx, opt + 3, val);
+        else if (val && strncmp(opt, "tx_", 3) == 0)
+            ret = driver_netem_option(&netem.tx, opt + 3, val);
+        else if (val)
+            ret = driver_netem_option(&netem.rx, opt, val) | driver_netem_option(&netem.tx, opt, val);
+        if (ret < 0) {
+            fprintf(stderr, "Error in driver_netem_open: bad option %s.\n", opt);
+            netem.inner = NULL;
+            driver_netem_close();
+            return -1;
+        }
+    }
+
+    // Step3: 分配队列，两个方向的随机数序列由同一个种子导出
+    if (driver_netem_link_init(&netem.rx, &driver_netem_stat.rx, seed * 0x9E3779B97F4A7C15ull) < 0 ||
+        driver_netem_link_init(&netem.tx, &driver_netem_stat.tx, ~seed * 0xBF58476D1CE4E5B9ull) < 0 || netem.inner->open(inner_arg) < 0) {
+        netem.inner = NULL;
+        driver_netem_close();
+        return -1;
+    }
+
+#ifdef __linux__
+    // Step4: 内层后端可等待时，将其文件描述符与定时器合并到一个epoll中
+    int fd = netem.inner->fd ? netem.inner->fd() : -1;
+    if (fd >= 0) {
+        netem.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        netem.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);  // 与协议栈时钟一致，为CLOCK_MONOTONIC
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+        struct epoll_event tev = {.events = EPOLLIN, .data.fd = netem.timer_fd};
+        if (netem.epoll_fd < 0 || netem.timer_fd < 0 || epoll_ctl(netem.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0 ||
+            epoll_ctl(netem.epoll_fd, EPOLL_CTL_ADD, netem.timer_fd, &tev) < 0) {
+            fprintf(stderr, "Error in driver_netem_open: %s.\n", strerror(errno));
+            driver_netem_close();
+            return -1;
+        }
+    }
+#endif
+    return 0;
+}
+
+/**
+ * @brief 从内层后端接收数据帧放入接收方向的队列，交出已到期的帧
+ *        交出的帧直接引用队列中的帧槽，在下一次接收时归还；发送方向到期的帧也在此交给内层后端
+ *
+ * @param bufs 收到的数据包
+ * @param n 最多接收的数据包数
+ * @return int 收到的数据包数，未收到为0，错误为-1
+ */
+static int driver_netem_recv_burst(buf_t *bufs, int n) {
+    driver_netem_link_t *link = &netem.rx;
+    uint64_t now_us = net_now_ms() * 1000;
+    for (int i = 0; i < netem.rx_taken_num; i++)
+        link->free[link->free_num++] = netem.rx_taken[i];
+    netem.rx_taken_num = 0;
+
+    // Step1: 发送方向到期的帧不依赖协议栈再次发送，每次轮询时交出
+    driver_netem_flush(now_us);
+
+    // Step2: 内层后端收到的帧立即拷贝入队，内层的缓冲区随即可复用
+    int num = driver_recv_with(netem.inner, netem.inner_bufs, n < NET_POLL_BUDGET ? n : NET_POLL_BUDGET);
+    for (int i = 0; i < num; i++)
+        driver_netem_enqueue(link, &netem.inner_bufs[i], now_us);
+
+    // Step3: 交出到期的帧
+    int out = 0;
+    for (; out < n && out < NET_POLL_BUDGET && driver_netem_due(link, now_us); out++) {
+        uint32_t index = driver_netem_pop(link);
+        netem.rx_taken[out] = index;
+        buf_view(&bufs[out], link->slots[index].data, link->slots[index].len);
+    }
+    netem.rx_taken_num = out;
+    link->stat->delivered += out;
+    driver_netem_arm(&driver_stat.rx_syscalls);
+    return (num < 0 && out == 0) ? -1 : out;
+}
+
+/**
+ * @brief 接收一个数据帧
+ *
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0
+ */
+static int driver_netem_recv(buf_t *buf) {
+    int ret = driver_netem_recv_burst(buf, 1);
+    return ret > 0 ? (int)buf->len : ret;
+}
+
+/**
+ * @brief 将数据帧放入发送方向的队列，已到期的帧立即交给内层后端
+ *
+ * @param bufs 要发送的数据包，可以是buffer链
+ * @param n 数据包数
+ * @return int 发送成功的数据包数，被仿真丢弃的帧也视为已发送
+ */
+static int driver_netem_send_burst(buf_t *bufs, int n) {
+    uint64_t now_us = net_now_ms() * 1000;
+    for (int i = 0; i < n; i++)
+        driver_netem_enqueue(&netem.tx, &bufs[i], now_us);
+    driver_netem_flush(now_us);
+    driver_netem_arm(&driver_stat.tx_syscalls);
+    return n;
+}
+
+/**
+ * @brief 发送一个数据帧
+ *
+ * @param buf 要发送的数据包，可以是buffer链
+ * @return int 成功为0
+ */
+static int driver_netem_send(buf_t *buf) {
+    return driver_netem_send_burst(buf, 1) == 1 ? 0 : -1;
+}
+
+/**
+ * @brief 获取可用于select/epoll等待的文件描述符，内层后端的帧到达或排队的帧到期时可读
+ *
+ * @return int 文件描述符，内层后端不可等待时为-1
+ */
+static int driver_netem_fd() {
+    return netem.epoll_fd;
+}
+
+/**
+ * @brief 网络仿真驱动，包装另一个后端，为收发两个方向分别加上时延、抖动、丢包、乱序、重复与限速
+ *        全部由协议栈时钟驱动，相同的种子与帧序列得到相同的损伤
+ *
+ */
+const net_driver_ops_t driver_netem_ops = {
+    .name = "netem",
+    .caps = DRIVER_CAP_RECV_BURST | DRIVER_CAP_SEND_BURST | DRIVER_CAP_FD | DRIVER_CAP_RECV_INPLACE,
+    .open = driver_netem_open,
+    .recv = driver_netem_recv,
+    .recv_burst = driver_netem_recv_burst,
+    .send = driver_netem_send,
+    .send_burst = driver_netem_send_burst,
+    .close = driver_netem_close,
+    .fd = driver_netem_fd,
+};
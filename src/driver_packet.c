@@ -0,0 +1,399 @@
+#include "driver.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <pcap.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define DRIVER_PACKET_TX_OFFSET TPACKET_ALIGN(sizeof(struct tpacket3_hdr))  // 发送帧槽中数据相对帧头的偏移
+#define DRIVER_PACKET_TX_BLOCK_SIZE (DRIVER_PACKET_FRAME_SIZE * 32)         // 发送环的块大小
+
+typedef struct driver_packet  // AF_PACKET后端的状态
+{
+    int fd;                        // packet套接字
+    uint8_t *ring;                 // mmap的环，接收环在前，发送环在后
+    size_t ring_len;               // 环的总大小
+    size_t rx_block;               // 正在读取的接收块序号，单调递增
+    size_t rx_release;             // 下一个要归还内核的接收块序号
+    size_t rx_left;                // 正在读取的块中剩余的帧数
+    struct tpacket3_hdr *rx_pkt;   // 正在读取的块中下一帧，为NULL表示尚未取得该块
+    size_t tx_frame;               // 下一个要填写的发送帧槽序号，单调递增
+    int arp_fd;                    // 多个worker时单独接收ARP的套接字，不加入fanout组，否则为-1
+    int epoll_fd;                  // 多个worker时合并等待两个套接字的epoll，否则为-1
+} driver_packet_t;
+
+static driver_packet_t packet = {.fd = -1, .arp_fd = -1, .epoll_fd = -1};
+
+/**
+ * @brief 获取接收环中的块
+ *
+ * @param i 块序号
+ * @return struct tpacket_block_desc* 块描述符
+ */
+static inline struct tpacket_block_desc *driver_packet_block(size_t i) {
+    return (struct tpacket_block_desc *)(packet.ring + (i % DRIVER_PACKET_BLOCK_NUM) * DRIVER_PACKET_BLOCK_SIZE);
+}
+
+/**
+ * @brief 获取发送环中的帧槽
+ *
+ * @param i 帧槽序号
+ * @return struct tpacket3_hdr* 帧头
+ */
+static inline struct tpacket3_hdr *driver_packet_tx_frame(size_t i) {
+    uint8_t *tx_ring = packet.ring + (size_t)DRIVER_PACKET_BLOCK_NUM * DRIVER_PACKET_BLOCK_SIZE;
+    return (struct tpacket3_hdr *)(tx_ring + (i % DRIVER_PACKET_TX_FRAME_NUM) * DRIVER_PACKET_FRAME_SIZE);
+}
+
+/**
+ * @brief 在套接字上挂载BPF过滤器，借用libpcap编译过滤表达式，已有的过滤器被原子地替换
+ *
+ * @param filter_exp pcap过滤表达式
+ * @return int 成功为0，失败为-1
+ */
+static int driver_packet_filter(const char *filter_exp) {
+    struct bpf_program fp;
+    if (driver_filter_compile(filter_exp, &fp) < 0)
+        return -1;
+    // struct bpf_insn与内核的struct sock_filter布局相同
+    struct sock_fprog prog = {.len = fp.bf_len, .filter = (struct sock_filter *)fp.bf_insns};
+    int ret = setsockopt(packet.fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+    pcap_freecode(&fp);
+    if (ret < 0) {
+        fprintf(stderr, "Error in SO_ATTACH_FILTER: %s.\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 配置TPACKET_V3的接收环与发送环并映射到用户空间
+ *
+ * @return int 成功为0，失败为-1
+ */
+static int driver_packet_ring() {
+    int version = TPACKET_V3;
+    if (setsockopt(packet.fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        fprintf(stderr, "Error in PACKET_VERSION: %s.\n", strerror(errno));
+        return -1;
+    }
+    struct tpacket_req3 rx_req = {
+        .tp_block_size = DRIVER_PACKET_BLOCK_SIZE,
+        .tp_block_nr = DRIVER_PACKET_BLOCK_NUM,
+        .tp_frame_size = DRIVER_PACKET_FRAME_SIZE,
+        .tp_frame_nr = DRIVER_PACKET_BLOCK_SIZE / DRIVER_PACKET_FRAME_SIZE * DRIVER_PACKET_BLOCK_NUM,
+        .tp_retire_blk_tov = DRIVER_PACKET_BLOCK_TIMEOUT,
+    };
+    if (setsockopt(packet.fd, SOL_PACKET, PACKET_RX_RING, &rx_req, sizeof(rx_req)) < 0) {
+        fprintf(stderr, "Error in PACKET_RX_RING: %s.\n", strerror(errno));
+        return -1;
+    }
+    // 发送环按帧使用，块只是内核分配内存的单位
+    struct tpacket_req3 tx_req = {
+        .tp_block_size = DRIVER_PACKET_TX_BLOCK_SIZE,
+        .tp_block_nr = DRIVER_PACKET_TX_FRAME_NUM * DRIVER_PACKET_FRAME_SIZE / DRIVER_PACKET_TX_BLOCK_SIZE,
+        .tp_frame_size = DRIVER_PACKET_FRAME_SIZE,
+        .tp_frame_nr = DRIVER_PACKET_TX_FRAME_NUM,
+    };
+    if (setsockopt(packet.fd, SOL_PACKET, PACKET_TX_RING, &tx_req, sizeof(tx_req)) < 0) {
+        fprintf(stderr, "Error in PACKET_TX_RING: %s.\n", strerror(errno));
+        return -1;
+    }
+    packet.ring_len = (size_t)DRIVER_PACKET_BLOCK_NUM * DRIVER_PACKET_BLOCK_SIZE + (size_t)DRIVER_PACKET_TX_FRAME_NUM * DRIVER_PACKET_FRAME_SIZE;
+    packet.ring = mmap(NULL, packet.ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, packet.fd, 0);
+    if (packet.ring == MAP_FAILED) {
+        packet.ring = NULL;
+        fprintf(stderr, "Error in mmap: %s.\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 加入driver_fanout指定的fanout组，按流的哈希在各worker间分担IP数据帧，分片先重组再分发以落在同一个worker
+ *        ARP帧不参与分担，每个worker另开一个套接字收到全部ARP帧，各自的ARP表保持一致
+ *
+ * @param ifindex 网卡序号
+ * @return int 成功为0，失败为-1
+ */
+static int driver_packet_fanout(int ifindex) {
+    int arg = driver_fanout.group | (PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16;
+    if (setsockopt(packet.fd, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0) {
+        fprintf(stderr, "Error in PACKET_FANOUT: %s.\n", strerror(errno));
+        return -1;
+    }
+    packet.arp_fd = socket(AF_PACKET, SOCK_RAW | SOCK_NONBLOCK, 0);
+    if (packet.arp_fd < 0) {
+        fprintf(stderr, "Error in socket(AF_PACKET): %s.\n", strerror(errno));
+        return -1;
+    }
+    // 各worker发出的ARP帧对本机而言都是外发的，一并忽略
+    int one = 1;
+    setsockopt(packet.arp_fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+    struct sockaddr_ll addr = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ARP),
+        .sll_ifindex = ifindex,
+    };
+    if (bind(packet.arp_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Error in bind: %s.\n", strerror(errno));
+        return -1;
+    }
+    // 对外只提供一个可等待的文件描述符，两个套接字任一可读时可读
+    packet.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = packet.fd};
+    struct epoll_event arp_ev = {.events = EPOLLIN, .data.fd = packet.arp_fd};
+    if (packet.epoll_fd < 0 || epoll_ctl(packet.epoll_fd, EPOLL_CTL_ADD, packet.fd, &ev) < 0 || epoll_ctl(packet.epoll_fd, EPOLL_CTL_ADD, packet.arp_fd, &arp_ev) < 0) {
+        fprintf(stderr, "Error in epoll: %s.\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void driver_packet_close();
+
+/**
+ * @brief 打开网卡，driver_fanout指定了多个worker时加入其fanout组
+ *
+ * @param arg 网卡名，为NULL时按本机ip选取网卡
+ * @return int 成功为0，失败为-1
+ */
+static int driver_packet_open(const char *arg) {
+    char if_name[PCAP_BUF_SIZE];
+    uint32_t mask;
+    if (arg)
+        snprintf(if_name, sizeof(if_name), "%s", arg);
+    else if (driver_find(net_if_ip, if_name, (uint8_t *)&mask) < 0) {
+        fprintf(stderr, "Error in driver find.\n");
+        return -1;
+    }
+    int ifindex = if_nametoindex(if_name);
+    if (ifindex == 0) {
+        fprintf(stderr, "Error in if_nametoindex: %s %s.\n", if_name, strerror(errno));
+        return -1;
+    }
+    printf("Using interface %s, my ip is %s.\n", if_name, iptos(net_if_ip));
+
+    // Step1: 以协议号0创建套接字，此时不接收任何数据帧，环和过滤器就绪后再绑定
+    memset(&packet, 0, sizeof(packet));
+    packet.arp_fd = -1;
+    packet.epoll_fd = -1;
+    packet.fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (packet.fd < 0) {
+        fprintf(stderr, "Error in socket(AF_PACKET): %s.\n", strerror(errno));
+        return -1;
+    }
+
+    // Step2: 挂载过滤器，配置并映射收发环，协议栈初始化后按打开的端口收窄过滤器
+    char filter_exp[PCAP_BUF_SIZE];
+    driver_filter_exp(filter_exp, sizeof(filter_exp));
+    if (driver_packet_filter(filter_exp) < 0 || driver_packet_ring() < 0) {
+        driver_packet_close();
+        return -1;
+    }
+    int one = 1;
+    setsockopt(packet.fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));  // 发送绕过qdisc，不支持时忽略
+
+    // Step3: 绑定网卡并开启混杂模式，fanout组只分担IP数据帧
+    struct sockaddr_ll addr = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(driver_fanout.num > 1 ? ETH_P_IP : ETH_P_ALL),
+        .sll_ifindex = ifindex,
+    };
+    if (bind(packet.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Error in bind: %s.\n", strerror(errno));
+        driver_packet_close();
+        return -1;
+    }
+    struct packet_mreq mreq = {.mr_ifindex = ifindex, .mr_type = PACKET_MR_PROMISC};
+    if (setsockopt(packet.fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        fprintf(stderr, "Error in PACKET_ADD_MEMBERSHIP: %s.\n", strerror(errno));
+        driver_packet_close();
+        return -1;
+    }
+
+    // Step4: 多个worker时加入fanout组
+    if (driver_fanout.num > 1 && driver_packet_fanout(ifindex) < 0) {
+        driver_packet_close();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 从单独的ARP套接字读取一帧，拷贝到缓冲池的块中
+ *
+ * @param buf 收到的数据帧
+ * @return int 收到为1，未收到为0
+ */
+static int driver_packet_recv_arp(buf_t *buf) {
+    if (buf_init(buf, BUF_MTU_LEN - BUF_HEADROOM) < 0)
+        return 0;
+    driver_stat.rx_syscalls++;
+    ssize_t len = recv(packet.arp_fd, buf->data, buf->len, 0);
+    if (len <= 0) {
+        buf->len = 0;
+        return 0;
+    }
+    buf->len = len;
+    return 1;
+}
+
+/**
+ * @brief 试图从接收环批量取出数据帧，buf直接引用环中的内存，不拷贝
+ *        上一次取出的数据帧此时已处理完毕，其间读完的块在此归还内核
+ *
+ * @param bufs 收到的数据包
+ * @param n 最多接收的数据包数
+ * @return int 收到的数据包数，未收到为0
+ */
+static int driver_packet_recv_burst(buf_t *bufs, int n) {
+    for (; packet.rx_release < packet.rx_block; packet.rx_release++)
+        __atomic_store_n(&driver_packet_block(packet.rx_release)->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+    int num = 0;
+    while (num < n) {
+        if (packet.rx_pkt == NULL) {
+            struct tpacket_block_desc *block = driver_packet_block(packet.rx_block);
+            if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+                break;  // 内核尚未交出下一块
+            packet.rx_pkt = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+            packet.rx_left = block->hdr.bh1.num_pkts;
+        }
+        for (; packet.rx_left && num < n; packet.rx_left--) {
+            struct tpacket3_hdr *pkt = packet.rx_pkt;
+            // 从帧头起挂载，帧头与sockaddr_ll所在的tp_mac之前作为头部空间，到下一帧（或块末尾）之前作为尾部空间
+            // 帧头在此之后不再读取，上层添加协议头时可以覆盖
+            uint8_t *end = pkt->tp_next_offset ? (uint8_t *)pkt + pkt->tp_next_offset
+                                               : (uint8_t *)driver_packet_block(packet.rx_block) + DRIVER_PACKET_BLOCK_SIZE;
+            buf_attach(&bufs[num], (uint8_t *)pkt, end - (uint8_t *)pkt, pkt->tp_mac, pkt->tp_snaplen);
+            // 本机经veth等虚拟网卡发出的数据帧传输层校验和尚未计算（CSUMNOTREADY），或已由网卡校验，均无需软件校验
+            // 该标志只涉及传输层，IP头部校验和仍由ip_in检查
+            if (pkt->tp_status & (TP_STATUS_CSUMNOTREADY | TP_STATUS_CSUM_VALID))
+                bufs[num].flags |= BUF_FLAG_CSUM_VERIFIED;
+            num++;
+            packet.rx_pkt = (struct tpacket3_hdr *)((uint8_t *)pkt + pkt->tp_next_offset);
+        }
+        if (packet.rx_left == 0) {
+            // 该块读完，在下一次接收时归还
+            packet.rx_pkt = NULL;
+            packet.rx_block++;
+        }
+    }
+    // ARP帧很少，只在接收环取空时读取，每次至多一帧
+    if (packet.arp_fd >= 0 && num < n)
+        num += driver_packet_recv_arp(&bufs[num]);
+    return num;
+}
+
+/**
+ * @brief 试图从接收环取出一个数据帧
+ *
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0
+ */
+static int driver_packet_recv(buf_t *buf) {
+    return driver_packet_recv_burst(buf, 1) ? buf->len : 0;
+}
+
+/**
+ * @brief 将数据帧写入发送环后通知内核批量发送，buffer链直接聚集拷贝进帧槽
+ *
+ * @param bufs 要发送的数据包，可以是buffer链
+ * @param n 数据包数
+ * @return int 发送成功的数据包数，全部失败为-1
+ */
+static int driver_packet_send_burst(buf_t *bufs, int n) {
+    int num = 0, waited = 0;
+    while (num < n) {
+        struct tpacket3_hdr *hdr = driver_packet_tx_frame(packet.tx_frame);
+        if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+            // 发送环已满，阻塞地通知内核发送已填写的帧，等其腾出帧槽后重试一次
+            if (waited++ || (driver_stat.tx_syscalls++, send(packet.fd, NULL, 0, 0)) < 0)
+                break;
+            continue;
+        }
+        size_t len = buf_chain_len(&bufs[num]);
+        if (len > DRIVER_PACKET_FRAME_SIZE - DRIVER_PACKET_TX_OFFSET) {
+            fprintf(stderr, "Error in driver_packet_send_burst: frame too long %zu.\n", len);
+            break;
+        }
+        uint8_t *p = (uint8_t *)hdr + DRIVER_PACKET_TX_OFFSET;
+        for (buf_t *seg = &bufs[num]; seg; p += seg->len, seg = seg->next)
+            memcpy(p, seg->data, seg->len);
+        hdr->tp_len = len;
+        hdr->tp_snaplen = len;
+        hdr->tp_next_offset = 0;
+        __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+        packet.tx_frame++;
+        num++;
+    }
+    if (num && (driver_stat.tx_syscalls++, send(packet.fd, NULL, 0, MSG_DONTWAIT)) < 0 && errno != EAGAIN && errno != ENOBUFS) {
+        fprintf(stderr, "Error in driver_packet_send_burst: %s.\n", strerror(errno));
+        return -1;
+    }
+    return num ? num : -1;
+}
+
+/**
+ * @brief 使用网卡发送一个数据包
+ *
+ * @param buf 要发送的数据包，可以是buffer链
+ * @return int 成功为0，失败为-1
+ */
+static int driver_packet_send(buf_t *buf) {
+    return driver_packet_send_burst(buf, 1) == 1 ? 0 : -1;
+}
+
+/**
+ * @brief 关闭网卡，解除环的映射
+ *
+ */
+static void driver_packet_close() {
+    if (packet.ring)
+        munmap(packet.ring, packet.ring_len);
+    if (packet.fd >= 0)
+        close(packet.fd);
+    if (packet.arp_fd >= 0)
+        close(packet.arp_fd);
+    if (packet.epoll_fd >= 0)
+        close(packet.epoll_fd);
+    memset(&packet, 0, sizeof(packet));
+    packet.fd = -1;
+    packet.arp_fd = -1;
+    packet.epoll_fd = -1;
+}
+
+/**
+ * @brief 获取可用于select/epoll等待的文件描述符，接收环有块交给用户时可读，多个worker时ARP套接字可读时也可读
+ *
+ * @return int 文件描述符
+ */
+static int driver_packet_fd() {
+    return packet.epoll_fd >= 0 ? packet.epoll_fd : packet.fd;
+}
+
+/**
+ * @brief Linux AF_PACKET驱动，TPACKET_V3内存映射的收发环，接收的数据帧在环中原地处理
+ *
+ */
+const net_driver_ops_t driver_packet_ops = {
+    .name = "afpacket",
+    .caps = DRIVER_CAP_RECV_BURST | DRIVER_CAP_SEND_BURST | DRIVER_CAP_FD | DRIVER_CAP_RECV_INPLACE | DRIVER_CAP_FANOUT,
+    .open = driver_packet_open,
+    .recv = driver_packet_recv,
+    .recv_burst = driver_packet_recv_burst,
+    .send = driver_packet_send,
+    .send_burst = driver_packet_send_burst,
+    .close = driver_packet_close,
+    .fd = driver_packet_fd,
+    .filter = driver_packet_filter,
+};
+#endif
@@ -0,0 +1,311 @@
+#include "driver.h"
+
+#include <pcap.h>
+
+#ifdef _WIN32
+#include <tchar.h>
+/**
+ * @brief npcp官方提供的加载npcap的dll库函数
+ *
+ * @return BOOL 是否成功
+ */
+static BOOL LoadNpcapDlls() {
+    _TCHAR npcap_dir[512];
+    UINT len;
+    len = GetSystemDirectory(npcap_dir, 480);
+    if (!len) {
+        fprintf(stderr, "Error in GetSystemDirectory: %lx", GetLastError());
+        return FALSE;
+    }
+    _tcscat_s(npcap_dir, 512, _T("\\Npcap"));
+    if (SetDllDirectory(npcap_dir) == 0) {
+        fprintf(stderr, "Error in SetDllDirectory: %lx", GetLastError());
+        return FALSE;
+    }
+    return TRUE;
+}
+#endif
+
+static pcap_t *pcap;
+static char pcap_errbuf[PCAP_ERRBUF_SIZE];
+static int pcap_view;  // 只读视图接收模式，数据帧不拷贝，直接引用libpcap的内存
+
+/**
+ * @brief 生成只接收发往本机的数据帧的过滤表达式，供基于BPF过滤的各后端使用
+ *
+ * @param filter_exp 出口参数，pcap过滤表达式
+ * @param len filter_exp的大小
+ */
+void driver_filter_exp(char *filter_exp, size_t len) {
+    uint8_t mac_addr[6] = NET_IF_MAC;
+    snprintf(filter_exp,
+             len,
+             "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
+             mac_addr[0],
+             mac_addr[1],
+             mac_addr[2],
+             mac_addr[3],
+             mac_addr[4],
+             mac_addr[5],
+             mac_addr[0],
+             mac_addr[1],
+             mac_addr[2],
+             mac_addr[3],
+             mac_addr[4],
+             mac_addr[5]);
+}
+
+/**
+ * @brief 借用libpcap将过滤表达式编译为BPF程序，供自行挂载过滤器的各后端使用
+ *
+ * @param filter_exp pcap过滤表达式
+ * @param fp 出口参数，编译得到的程序，用完后须调用pcap_freecode
+ * @return int 成功为0，失败为-1
+ */
+int driver_filter_compile(const char *filter_exp, struct bpf_program *fp) {
+    pcap_t *dead = pcap_open_dead(DLT_EN10MB, 65536);
+    if (dead == NULL || pcap_compile(dead, fp, filter_exp, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        fprintf(stderr, "Error in pcap_compile.\n%s.\n", dead ? pcap_geterr(dead) : "pcap_open_dead failed");
+        if (dead)
+            pcap_close(dead);
+        return -1;
+    }
+    pcap_close(dead);
+    return 0;
+}
+
+/**
+ * @brief 编译并替换网卡上的过滤器，libpcap在内核中原子地替换套接字过滤器
+ *
+ * @param filter_exp pcap过滤表达式
+ * @return int 成功为0，失败为-1
+ */
+static int driver_pcap_filter(const char *filter_exp) {
+    struct bpf_program fp;
+    if (pcap_compile(pcap, &fp, filter_exp, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        fprintf(stderr, "Error in pcap_compile.\n%s.\n", pcap_geterr(pcap));
+        return -1;
+    }
+    int ret = pcap_setfilter(pcap, &fp);
+    pcap_freecode(&fp);
+    if (ret < 0) {
+        fprintf(stderr, "Error in pcap_setfilter.\n%s.\n", pcap_geterr(pcap));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 打开网卡
+ *
+ * @param arg 形如"网卡名[,view]"，为NULL或网卡名为空时按本机ip选取网卡
+ *            view以只读视图接收，数据帧引用libpcap的内存而不拷贝，每次接收只交出一帧
+ * @return int 成功为0，失败为-1
+ */
+static int driver_pcap_open(const char *arg) {
+#ifdef _WIN32
+    /* Load Npcap and its functions. */
+    if (!LoadNpcapDlls()) {
+        fprintf(stderr, "Couldn't load Npcap\n");
+        return -1;
+    }
+#endif
+
+    char if_name[PCAP_BUF_SIZE];
+    uint32_t mask = PCAP_NETMASK_UNKNOWN;
+    const char *opt = arg ? strchr(arg, ',') : NULL;
+    int name_len = opt ? (int)(opt - arg) : arg ? (int)strlen(arg) : 0;
+    pcap_view = 0;
+    if (opt && strcmp(opt + 1, "view") == 0)
+        pcap_view = 1;
+    else if (opt) {
+        fprintf(stderr, "Error in driver_pcap_open: unknown option %s.\n", opt + 1);
+        return -1;
+    }
+    if (name_len)
+        snprintf(if_name, sizeof(if_name), "%.*s", name_len, arg);
+    else if (driver_find(net_if_ip, if_name, (uint8_t *)&mask) < 0) {
+        fprintf(stderr, "Error in driver find.\n");
+        return -1;
+    }
+    printf("Using interface %s, my ip is %s.\n", if_name, iptos(net_if_ip));
+
+    if ((pcap = pcap_open_live(if_name, 65536, 1, 10, pcap_errbuf)) == NULL)  // 混杂模式打开网卡
+    {
+        fprintf(stderr, "Error in pcap_open_live.\n%s.\n", pcap_errbuf);
+        return -1;
+    }
+    if (pcap_setnonblock(pcap, 1, pcap_errbuf) < 0)  // 设置非阻塞模式
+    {
+        fprintf(stderr, "Error in pcap_setnonblock. %s.\n", pcap_errbuf);
+        return -1;
+    }
+    char filter_exp[PCAP_BUF_SIZE];
+    driver_filter_exp(filter_exp, sizeof(filter_exp));  // 过滤数据包，协议栈初始化后按打开的端口收窄
+    return driver_pcap_filter(filter_exp);
+}
+/**
+ * @brief 试图从网卡接收数据包，只读视图模式下buf引用libpcap的内存，在下一次接收前有效
+ *
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0，错误为-1
+ */
+static int driver_pcap_recv(buf_t *buf) {
+    struct pcap_pkthdr *pkt_hdr;
+    const uint8_t *pkt_data;
+    int ret = pcap_next_ex(pcap, &pkt_hdr, &pkt_data);
+    if (ret == 0)
+        return 0;
+    else if (ret == 1) {
+        if (pcap_view) {
+            buf_view(buf, pkt_data, pkt_hdr->caplen);
+            return pkt_hdr->caplen;
+        }
+        if (buf_init(buf, pkt_hdr->caplen) < 0)
+            return 0;
+        memcpy(buf->data, pkt_data, pkt_hdr->caplen);
+        return pkt_hdr->caplen;
+    }
+    fprintf(stderr, "Error in driver_recv.\n%s.\n", pcap_geterr(pcap));
+    return -1;
+}
+typedef struct driver_burst  // 一次批量接收的上下文
+{
+    buf_t *bufs;  // 存放数据包的buf数组
+    int num;      // 已收到的数据包数
+} driver_burst_t;
+
+/**
+ * @brief pcap_dispatch的回调，将一个数据包拷贝到下一个buf
+ *
+ * @param user 批量接收的上下文
+ * @param pkt_hdr 数据包头
+ * @param pkt_data 数据包内容
+ */
+static void driver_burst_handler(u_char *user, const struct pcap_pkthdr *pkt_hdr, const u_char *pkt_data) {
+    driver_burst_t *burst = (driver_burst_t *)user;
+    buf_t *buf = &burst->bufs[burst->num];
+    if (buf_init(buf, pkt_hdr->caplen) < 0)
+        return;  // 超出缓冲区的数据包直接丢弃
+    memcpy(buf->data, pkt_data, pkt_hdr->caplen);
+    burst->num++;
+}
+
+/**
+ * @brief 试图从网卡批量接收数据包，一次调用至多接收n个
+ *        只读视图模式下libpcap的数据只在下一次接收前有效，每次只交出一帧
+ *
+ * @param bufs 收到的数据包
+ * @param n 最多接收的数据包数
+ * @return int 收到的数据包数，未收到为0，错误为-1
+ */
+static int driver_pcap_recv_burst(buf_t *bufs, int n) {
+    if (pcap_view) {
+        int ret = driver_pcap_recv(&bufs[0]);
+        return ret > 0 ? 1 : ret;
+    }
+    driver_burst_t burst = {bufs, 0};
+    if (pcap_dispatch(pcap, n, driver_burst_handler, (u_char *)&burst) == PCAP_ERROR) {
+        fprintf(stderr, "Error in driver_recv_burst.\n%s.\n", pcap_geterr(pcap));
+        return -1;
+    }
+    return burst.num;
+}
+
+/**
+ * @brief 使用网卡发送一个数据包
+ *
+ * @param buf 要发送的数据包，可以是buffer链
+ * @return int 成功为0，失败为-1
+ */
+static int driver_pcap_send(buf_t *buf) {
+    // pcap不支持聚集发送，buffer链先合并为连续的一帧
+    if (buf_linearize(buf) < 0)
+        return -1;
+    if (pcap_sendpacket(pcap, buf->data, buf->len) == -1) {
+        fprintf(stderr, "Error in driver_send.\n%s.\n", pcap_geterr(pcap));
+        return -1;
+    }
+
+    return 0;
+}
+/**
+ * @brief 使用网卡批量发送数据包
+ *
+ * @param bufs 要发送的数据包，可以是buffer链
+ * @param n 数据包数
+ * @return int 发送成功的数据包数，全部失败为-1
+ */
+static int driver_pcap_send_burst(buf_t *bufs, int n) {
+    for (int i = 0; i < n; i++)
+        if (buf_linearize(&bufs[i]) < 0)
+            return -1;
+#ifdef _WIN32
+    // Npcap的发送队列，一次调用发送整批数据包
+    size_t size = 0;
+    for (int i = 0; i < n; i++)
+        size += sizeof(struct pcap_pkthdr) + bufs[i].len;
+    pcap_send_queue *queue = pcap_sendqueue_alloc(size);
+    if (queue == NULL) {
+        fprintf(stderr, "Error in pcap_sendqueue_alloc.\n");
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        struct pcap_pkthdr header = {0};
+        header.caplen = header.len = bufs[i].len;
+        pcap_sendqueue_queue(queue, &header, bufs[i].data);
+    }
+    if (pcap_sendqueue_transmit(pcap, queue, 0) < queue->len) {
+        fprintf(stderr, "Error in driver_send_burst.\n%s.\n", pcap_geterr(pcap));
+        pcap_sendqueue_destroy(queue);
+        return -1;
+    }
+    pcap_sendqueue_destroy(queue);
+#else
+    // libpcap在此平台没有批量发送接口，逐个注入
+    for (int i = 0; i < n; i++)
+        if (pcap_inject(pcap, bufs[i].data, bufs[i].len) == -1) {
+            fprintf(stderr, "Error in driver_send_burst.\n%s.\n", pcap_geterr(pcap));
+            return i ? i : -1;
+        }
+#endif
+    return n;
+}
+
+/**
+ * @brief 关闭网卡
+ *
+ */
+static void driver_pcap_close() {
+    pcap_close(pcap);
+}
+
+/**
+ * @brief 获取可用于select/epoll等待的文件描述符
+ *
+ * @return int 文件描述符，平台不支持时为-1
+ */
+static int driver_pcap_fd() {
+#ifdef _WIN32
+    return -1;
+#else
+    return pcap_get_selectable_fd(pcap);
+#endif
+}
+
+/**
+ * @brief 基于libpcap的实时网卡驱动
+ *
+ */
+const net_driver_ops_t driver_pcap_ops = {
+    .name = "pcap",
+    .caps = DRIVER_CAP_RECV_BURST | DRIVER_CAP_SEND_BURST | DRIVER_CAP_FD,
+    .open = driver_pcap_open,
+    .recv = driver_pcap_recv,
+    .recv_burst = driver_pcap_recv_burst,
+    .send = driver_pcap_send,
+    .send_burst = driver_pcap_send_burst,
+    .close = driver_pcap_close,
+    .fd = driver_pcap_fd,
+    .filter = driver_pcap_filter,
+};
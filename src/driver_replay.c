@@ -0,0 +1,286 @@
+#include "driver.h"
+
+#include <pcap.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct driver_replay_frame  // 载入内存的一帧
+{
+    uint64_t ts_ns;   // 相对第一帧的时间，时间戳倒退的帧视为与前一帧同时
+    size_t offset;    // 在数据区中的偏移
+    uint32_t len;     // 帧长
+} driver_replay_frame_t;
+
+typedef struct driver_replay  // 回放后端的状态
+{
+    uint8_t *data;                  // 全部帧的数据，依次紧密排列
+    driver_replay_frame_t *frames;  // 帧表
+    size_t num;                     // 帧数
+    size_t next;                    // 本轮下一个交出的帧
+    size_t loops;                   // 回放轮数，0为不限
+    uint64_t end_ns;                // 限时回放的结束时刻，0为不限时
+    double speed;                   // 按原时间戳回放的倍速，0为最高速率
+    uint64_t start_ns;              // 按时间戳回放时第一轮的开始时刻
+    uint64_t span_ns;               // 按时间戳回放时一轮的时长
+    pcap_t *dead;                   // 写采样文件用的pcap句柄
+    pcap_dumper_t *dump;            // 采样文件，为NULL时发出的帧直接丢弃
+    size_t sample;                  // 每sample个发出的帧写入一个
+} driver_replay_t;
+
+/**
+ * @brief 回放统计
+ *
+ */
+driver_replay_stat_t driver_replay_stat;
+
+static driver_replay_t replay;
+
+/**
+ * @brief 获取单调时钟，单位为纳秒，回放时长与倍速不受系统时间调整影响
+ *
+ * @return uint64_t 当前时间
+ */
+static uint64_t driver_replay_clock() {
+    struct timespec ts;
+#ifdef __linux__
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief 将pcap文件全部载入内存
+ *
+ * @param path 文件路径
+ * @return int 成功为0，失败为-1
+ */
+static int driver_replay_load(const char *path) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *pcap = pcap_open_offline(path, errbuf);
+    if (pcap == NULL) {
+        fprintf(stderr, "Error in pcap_open_offline %s: %s.\n", path, errbuf);
+        return -1;
+    }
+    size_t cap = 0, data_len = 0, data_cap = 0;
+    struct pcap_pkthdr *hdr;
+    const uint8_t *pkt;
+    uint64_t last_ns = 0;
+    int ret;
+    while ((ret = pcap_next_ex(pcap, &hdr, &pkt)) == 1) {
+        if (replay.num == cap) {
+            cap = cap ? cap * 2 : 64;
+            void *frames = realloc(replay.frames, cap * sizeof(driver_replay_frame_t));
+            if (frames == NULL)
+                break;
+            replay.frames = frames;
+        }
+        if (data_len + hdr->caplen > data_cap) {
+            data_cap = (data_len + hdr->caplen) * 2;
+            void *data = realloc(replay.data, data_cap);
+            if (data == NULL)
+                break;
+            replay.data = data;
+        }
+        memcpy(replay.data + data_len, pkt, hdr->caplen);
+        uint64_t ts_ns = (uint64_t)hdr->ts.tv_sec * 1000000000 + (uint64_t)hdr->ts.tv_usec * 1000;
+        uint64_t prev = replay.num ? replay.frames[replay.num - 1].ts_ns : 0;
+        replay.frames[replay.num].ts_ns = prev + (replay.num && ts_ns > last_ns ? ts_ns - last_ns : 0);
+        last_ns = ts_ns;
+        replay.frames[replay.num].offset = data_len;
+        replay.frames[replay.num].len = hdr->caplen;
+        replay.num++;
+        data_len += hdr->caplen;
+    }
+    if (ret != PCAP_ERROR_BREAK)
+        fprintf(stderr, "Error in driver_replay_load: %s.\n", ret == 1 ? "out of memory" : pcap_geterr(pcap));
+    pcap_close(pcap);
+    if (ret != PCAP_ERROR_BREAK || replay.num == 0) {
+        if (ret == PCAP_ERROR_BREAK)
+            fprintf(stderr, "Error in driver_replay_load: %s has no frames.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 释放载入的帧与采样文件
+ *
+ */
+static void driver_replay_close() {
+    if (replay.dump)
+        pcap_dump_close(replay.dump);
+    if (replay.dead)
+        pcap_close(replay.dead);
+    free(replay.frames);
+    free(replay.data);
+    memset(&replay, 0, sizeof(replay));
+}
+
+/**
+ * @brief 载入pcap文件并设置回放方式
+ *
+ * @param arg 形如"文件[,loops=N][,seconds=S][,speed=X][,dump=文件][,sample=K]"
+ *            loops为回放轮数，seconds为回放时长，均未指定时回放一轮；speed为按原时间戳回放的倍速，未指定时以最高速率回放
+ *            dump指定时每sample个发出的帧写入该文件一个，否则发出的帧直接丢弃
+ * @return int 成功为0，失败为-1
+ */
+static int driver_replay_open(const char *arg) {
+    char opts[PCAP_BUF_SIZE];
+    snprintf(opts, sizeof(opts), "%s", arg ? arg : "");
+    char *path = strtok(opts, ",");
+    if (path == NULL) {
+        fprintf(stderr, "Error in driver_replay_open: no pcap file given.\n");
+        return -1;
+    }
+    driver_replay_close();  // 重新打开时释放上一次载入的帧与采样文件
+    memset(&driver_replay_stat, 0, sizeof(driver_replay_stat));
+    replay.sample = 1;
+    double seconds = 0;
+    const char *dump = NULL;
+    for (char *opt; (opt = strtok(NULL, ","));) {
+        char *val = strchr(opt, '=');
+        if (val)
+            *val++ = '\0';
+        if (val && strcmp(opt, "loops") == 0)
+            replay.loops = strtoull(val, NULL, 10);
+        else if (val && strcmp(opt, "seconds") == 0)
+            seconds = atof(val);
+        else if (val && strcmp(opt, "speed") == 0)
+            replay.speed = atof(val);
+        else if (val && strcmp(opt, "dump") == 0)
+            dump = val;
+        else if (val && strcmp(opt, "sample") == 0 && atoi(val) > 0)
+            replay.sample = atoi(val);
+        else {
+            fprintf(stderr, "Error in driver_replay_open: unknown option %s.\n", opt);
+            return -1;
+        }
+    }
+    if (replay.loops == 0 && seconds <= 0)
+        replay.loops = 1;
+
+    // Step1: 载入全部帧，回放时不再读文件
+    if (driver_replay_load(path) < 0) {
+        driver_replay_close();
+        return -1;
+    }
+
+    // Step2: 打开采样文件
+    if (dump) {
+        FILE *fp = fopen(dump, "wb");
+        replay.dead = pcap_open_dead(DLT_EN10MB, BUF_MAX_LEN);
+        replay.dump = fp && replay.dead ? pcap_dump_fopen(replay.dead, fp) : NULL;
+        if (replay.dump == NULL) {
+            fprintf(stderr, "Error in driver_replay_open: cannot open %s.\n", dump);
+            if (fp)
+                fclose(fp);
+            driver_replay_close();
+            return -1;
+        }
+    }
+
+    // Step3: 按时间戳回放时，一轮的时长为首末帧的间隔再加一个平均帧间隔，使相邻两轮首尾相接
+    replay.start_ns = driver_replay_clock();
+    if (seconds > 0)
+        replay.end_ns = replay.start_ns + (uint64_t)(seconds * 1e9);
+    if (replay.speed > 0) {
+        uint64_t span = replay.frames[replay.num - 1].ts_ns;
+        replay.span_ns = (span + (replay.num > 1 ? span / (replay.num - 1) : 0)) / replay.speed;
+        if (replay.span_ns == 0)
+            replay.span_ns = 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 交出到期的数据帧，以只读视图直接引用内存中的帧，协议栈修改时写时拷贝
+ *
+ * @param bufs 收到的数据包
+ * @param n 最多接收的数据包数
+ * @return int 收到的数据包数，回放结束或下一帧未到期时为0
+ */
+static int driver_replay_recv_burst(buf_t *bufs, int n) {
+    if (driver_replay_stat.done)
+        return 0;
+    uint64_t now = (replay.end_ns || replay.speed > 0) ? driver_replay_clock() : 0;
+    if (replay.end_ns && now >= replay.end_ns) {
+        driver_replay_stat.done = 1;
+        return 0;
+    }
+    int num = 0;
+    while (num < n) {
+        if (replay.next == replay.num) {
+            replay.next = 0;
+            if (++driver_replay_stat.loops == replay.loops) {
+                driver_replay_stat.done = 1;
+                break;
+            }
+        }
+        driver_replay_frame_t *frame = &replay.frames[replay.next];
+        if (replay.speed > 0) {
+            uint64_t due = replay.start_ns + driver_replay_stat.loops * replay.span_ns + frame->ts_ns / replay.speed;
+            if (due > now)
+                break;
+        }
+        buf_view(&bufs[num++], replay.data + frame->offset, frame->len);
+        replay.next++;
+    }
+    driver_replay_stat.rx_frames += num;
+    return num;
+}
+
+/**
+ * @brief 交出一个到期的数据帧
+ *
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0
+ */
+static int driver_replay_recv(buf_t *buf) {
+    return driver_replay_recv_burst(buf, 1) ? buf->len : 0;
+}
+
+/**
+ * @brief 丢弃发出的数据帧，指定了采样文件时按采样间隔写入
+ *
+ * @param bufs 要发送的数据包，可以是buffer链
+ * @param n 数据包数
+ * @return int 发送成功的数据包数
+ */
+static int driver_replay_send_burst(buf_t *bufs, int n) {
+    for (int i = 0; i < n; i++) {
+        size_t seq = driver_replay_stat.tx_frames++;
+        if (replay.dump && seq % replay.sample == 0 && buf_linearize(&bufs[i]) == 0) {
+            struct pcap_pkthdr header = {.caplen = bufs[i].len, .len = bufs[i].len};
+            pcap_dump((u_char *)replay.dump, &header, bufs[i].data);
+            driver_replay_stat.tx_dumped++;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief 发送一个数据帧
+ *
+ * @param buf 要发送的数据包，可以是buffer链
+ * @return int 成功为0
+ */
+static int driver_replay_send(buf_t *buf) {
+    return driver_replay_send_burst(buf, 1) == 1 ? 0 : -1;
+}
+
+/**
+ * @brief 高速回放驱动，将pcap文件载入内存后按轮数或时长循环回放，用于测量协议栈的处理速率
+ *
+ */
+const net_driver_ops_t driver_replay_ops = {
+    .name = "replay",
+    .caps = DRIVER_CAP_RECV_BURST | DRIVER_CAP_SEND_BURST,
+    .open = driver_replay_open,
+    .recv = driver_replay_recv,
+    .recv_burst = driver_replay_recv_burst,
+    .send = driver_replay_send,
+    .send_burst = driver_replay_send_burst,
+    .close = driver_replay_close,
+};
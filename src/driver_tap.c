@@ -0,0 +1,340 @@
+#include "driver.h"
+#include "driver_uring.h"
+
+#ifdef __linux__
+#include "ethernet.h"
+#include "ip.h"
+#include "tcp.h"
+#include "udp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/filter.h>
+#include <linux/if_tun.h>
+#include <linux/virtio_net.h>
+#include <net/if.h>
+#include <pcap.h>
+#include <stddef.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define DRIVER_TAP_IOV_MAX 16  // 一次writev聚集的最大段数，含vnet头
+
+static int tap_fd = -1;
+static int tap_uring;  // io_uring收发模式，0为逐帧readv/writev，1为io_uring，2为io_uring并启用SQPOLL
+static uint8_t tap_overflow[BUF_MAX_LEN];  // 接收超出常规块的GRO合并帧时存放其后半部分
+
+/**
+ * @brief 打开TAP网卡，带vnet头以使用校验和与分段卸载
+ *
+ * @param arg 形如"网卡名[,uring|,sqpoll]"，网卡名为空时使用DRIVER_TAP_NAME，不存在时创建
+ *            uring以io_uring批量收发，sqpoll在此基础上由内核线程轮询提交队列
+ * @return int 成功为0，失败为-1
+ */
+static int driver_tap_open(const char *arg) {
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    const char *opt = arg ? strchr(arg, ',') : NULL;
+    int name_len = opt ? (int)(opt - arg) : arg ? (int)strlen(arg) : 0;
+    snprintf(ifr.ifr_name, IFNAMSIZ, "%.*s", name_len, name_len ? arg : DRIVER_TAP_NAME);
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+    tap_uring = 0;
+    if (opt && strcmp(opt + 1, "uring") == 0)
+        tap_uring = 1;
+    else if (opt && strcmp(opt + 1, "sqpoll") == 0)
+        tap_uring = 2;
+    else if (opt) {
+        fprintf(stderr, "Error in driver_tap_open: unknown option %s.\n", opt + 1);
+        return -1;
+    }
+
+    // Step1: 打开TAP设备，io_uring模式下由io_uring在可读时发起读，使用阻塞的文件描述符
+    tap_fd = open("/dev/net/tun", tap_uring ? O_RDWR : O_RDWR | O_NONBLOCK);
+    if (tap_fd < 0) {
+        fprintf(stderr, "Error in open /dev/net/tun: %s.\n", strerror(errno));
+        return -1;
+    }
+    if (ioctl(tap_fd, TUNSETIFF, &ifr) < 0) {
+        fprintf(stderr, "Error in TUNSETIFF %s: %s.\n", ifr.ifr_name, strerror(errno));
+        close(tap_fd);
+        return -1;
+    }
+
+    // Step2: 协商卸载能力，TUN_F_CSUM允许内核交来未计算校验和的帧，TUN_F_TSO4允许交来GRO合并的TCP大帧
+    // UDP的大帧需按gso_size拆回各个数据报，协议栈不支持，因此不协商UFO/USO，由内核分段后再交来
+    // io_uring模式读入定长的常规块，不接收GRO大帧，发送方向的TSO不受影响
+    int hdr_len = sizeof(struct virtio_net_hdr);
+    unsigned offload = tap_uring ? TUN_F_CSUM : TUN_F_CSUM | TUN_F_TSO4;
+    if (ioctl(tap_fd, TUNSETVNETHDRSZ, &hdr_len) < 0 || ioctl(tap_fd, TUNSETOFFLOAD, offload) < 0) {
+        fprintf(stderr, "Error in TUNSETOFFLOAD: %s.\n", strerror(errno));
+        close(tap_fd);
+        return -1;
+    }
+
+    // Step3: 启用网卡，地址等配置由管理员在主机侧完成
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock >= 0) {
+        if (ioctl(sock, SIOCGIFFLAGS, &ifr) == 0) {
+            ifr.ifr_flags |= IFF_UP;
+            ioctl(sock, SIOCSIFFLAGS, &ifr);
+        }
+        close(sock);
+    }
+
+    // Step4: 启用io_uring收发
+    if (tap_uring && driver_uring_open(tap_fd, sizeof(struct virtio_net_hdr), tap_uring == 2) < 0) {
+        close(tap_fd);
+        tap_fd = -1;
+        return -1;
+    }
+    printf("Using interface %s, my ip is %s.\n", ifr.ifr_name, iptos(net_if_ip));
+    return 0;
+}
+
+static int driver_tap_recv_burst(buf_t *bufs, int n);
+
+/**
+ * @brief 根据收到的vnet头设置buf的接收标志
+ *        NEEDS_CSUM表示本机发出、传输层校验和字段只含伪头部的和，DATA_VALID表示主机已校验传输层校验和
+ *        二者都只涉及传输层，IP头部校验和总由ip_in校验
+ *
+ * @param buf 收到的数据帧
+ * @param vnet vnet头
+ */
+static inline void driver_tap_rx_flags(buf_t *buf, const struct virtio_net_hdr *vnet) {
+    if (vnet->flags & (VIRTIO_NET_HDR_F_NEEDS_CSUM | VIRTIO_NET_HDR_F_DATA_VALID))
+        buf->flags |= BUF_FLAG_CSUM_VERIFIED;
+}
+
+/**
+ * @brief 试图从TAP网卡接收一个数据帧，常规大小的帧直接读入buf的块中
+ *
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0，错误为-1
+ */
+static int driver_tap_recv(buf_t *buf) {
+    if (tap_uring)
+        return driver_tap_recv_burst(buf, 1) > 0 ? buf->len : 0;
+    struct virtio_net_hdr vnet;
+    if (buf_init(buf, BUF_MTU_LEN - BUF_HEADROOM) < 0)
+        return -1;
+    struct iovec iov[3] = {
+        {&vnet, sizeof(vnet)},
+        {buf->data, buf->len},
+        {tap_overflow, sizeof(tap_overflow)},
+    };
+    driver_stat.rx_syscalls++;
+    ssize_t len = readv(tap_fd, iov, 3);
+    if (len < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        fprintf(stderr, "Error in driver_tap_recv: %s.\n", strerror(errno));
+        return -1;
+    }
+    if ((size_t)len <= sizeof(vnet))
+        return 0;
+    len -= sizeof(vnet);
+
+    if ((size_t)len > buf->len) {
+        // GRO合并的大帧超出常规块，合并到巨型块中
+        buf_t jumbo = {0};
+        if (buf_init(&jumbo, len) < 0)
+            return 0;  // 巨型块耗尽，丢弃该帧
+        memcpy(jumbo.data, buf->data, buf->len);
+        memcpy(jumbo.data + buf->len, tap_overflow, len - buf->len);
+        buf_free(buf);
+        memcpy(buf, &jumbo, sizeof(buf_t));
+    } else
+        buf->len = len;
+
+    driver_tap_rx_flags(buf, &vnet);
+    return buf->len;
+}
+
+/**
+ * @brief 试图从TAP网卡批量接收数据帧，io_uring模式下从完成队列取出预投递的读读入的帧，无需系统调用
+ *
+ * @param bufs 收到的数据包
+ * @param n 最多接收的数据包数
+ * @return int 收到的数据包数，未收到为0，错误为-1
+ */
+static int driver_tap_recv_burst(buf_t *bufs, int n) {
+    if (!tap_uring) {
+        int num = 0;
+        for (int ret; num < n; num++)
+            if ((ret = driver_tap_recv(&bufs[num])) <= 0)
+                return (ret < 0 && num == 0) ? -1 : num;
+        return num;
+    }
+    int num = driver_uring_recv_burst(bufs, n);
+    for (int i = 0; i < num; i++)  // vnet头紧邻数据帧之前
+        driver_tap_rx_flags(&bufs[i], (struct virtio_net_hdr *)(bufs[i].data - sizeof(struct virtio_net_hdr)));
+    return num;
+}
+
+/**
+ * @brief 根据buf的卸载标志填写vnet头，首段须包含以太网、IP与传输层头部
+ *
+ * @param buf 要发送的数据帧
+ * @param vnet 出口参数，vnet头
+ */
+static void driver_tap_vnet_hdr(buf_t *buf, struct virtio_net_hdr *vnet) {
+    ip_hdr_t *ip_hdr = (ip_hdr_t *)(buf->data + sizeof(ether_hdr_t));
+    size_t start = sizeof(ether_hdr_t) + ip_hdr->hdr_len * IP_HDR_LEN_PER_BYTE;
+    vnet->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    vnet->csum_start = start;
+    vnet->csum_offset = ip_hdr->protocol == NET_PROTOCOL_TCP ? offsetof(tcp_hdr_t, checksum16) : offsetof(udp_hdr_t, checksum16);
+    if (buf->flags & BUF_FLAG_GSO_TCP) {
+        tcp_hdr_t *tcp_hdr = (tcp_hdr_t *)(buf->data + start);
+        vnet->hdr_len = start + (tcp_hdr->doff >> 4) * 4;
+        vnet->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        vnet->gso_size = ETHERNET_MAX_TRANSPORT_UNIT - (vnet->hdr_len - sizeof(ether_hdr_t));
+    }
+}
+
+/**
+ * @brief 填写vnet头，合并首段过短或段数过多的buffer链
+ *
+ * @param buf 要发送的数据帧
+ * @param vnet 出口参数，vnet头
+ * @return int 成功为0，失败为-1
+ */
+static int driver_tap_prepare(buf_t *buf, struct virtio_net_hdr *vnet) {
+    memset(vnet, 0, sizeof(*vnet));
+    if (buf->flags & (BUF_FLAG_CSUM_PARTIAL | BUF_FLAG_GSO_TCP)) {
+        // 首段不足以容纳全部协议头时先合并
+        if (buf->len < sizeof(ether_hdr_t) + sizeof(ip_hdr_t) + sizeof(tcp_hdr_t) && buf_linearize(buf) < 0)
+            return -1;
+        driver_tap_vnet_hdr(buf, vnet);
+    }
+
+    // 段数过多时先合并
+    int segs = 0;
+    for (buf_t *seg = buf; seg; seg = seg->next)
+        segs++;
+    if (segs >= DRIVER_TAP_IOV_MAX && buf_linearize(buf) < 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief 使用TAP网卡发送一个数据帧，buffer链直接聚集写出，校验和与分段交给内核
+ *
+ * @param buf 要发送的数据包，可以是buffer链
+ * @return int 成功为0，失败为-1
+ */
+static int driver_tap_send(buf_t *buf) {
+    struct virtio_net_hdr vnet;
+    if (driver_tap_prepare(buf, &vnet) < 0)
+        return -1;
+    if (tap_uring)
+        return driver_uring_send(&vnet, buf) < 0 || driver_uring_flush() != 1 ? -1 : 0;
+    struct iovec iov[DRIVER_TAP_IOV_MAX];
+    int iovcnt = 1;
+    iov[0].iov_base = &vnet;
+    iov[0].iov_len = sizeof(vnet);
+    for (buf_t *seg = buf; seg; seg = seg->next, iovcnt++) {
+        iov[iovcnt].iov_base = seg->data;
+        iov[iovcnt].iov_len = seg->len;
+    }
+    driver_stat.tx_syscalls++;
+    if (writev(tap_fd, iov, iovcnt) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            fprintf(stderr, "Error in driver_tap_send: %s.\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 使用TAP网卡批量发送数据帧，io_uring模式下全部帧在一次io_uring_enter中提交
+ *
+ * @param bufs 要发送的数据包，可以是buffer链
+ * @param n 数据包数
+ * @return int 发送成功的数据包数，全部失败为-1
+ */
+static int driver_tap_send_burst(buf_t *bufs, int n) {
+    if (!tap_uring) {
+        for (int i = 0; i < n; i++)
+            if (driver_tap_send(&bufs[i]) < 0)
+                return i ? i : -1;
+        return n;
+    }
+    int queued = 0, num = 0, ret;
+    for (int i = 0; i < n; i++) {
+        struct virtio_net_hdr vnet;
+        if (queued == DRIVER_URING_TX_DEPTH) {
+            if ((ret = driver_uring_flush()) > 0)
+                num += ret;
+            queued = 0;
+        }
+        if (driver_tap_prepare(&bufs[i], &vnet) < 0 || driver_uring_send(&vnet, &bufs[i]) < 0)
+            break;
+        queued++;
+    }
+    if ((ret = driver_uring_flush()) > 0)
+        num += ret;
+    return num ? num : -1;
+}
+
+/**
+ * @brief 关闭TAP网卡，非持久的TAP网卡随之删除
+ *
+ */
+static void driver_tap_close() {
+    if (tap_uring)
+        driver_uring_close();
+    if (tap_fd >= 0)
+        close(tap_fd);
+    tap_fd = -1;
+}
+
+/**
+ * @brief 获取可用于select/epoll等待的文件描述符
+ *
+ * @return int 文件描述符
+ */
+static int driver_tap_fd() {
+    return tap_uring ? driver_uring_fd() : tap_fd;
+}
+
+/**
+ * @brief 在TAP网卡上挂载BPF过滤器，内核在帧进入TAP队列前丢弃不匹配的帧，已有的过滤器被替换
+ *
+ * @param filter_exp pcap过滤表达式
+ * @return int 成功为0，失败为-1
+ */
+static int driver_tap_filter(const char *filter_exp) {
+    struct bpf_program fp;
+    if (driver_filter_compile(filter_exp, &fp) < 0)
+        return -1;
+    // struct bpf_insn与内核的struct sock_filter布局相同
+    struct sock_fprog prog = {.len = fp.bf_len, .filter = (struct sock_filter *)fp.bf_insns};
+    int ret = ioctl(tap_fd, TUNATTACHFILTER, &prog);
+    pcap_freecode(&fp);
+    if (ret < 0) {
+        fprintf(stderr, "Error in TUNATTACHFILTER: %s.\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Linux TAP驱动，vnet头承载校验和与TCP分段卸载信息
+ *
+ */
+const net_driver_ops_t driver_tap_ops = {
+    .name = "tap",
+    .caps = DRIVER_CAP_FD | DRIVER_CAP_TX_CSUM | DRIVER_CAP_TSO,
+    .open = driver_tap_open,
+    .recv = driver_tap_recv,
+    .recv_burst = driver_tap_recv_burst,
+    .send = driver_tap_send,
+    .send_burst = driver_tap_send_burst,
+    .close = driver_tap_close,
+    .fd = driver_tap_fd,
+    .filter = driver_tap_filter,
+};
+#endif
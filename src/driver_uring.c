@@ -0,0 +1,451 @@
+#include "driver_uring.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef IORING_OP_READ_MULTISHOT
+#define IORING_OP_READ_MULTISHOT 49  // Linux 6.7起支持，较旧的头文件中没有
+#endif
+
+#define DRIVER_URING_HDR_MAX 16  // 帧前缀（如vnet头）的最大长度
+#define DRIVER_URING_IOV_MAX 16  // 一个发送帧的最大段数，含前缀
+#define DRIVER_URING_BGID 0      // 提供缓冲区组号
+#define DRIVER_URING_CANCEL 1    // 取消请求的user_data，接收请求为0
+#define DRIVER_URING_SPIN 4096   // SQPOLL模式下自旋等待发送完成的最大次数
+
+typedef struct driver_uring_ring  // 一个io_uring实例，映射到用户空间的提交队列与完成队列
+{
+    int fd;                     // io_uring的文件描述符
+    uint32_t *sq_tail;          // 提交队列尾，用户写
+    uint32_t *sq_flags;         // 提交队列标志，IORING_SQ_NEED_WAKEUP表示SQPOLL线程已休眠
+    uint32_t sq_mask;           // 提交队列掩码
+    struct io_uring_sqe *sqes;  // 提交队列项数组
+    uint32_t *cq_head;          // 完成队列头，用户写
+    uint32_t *cq_tail;          // 完成队列尾，内核写
+    uint32_t cq_mask;           // 完成队列掩码
+    struct io_uring_cqe *cqes;  // 完成队列项数组
+    uint32_t pending;           // 已填写尚未提交的提交队列项数
+    void *ring_map;             // 提交与完成队列的mmap起始地址
+    size_t ring_len;            // 提交与完成队列的mmap长度
+    size_t sqes_len;            // 提交队列项数组的mmap长度
+} driver_uring_ring_t;
+
+typedef struct driver_uring  // io_uring收发模式的状态
+{
+    int fd;                                                            // 后端的文件描述符
+    size_t hdr_len;                                                    // 每帧数据前的前缀长度
+    int sqpoll;                                                        // 是否由内核线程轮询提交队列
+    int multishot;                                                     // 接收是否使用多发读，内核不支持时退回预投递多个单发读
+    driver_uring_ring_t rx, tx;                                        // 接收与发送各用一个实例，互不混杂完成项
+    struct io_uring_buf_ring *buf_ring;                                // 注册的提供缓冲区环
+    uint16_t buf_tail;                                                 // 提供缓冲区环尾
+    uint8_t *blocks[DRIVER_URING_BUF_NUM];                             // 各缓冲区号对应的常规块
+    uint8_t tx_hdr[DRIVER_URING_TX_DEPTH][DRIVER_URING_HDR_MAX];       // 待发送帧的前缀
+    struct iovec tx_iov[DRIVER_URING_TX_DEPTH][DRIVER_URING_IOV_MAX];  // 待发送帧的分散聚集表
+} driver_uring_t;
+
+static driver_uring_t uring = {.fd = -1, .rx.fd = -1, .tx.fd = -1};
+
+/**
+ * @brief 调用io_uring_enter，并计入系统调用统计
+ *
+ * @param ring io_uring实例
+ * @param to_submit 提交的项数
+ * @param min_complete 等待的最少完成项数
+ * @param flags IORING_ENTER_*
+ * @param syscalls 计数的统计项
+ * @return int 提交的项数，失败为-1
+ */
+static int driver_uring_enter(driver_uring_ring_t *ring, uint32_t to_submit, uint32_t min_complete, uint32_t flags, size_t *syscalls) {
+    (*syscalls)++;
+    return syscall(SYS_io_uring_enter, ring->fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/**
+ * @brief 创建io_uring实例并映射其队列
+ *
+ * @param ring 要创建的实例
+ * @param entries 提交队列大小
+ * @param cq_entries 完成队列大小
+ * @param wq_fd 非负时与该实例共享SQPOLL线程
+ * @return int 成功为0，失败为-1
+ */
+static int driver_uring_ring_setup(driver_uring_ring_t *ring, uint32_t entries, uint32_t cq_entries, int wq_fd) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    if (uring.sqpoll) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = DRIVER_URING_SQ_IDLE;
+        if (wq_fd >= 0) {
+            p.flags |= IORING_SETUP_ATTACH_WQ;
+            p.wq_fd = wq_fd;
+        }
+    }
+    ring->fd = syscall(SYS_io_uring_setup, entries, &p);
+    if (ring->fd < 0) {
+        fprintf(stderr, "Error in io_uring_setup: %s.\n", strerror(errno));
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        fprintf(stderr, "Error in io_uring_setup: kernel too old.\n");
+        return -1;
+    }
+
+    // 提交队列与完成队列共用一次映射
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_len = sq_len > cq_len ? sq_len : cq_len;
+    ring->ring_map = mmap(NULL, ring->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->ring_map == MAP_FAILED) {
+        ring->ring_map = NULL;
+        fprintf(stderr, "Error in mmap: %s.\n", strerror(errno));
+        return -1;
+    }
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        fprintf(stderr, "Error in mmap: %s.\n", strerror(errno));
+        return -1;
+    }
+    uint8_t *base = ring->ring_map;
+    ring->sq_tail = (uint32_t *)(base + p.sq_off.tail);
+    ring->sq_flags = (uint32_t *)(base + p.sq_off.flags);
+    ring->sq_mask = *(uint32_t *)(base + p.sq_off.ring_mask);
+    ring->cq_head = (uint32_t *)(base + p.cq_off.head);
+    ring->cq_tail = (uint32_t *)(base + p.cq_off.tail);
+    ring->cq_mask = *(uint32_t *)(base + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+    // 提交队列项与索引数组一一对应，之后只需移动队尾
+    uint32_t *array = (uint32_t *)(base + p.sq_off.array);
+    for (uint32_t i = 0; i < p.sq_entries; i++)
+        array[i] = i;
+    return 0;
+}
+
+/**
+ * @brief 解除io_uring实例的映射并关闭
+ *
+ * @param ring 要关闭的实例
+ */
+static void driver_uring_ring_close(driver_uring_ring_t *ring) {
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->ring_map)
+        munmap(ring->ring_map, ring->ring_len);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/**
+ * @brief 取一个空闲的提交队列项，调用者保证队列未满
+ *
+ * @param ring io_uring实例
+ * @return struct io_uring_sqe* 清零的提交队列项
+ */
+static struct io_uring_sqe *driver_uring_sqe(driver_uring_ring_t *ring) {
+    struct io_uring_sqe *sqe = &ring->sqes[(*ring->sq_tail + ring->pending++) & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ * @brief 提交已填写的提交队列项，SQPOLL模式下只在内核线程休眠时才需系统调用唤醒
+ *
+ * @param ring io_uring实例
+ * @param min_complete 等待的最少完成项数，SQPOLL模式下忽略
+ * @param syscalls 计数的统计项
+ * @return int 成功为0，失败为-1
+ */
+static int driver_uring_submit(driver_uring_ring_t *ring, uint32_t min_complete, size_t *syscalls) {
+    uint32_t to_submit = ring->pending;
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + to_submit, __ATOMIC_RELEASE);
+    ring->pending = 0;
+    if (uring.sqpoll) {
+        // 须在更新队尾之后检查，避免内核线程恰好在此前休眠而漏掉新项
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)
+            return driver_uring_enter(ring, 0, 0, IORING_ENTER_SQ_WAKEUP, syscalls) < 0 ? -1 : 0;
+        return 0;
+    }
+    if (to_submit == 0 && min_complete == 0)
+        return 0;
+    return driver_uring_enter(ring, to_submit, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0, syscalls) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief 将一个常规块作为提供缓冲区放入缓冲区环，数据帧连同前缀写在BUF_HEADROOM之前的前缀处
+ *
+ * @param bid 缓冲区号
+ * @param block 常规块
+ */
+static void driver_uring_provide(uint16_t bid, uint8_t *block) {
+    struct io_uring_buf *b = &uring.buf_ring->bufs[uring.buf_tail & (DRIVER_URING_BUF_NUM - 1)];
+    uring.blocks[bid] = block;
+    b->addr = (uintptr_t)(block + BUF_HEADROOM - uring.hdr_len);
+    b->len = BUF_MTU_LEN - BUF_HEADROOM + uring.hdr_len;
+    b->bid = bid;
+    uring.buf_tail++;
+}
+
+/**
+ * @brief 投递接收请求，多发读只需一个，单发读补足到DRIVER_URING_RX_DEPTH个
+ *
+ * @param num 投递的个数
+ */
+static void driver_uring_arm(int num) {
+    for (int i = 0; i < num; i++) {
+        struct io_uring_sqe *sqe = driver_uring_sqe(&uring.rx);
+        sqe->opcode = uring.multishot ? IORING_OP_READ_MULTISHOT : IORING_OP_READ;
+        sqe->fd = uring.fd;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = DRIVER_URING_BGID;
+        sqe->len = uring.multishot ? 0 : BUF_MTU_LEN - BUF_HEADROOM + uring.hdr_len;
+    }
+}
+
+/**
+ * @brief 在文件描述符上启用io_uring收发，接收预投递读请求，读入从缓冲池借出并注册的常规块
+ *
+ * @param fd 后端的文件描述符，须可poll
+ * @param hdr_len 每帧数据前的前缀长度，如vnet头，接收时位于buf->data之前
+ * @param sqpoll 是否启用SQPOLL，稳定状态下收发均无需系统调用
+ * @return int 成功为0，失败为-1
+ */
+int driver_uring_open(int fd, size_t hdr_len, int sqpoll) {
+    if (hdr_len > DRIVER_URING_HDR_MAX) {
+        fprintf(stderr, "Error in driver_uring_open: header too long %zu.\n", hdr_len);
+        return -1;
+    }
+    memset(&uring, 0, sizeof(uring));
+    uring.rx.fd = uring.tx.fd = -1;
+    uring.fd = fd;
+    uring.hdr_len = hdr_len;
+    uring.sqpoll = sqpoll;
+    uring.multishot = 1;
+
+    // Step1: 创建接收与发送两个实例，SQPOLL时共享同一个内核线程
+    if (driver_uring_ring_setup(&uring.rx, DRIVER_URING_RX_DEPTH, DRIVER_URING_BUF_NUM * 2, -1) < 0 ||
+        driver_uring_ring_setup(&uring.tx, DRIVER_URING_TX_DEPTH, DRIVER_URING_TX_DEPTH * 2, uring.rx.fd) < 0) {
+        driver_uring_close();
+        return -1;
+    }
+
+    // Step2: 注册提供缓冲区环，放入从缓冲池借出的常规块
+    uring.buf_ring = mmap(NULL, DRIVER_URING_BUF_NUM * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uring.buf_ring == MAP_FAILED) {
+        uring.buf_ring = NULL;
+        fprintf(stderr, "Error in mmap: %s.\n", strerror(errno));
+        driver_uring_close();
+        return -1;
+    }
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uintptr_t)uring.buf_ring,
+        .ring_entries = DRIVER_URING_BUF_NUM,
+        .bgid = DRIVER_URING_BGID,
+    };
+    if (syscall(SYS_io_uring_register, uring.rx.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        fprintf(stderr, "Error in IORING_REGISTER_PBUF_RING: %s.\n", strerror(errno));
+        driver_uring_close();
+        return -1;
+    }
+    for (uint16_t bid = 0; bid < DRIVER_URING_BUF_NUM; bid++) {
+        uint8_t *block = buf_block_get();
+        if (block == NULL) {
+            fprintf(stderr, "Error in driver_uring_open: buffer pool exhausted.\n");
+            driver_uring_close();
+            return -1;
+        }
+        driver_uring_provide(bid, block);
+    }
+    __atomic_store_n(&uring.buf_ring->tail, uring.buf_tail, __ATOMIC_RELEASE);
+
+    // Step3: 投递接收请求
+    driver_uring_arm(1);
+    if (driver_uring_submit(&uring.rx, 0, &driver_stat.rx_syscalls) < 0) {
+        fprintf(stderr, "Error in io_uring_enter: %s.\n", strerror(errno));
+        driver_uring_close();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 从完成队列批量取出收到的数据帧，所在的常规块直接交给buf，不拷贝，并补入新块
+ *
+ * @param bufs 收到的数据包，前缀位于data之前hdr_len字节处
+ * @param n 最多接收的数据包数
+ * @return int 收到的数据包数，未收到为0，错误为-1
+ */
+int driver_uring_recv_burst(buf_t *bufs, int n) {
+    uint32_t head = *uring.rx.cq_head;
+    uint32_t tail = __atomic_load_n(uring.rx.cq_tail, __ATOMIC_ACQUIRE);
+    int num = 0, rearm = 0, ret = 0;
+    for (; head != tail && num < n; head++) {
+        struct io_uring_cqe *cqe = &uring.rx.cqes[head & uring.rx.cq_mask];
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            rearm++;  // 单发读完成，或多发读因缓冲区耗尽等原因终止
+        if (cqe->res < 0) {
+            if (cqe->res == -EINVAL && uring.multishot) {
+                // 内核不支持多发读，退回预投递多个单发读
+                uring.multishot = 0;
+                rearm = DRIVER_URING_RX_DEPTH;
+            } else if (cqe->res != -ENOBUFS && cqe->res != -EAGAIN) {
+                fprintf(stderr, "Error in driver_uring_recv_burst: %s.\n", strerror(-cqe->res));
+                ret = -1;
+            }
+            continue;
+        }
+        if (!(cqe->flags & IORING_CQE_F_BUFFER))
+            continue;
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        uint8_t *block = uring.blocks[bid];
+        uint8_t *fresh = buf_block_get();
+        if ((size_t)cqe->res > uring.hdr_len && fresh) {
+            buf_attach(&bufs[num++], block, BUF_MTU_LEN, BUF_HEADROOM, cqe->res - uring.hdr_len);
+            driver_uring_provide(bid, fresh);
+        } else {
+            // 缓冲池耗尽或帧不完整，丢弃该帧，块原样放回
+            if (fresh)
+                buf_block_put(fresh);
+            driver_uring_provide(bid, block);
+        }
+    }
+    __atomic_store_n(uring.rx.cq_head, head, __ATOMIC_RELEASE);
+    __atomic_store_n(&uring.buf_ring->tail, uring.buf_tail, __ATOMIC_RELEASE);
+    if (rearm) {
+        driver_uring_arm(uring.multishot ? 1 : (rearm < DRIVER_URING_RX_DEPTH ? rearm : DRIVER_URING_RX_DEPTH));
+        if (driver_uring_submit(&uring.rx, 0, &driver_stat.rx_syscalls) < 0)
+            ret = -1;
+    }
+    return num ? num : ret;
+}
+
+/**
+ * @brief 将一个数据帧加入发送队列，在driver_uring_flush时一并提交，队列中至多DRIVER_URING_TX_DEPTH帧
+ *        提交前buffer须保持不变
+ *
+ * @param hdr 帧前缀，长度为hdr_len
+ * @param buf 要发送的数据包，段数须少于DRIVER_URING_IOV_MAX
+ * @return int 成功为0，队列已满或段数过多为-1
+ */
+int driver_uring_send(const void *hdr, buf_t *buf) {
+    if (uring.tx.pending == DRIVER_URING_TX_DEPTH) {
+        fprintf(stderr, "Error in driver_uring_send: queue full.\n");
+        return -1;
+    }
+    uint32_t slot = uring.tx.pending;
+    struct iovec *iov = uring.tx_iov[slot];
+    int iovcnt = 0;
+    if (uring.hdr_len) {
+        memcpy(uring.tx_hdr[slot], hdr, uring.hdr_len);
+        iov[iovcnt++] = (struct iovec){uring.tx_hdr[slot], uring.hdr_len};
+    }
+    for (buf_t *seg = buf; seg; seg = seg->next) {
+        if (iovcnt == DRIVER_URING_IOV_MAX) {
+            fprintf(stderr, "Error in driver_uring_send: too many segments.\n");
+            return -1;
+        }
+        iov[iovcnt++] = (struct iovec){seg->data, seg->len};
+    }
+    struct io_uring_sqe *sqe = driver_uring_sqe(&uring.tx);
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = uring.fd;
+    sqe->addr = (uintptr_t)iov;
+    sqe->len = iovcnt;
+    return 0;
+}
+
+/**
+ * @brief 一次提交发送队列中的全部数据帧并等待完成，之后各帧的buffer即可复用
+ *        普通模式下提交与等待合为一次io_uring_enter，SQPOLL模式下自旋等待完成队列
+ *
+ * @return int 发送成功的数据包数，全部失败为-1
+ */
+int driver_uring_flush() {
+    uint32_t submitted = uring.tx.pending, done = 0;
+    int num = 0, spins = 0;
+    if (submitted == 0)
+        return 0;
+    if (driver_uring_submit(&uring.tx, submitted, &driver_stat.tx_syscalls) < 0) {
+        fprintf(stderr, "Error in io_uring_enter: %s.\n", strerror(errno));
+        return -1;
+    }
+    while (done < submitted) {
+        uint32_t head = *uring.tx.cq_head;
+        uint32_t tail = __atomic_load_n(uring.tx.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, done++) {
+            struct io_uring_cqe *cqe = &uring.tx.cqes[head & uring.tx.cq_mask];
+            if (cqe->res >= 0)
+                num++;
+            else if (cqe->res != -EAGAIN)
+                fprintf(stderr, "Error in driver_uring_flush: %s.\n", strerror(-cqe->res));
+        }
+        __atomic_store_n(uring.tx.cq_head, head, __ATOMIC_RELEASE);
+        // 未等齐时继续等待，SQPOLL模式下先自旋，内核线程与本线程争用同一CPU时自旋无益，转为阻塞等待
+        if (done < submitted && (!uring.sqpoll || ++spins > DRIVER_URING_SPIN) && driver_uring_enter(&uring.tx, 0, submitted - done, IORING_ENTER_GETEVENTS, &driver_stat.tx_syscalls) < 0 && errno != EINTR) {
+            fprintf(stderr, "Error in io_uring_enter: %s.\n", strerror(errno));
+            return num ? num : -1;
+        }
+    }
+    return num ? num : -1;
+}
+
+/**
+ * @brief 取消预投递的读请求并等待取消完成，此后内核不再写入块，也不再持有后端的文件描述符
+ *
+ */
+static void driver_uring_cancel() {
+    struct io_uring_sqe *sqe = driver_uring_sqe(&uring.rx);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = DRIVER_URING_CANCEL;
+    if (driver_uring_submit(&uring.rx, 0, &driver_stat.rx_syscalls) < 0)
+        return;
+    for (int done = 0; !done;) {
+        if (driver_uring_enter(&uring.rx, 0, 1, IORING_ENTER_GETEVENTS, &driver_stat.rx_syscalls) < 0 && errno != EINTR)
+            return;
+        uint32_t head = *uring.rx.cq_head;
+        uint32_t tail = __atomic_load_n(uring.rx.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+            done |= uring.rx.cqes[head & uring.rx.cq_mask].user_data == DRIVER_URING_CANCEL;
+        __atomic_store_n(uring.rx.cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief 关闭io_uring，提供缓冲区环中的块归还缓冲池
+ *
+ */
+void driver_uring_close() {
+    if (uring.rx.sqes)
+        driver_uring_cancel();
+    driver_uring_ring_close(&uring.rx);
+    driver_uring_ring_close(&uring.tx);
+    if (uring.buf_ring)
+        munmap(uring.buf_ring, DRIVER_URING_BUF_NUM * sizeof(struct io_uring_buf));
+    for (int i = 0; i < DRIVER_URING_BUF_NUM; i++)
+        if (uring.blocks[i])
+            buf_block_put(uring.blocks[i]);
+    memset(&uring, 0, sizeof(uring));
+    uring.fd = uring.rx.fd = uring.tx.fd = -1;
+}
+
+/**
+ * @brief 获取可用于select/epoll等待的文件描述符，接收完成队列非空时可读
+ *
+ * @return int 文件描述符，未启用时为-1
+ */
+int driver_uring_fd() {
+    return uring.rx.fd;
+}
+#endif
@@ -0,0 +1,221 @@
+#include "driver.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct driver_wire_slot  // 环上的帧槽
+{
+    uint32_t len;                                          // 帧长
+    uint8_t data[DRIVER_WIRE_FRAME_SIZE - sizeof(uint32_t)];  // 数据帧从DRIVER_WIRE_HEADROOM处开始，之前为头部空间
+} driver_wire_slot_t;
+
+typedef struct driver_wire_ring  // 单生产者单消费者的无锁环，一个方向的连线
+{
+    uint32_t producer __attribute__((aligned(64)));  // 生产者序号，单调递增，生产者与消费者各占一个缓存行
+    uint32_t consumer __attribute__((aligned(64)));  // 消费者序号，单调递增
+    int notified;                                    // 已写过event_fd且消费者尚未清除
+    int event_fd;                                    // 环由空变为非空时通知消费者，用于阻塞等待
+    driver_wire_slot_t slots[DRIVER_WIRE_RING_SIZE];
+} driver_wire_ring_t;
+
+typedef struct driver_wire  // 内存连线后端的状态
+{
+    driver_wire_ring_t *rings;  // 共享内存中的两个方向，端0发送到rings[0]，端1发送到rings[1]
+    driver_wire_ring_t *rx;     // 本端的接收环
+    driver_wire_ring_t *tx;     // 本端的发送环
+    uint32_t rx_taken;          // 上一次接收交出、尚未归还的帧数
+} driver_wire_t;
+
+static driver_wire_t wire;
+
+/**
+ * @brief 创建连接两端的共享内存与通知用的eventfd
+ *        两个协议栈实例分别在fork出的两个进程中运行，须在fork之前调用，未调用时driver_open自动创建
+ *
+ * @return int 成功为0，失败为-1
+ */
+int driver_wire_create() {
+    if (wire.rings)
+        return 0;
+    driver_wire_ring_t *rings = mmap(NULL, 2 * sizeof(driver_wire_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (rings == MAP_FAILED) {
+        fprintf(stderr, "Error in driver_wire_create: %s.\n", strerror(errno));
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        rings[i].event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (rings[i].event_fd < 0) {
+            fprintf(stderr, "Error in driver_wire_create: %s.\n", strerror(errno));
+            if (i)
+                close(rings[0].event_fd);
+            munmap(rings, 2 * sizeof(driver_wire_ring_t));
+            return -1;
+        }
+    }
+    wire.rings = rings;
+    return 0;
+}
+
+/**
+ * @brief 接入内存连线的一端
+ *
+ * @param arg 端号，"0"或"1"，为NULL时为0
+ * @return int 成功为0，失败为-1
+ */
+static int driver_wire_open(const char *arg) {
+    int side = arg ? atoi(arg) : 0;
+    if (side != 0 && side != 1) {
+        fprintf(stderr, "Error in driver_wire_open: side must be 0 or 1.\n");
+        return -1;
+    }
+    if (driver_wire_create() < 0)
+        return -1;
+    wire.tx = &wire.rings[side];
+    wire.rx = &wire.rings[!side];
+    wire.rx_taken = 0;
+    return 0;
+}
+
+/**
+ * @brief 从接收环取出数据帧，帧直接引用环上的帧槽，在下一次接收时归还
+ *
+ * @param bufs 收到的数据包
+ * @param n 最多接收的数据包数
+ * @return int 收到的数据包数，未收到为0
+ */
+static int driver_wire_recv_burst(buf_t *bufs, int n) {
+    driver_wire_ring_t *ring = wire.rx;
+    uint32_t consumer = ring->consumer + wire.rx_taken;
+    if (wire.rx_taken) {
+        __atomic_store_n(&ring->consumer, consumer, __ATOMIC_RELEASE);
+        wire.rx_taken = 0;
+    }
+
+    uint32_t avail = __atomic_load_n(&ring->producer, __ATOMIC_ACQUIRE) - consumer;
+    if (avail == 0) {
+        // Step1: 环看似已空时，与发送端的“写生产者序号、读消费者序号”构成对称的屏障后再检查一次
+        // 二者至少有一方看到对方的写入：本端看到新的帧，或发送端看到环已取空而写event_fd
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        avail = __atomic_load_n(&ring->producer, __ATOMIC_ACQUIRE) - consumer;
+        if (avail == 0 && __atomic_load_n(&ring->notified, __ATOMIC_SEQ_CST)) {
+            // 仅在发送端通知过时清除event_fd的可读状态，取空后的轮询不发起系统调用
+            uint64_t count;
+            __atomic_store_n(&ring->notified, 0, __ATOMIC_SEQ_CST);
+            driver_stat.rx_syscalls++;
+            if (read(ring->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                fprintf(stderr, "Error in driver_wire_recv_burst: %s.\n", strerror(errno));
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            avail = __atomic_load_n(&ring->producer, __ATOMIC_ACQUIRE) - consumer;
+        }
+    }
+
+    // Step2: 直接引用帧槽中的数据帧，连同之前的头部空间与之后的尾部空间，添加协议头时无需拷贝
+    int num = avail < (uint32_t)n ? (int)avail : n;
+    for (int i = 0; i < num; i++) {
+        driver_wire_slot_t *slot = &ring->slots[(consumer + i) & (DRIVER_WIRE_RING_SIZE - 1)];
+        buf_attach(&bufs[i], slot->data, sizeof(slot->data), DRIVER_WIRE_HEADROOM, slot->len);
+    }
+    wire.rx_taken = num;
+    return num;
+}
+
+/**
+ * @brief 试图从接收环取出一个数据帧
+ *
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0
+ */
+static int driver_wire_recv(buf_t *buf) {
+    return driver_wire_recv_burst(buf, 1) ? buf->len : 0;
+}
+
+/**
+ * @brief 将数据帧拷贝进发送环，环由空变为非空时通知对端
+ *
+ * @param bufs 要发送的数据包，可以是buffer链
+ * @param n 数据包数
+ * @return int 发送成功的数据包数，全部失败为-1
+ */
+static int driver_wire_send_burst(buf_t *bufs, int n) {
+    driver_wire_ring_t *ring = wire.tx;
+    uint32_t producer = ring->producer, start = producer;
+    uint32_t room = DRIVER_WIRE_RING_SIZE - (producer - __atomic_load_n(&ring->consumer, __ATOMIC_ACQUIRE));
+
+    // Step1: 环满时丢弃其余的帧，如同网卡的发送队列溢出
+    int num = 0;
+    for (; num < n && room; num++) {
+        if (buf_chain_len(&bufs[num]) > sizeof(ring->slots[0].data) - DRIVER_WIRE_HEADROOM)
+            break;
+        driver_wire_slot_t *slot = &ring->slots[producer & (DRIVER_WIRE_RING_SIZE - 1)];
+        slot->len = 0;
+        for (buf_t *seg = &bufs[num]; seg; seg = seg->next) {
+            memcpy(slot->data + DRIVER_WIRE_HEADROOM + slot->len, seg->data, seg->len);
+            slot->len += seg->len;
+        }
+        producer++;
+        room--;
+    }
+    if (num == 0)
+        return -1;
+    __atomic_store_n(&ring->producer, producer, __ATOMIC_RELEASE);
+
+    // Step2: 对端已取空本次之前的全部帧时，可能已在等待，尚未通知过则写event_fd
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->consumer, __ATOMIC_ACQUIRE) == start && !__atomic_exchange_n(&ring->notified, 1, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        driver_stat.tx_syscalls++;
+        if (write(ring->event_fd, &one, sizeof(one)) < 0)
+            fprintf(stderr, "Error in driver_wire_send_burst: %s.\n", strerror(errno));
+    }
+    return num;
+}
+
+/**
+ * @brief 发送一个数据帧
+ *
+ * @param buf 要发送的数据包，可以是buffer链
+ * @return int 成功为0，失败为-1
+ */
+static int driver_wire_send(buf_t *buf) {
+    return driver_wire_send_burst(buf, 1) == 1 ? 0 : -1;
+}
+
+/**
+ * @brief 断开本端，共享内存保留给对端与之后的重新接入
+ *
+ */
+static void driver_wire_close() {
+    if (wire.rx && wire.rx_taken)
+        __atomic_store_n(&wire.rx->consumer, wire.rx->consumer + wire.rx_taken, __ATOMIC_RELEASE);
+    wire.rx = wire.tx = NULL;
+    wire.rx_taken = 0;
+}
+
+/**
+ * @brief 获取可用于select/epoll等待的文件描述符，接收环由空变为非空时可读
+ *
+ * @return int 文件描述符
+ */
+static int driver_wire_fd() {
+    return wire.rx ? wire.rx->event_fd : -1;
+}
+
+/**
+ * @brief 内存连线驱动，经共享内存中的一对无锁环连接两个协议栈实例，用于不依赖网卡的端到端测量
+ *
+ */
+const net_driver_ops_t driver_wire_ops = {
+    .name = "wire",
+    .caps = DRIVER_CAP_RECV_BURST | DRIVER_CAP_SEND_BURST | DRIVER_CAP_FD | DRIVER_CAP_RECV_INPLACE,
+    .open = driver_wire_open,
+    .recv = driver_wire_recv,
+    .recv_burst = driver_wire_recv_burst,
+    .send = driver_wire_send,
+    .send_burst = driver_wire_send_burst,
+    .close = driver_wire_close,
+    .fd = driver_wire_fd,
+};
+#endif
@@ -0,0 +1,446 @@
+#include "driver.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define DRIVER_XDP_CHUNK_MASK (~(uint64_t)(BUF_MTU_LEN - 1))  // UMEM地址取整到所在块
+
+typedef struct driver_xdp_ring  // 映射到用户空间的单生产者单消费者环
+{
+    uint32_t *producer;  // 生产者序号，单调递增
+    uint32_t *consumer;  // 消费者序号，单调递增
+    void *desc;          // 描述符数组，填充/完成环为UMEM地址，收发环为struct xdp_desc
+    void *map;           // mmap的起始地址
+    size_t map_len;      // mmap的长度
+} driver_xdp_ring_t;
+
+typedef struct driver_xdp  // AF_XDP后端的状态
+{
+    int fd;                                // XDP套接字
+    int map_fd;                            // XSKMAP，按队列号找到套接字
+    int prog_fd;                           // 将发往本机的数据帧重定向到套接字的XDP程序
+    int link_fd;                           // XDP程序与网卡的挂载，关闭即卸载
+    uint8_t *umem;                         // UMEM，即缓冲池的常规块存储区
+    size_t umem_num;                       // UMEM中的块数
+    driver_xdp_ring_t fill, comp, rx, tx;  // 填充环、完成环、接收环、发送环
+    size_t fill_num;                       // 经填充环借给内核、尚未收到数据帧的块数
+    uint16_t kernel[BUF_MTU_NUM];          // 内核经填充环与发送环持有的各块的引用数
+} driver_xdp_t;
+
+static driver_xdp_t xdp = {.fd = -1, .map_fd = -1, .prog_fd = -1, .link_fd = -1};
+
+/**
+ * @brief 调用bpf系统调用
+ *
+ * @param cmd 命令
+ * @param attr 参数
+ * @return int 返回值，失败为-1
+ */
+static inline int driver_xdp_bpf(int cmd, union bpf_attr *attr) {
+    return syscall(SYS_bpf, cmd, attr, sizeof(*attr));
+}
+
+/**
+ * @brief 块在UMEM中的序号
+ *
+ * @param addr 块内任意位置的UMEM地址
+ * @return size_t 块序号
+ */
+static inline size_t driver_xdp_chunk(uint64_t addr) {
+    return addr / BUF_MTU_LEN;
+}
+
+/**
+ * @brief 创建XSKMAP并加载XDP程序，发往本机mac或广播的数据帧重定向到队列上的套接字，其余交给内核协议栈
+ *        程序手工汇编，不依赖libbpf，与pcap驱动的过滤条件一致
+ *
+ * @return int 成功为0，失败为-1
+ */
+static int driver_xdp_prog() {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = DRIVER_XDP_QUEUE + 1;
+    xdp.map_fd = driver_xdp_bpf(BPF_MAP_CREATE, &attr);
+    if (xdp.map_fd < 0) {
+        fprintf(stderr, "Error in BPF_MAP_CREATE: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    // 按主机字节序比较目的mac的前4字节与后2字节
+    uint32_t mac_lo;
+    uint16_t mac_hi;
+    memcpy(&mac_lo, net_if_mac, sizeof(mac_lo));
+    memcpy(&mac_hi, net_if_mac + sizeof(mac_lo), sizeof(mac_hi));
+    struct bpf_insn insns[] = {
+        {.code = BPF_ALU64 | BPF_MOV | BPF_X, .dst_reg = BPF_REG_6, .src_reg = BPF_REG_1},                                                   // r6 = ctx
+        {.code = BPF_LDX | BPF_W | BPF_MEM, .dst_reg = BPF_REG_2, .src_reg = BPF_REG_1, .off = offsetof(struct xdp_md, data)},              // r2 = data
+        {.code = BPF_LDX | BPF_W | BPF_MEM, .dst_reg = BPF_REG_3, .src_reg = BPF_REG_1, .off = offsetof(struct xdp_md, data_end)},          // r3 = data_end
+        {.code = BPF_ALU64 | BPF_MOV | BPF_X, .dst_reg = BPF_REG_4, .src_reg = BPF_REG_2},                                                   // r4 = data
+        {.code = BPF_ALU64 | BPF_ADD | BPF_K, .dst_reg = BPF_REG_4, .imm = NET_MAC_LEN},                                                     // r4 += 6
+        {.code = BPF_JMP | BPF_JGT | BPF_X, .dst_reg = BPF_REG_4, .src_reg = BPF_REG_3, .off = 7},                                           // 帧过短则交给内核
+        {.code = BPF_LDX | BPF_W | BPF_MEM, .dst_reg = BPF_REG_4, .src_reg = BPF_REG_2, .off = 0},                                          // r4 = dst[0..3]
+        {.code = BPF_LDX | BPF_H | BPF_MEM, .dst_reg = BPF_REG_5, .src_reg = BPF_REG_2, .off = sizeof(mac_lo)},                             // r5 = dst[4..5]
+        {.code = BPF_JMP32 | BPF_JNE | BPF_K, .dst_reg = BPF_REG_4, .off = 2, .imm = (int32_t)mac_lo},                                      // 不是本机mac则检查广播
+        {.code = BPF_JMP32 | BPF_JEQ | BPF_K, .dst_reg = BPF_REG_5, .off = 5, .imm = mac_hi},                                               // 本机mac，重定向
+        {.code = BPF_JMP | BPF_JA, .off = 2},                                                                                                // 前4字节是本机的则不是广播，交给内核
+        {.code = BPF_JMP32 | BPF_JNE | BPF_K, .dst_reg = BPF_REG_4, .off = 1, .imm = -1},                                                    // 不是广播则交给内核
+        {.code = BPF_JMP32 | BPF_JEQ | BPF_K, .dst_reg = BPF_REG_5, .off = 2, .imm = 0xffff},                                               // 广播，重定向
+        {.code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_0, .imm = XDP_PASS},                                                        // r0 = XDP_PASS
+        {.code = BPF_JMP | BPF_EXIT},                                                                                                        // return
+        {.code = BPF_LDX | BPF_W | BPF_MEM, .dst_reg = BPF_REG_2, .src_reg = BPF_REG_6, .off = offsetof(struct xdp_md, rx_queue_index)},   // r2 = 队列号
+        {.code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1, .src_reg = BPF_PSEUDO_MAP_FD, .imm = xdp.map_fd},                         // r1 = XSKMAP
+        {0},                                                                                                                                 // 64位立即数的高32位
+        {.code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3, .imm = XDP_PASS},                                                        // 队列上没有套接字时交给内核
+        {.code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map},                                                                          // r0 = bpf_redirect_map(r1, r2, r3)
+        {.code = BPF_JMP | BPF_EXIT},                                                                                                        // return
+    };
+    char log[PCAP_BUF_SIZE] = "";
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t)insns;
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.license = (uintptr_t) "GPL";
+    xdp.prog_fd = driver_xdp_bpf(BPF_PROG_LOAD, &attr);
+    if (xdp.prog_fd < 0) {
+        // 带上校验器日志重新加载一次以便排查
+        int err = errno;
+        attr.log_buf = (uintptr_t)log;
+        attr.log_size = sizeof(log);
+        attr.log_level = 1;
+        driver_xdp_bpf(BPF_PROG_LOAD, &attr);
+        fprintf(stderr, "Error in BPF_PROG_LOAD: %s.\n%s\n", strerror(err), log);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 查询环的偏移并映射到用户空间
+ *
+ * @param ring 要映射的环
+ * @param off 内核给出的偏移
+ * @param pgoff mmap的页偏移，区分四个环
+ * @param desc_size 描述符大小
+ * @return int 成功为0，失败为-1
+ */
+static int driver_xdp_ring_map(driver_xdp_ring_t *ring, const struct xdp_ring_offset *off, off_t pgoff, size_t desc_size) {
+    ring->map_len = off->desc + DRIVER_XDP_RING_SIZE * desc_size;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, xdp.fd, pgoff);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        fprintf(stderr, "Error in mmap: %s.\n", strerror(errno));
+        return -1;
+    }
+    ring->producer = (uint32_t *)((uint8_t *)ring->map + off->producer);
+    ring->consumer = (uint32_t *)((uint8_t *)ring->map + off->consumer);
+    ring->desc = (uint8_t *)ring->map + off->desc;
+    return 0;
+}
+
+/**
+ * @brief 将缓冲池的常规块存储区注册为UMEM，创建并映射四个环
+ *
+ * @return int 成功为0，失败为-1
+ */
+static int driver_xdp_umem() {
+    xdp.umem = buf_block_area(&xdp.umem_num);
+    struct xdp_umem_reg reg = {
+        .addr = (uintptr_t)xdp.umem,
+        .len = xdp.umem_num * BUF_MTU_LEN,
+        .chunk_size = BUF_MTU_LEN,
+        .headroom = 0,
+    };
+    if (setsockopt(xdp.fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0) {
+        fprintf(stderr, "Error in XDP_UMEM_REG: %s.\n", strerror(errno));
+        return -1;
+    }
+    int size = DRIVER_XDP_RING_SIZE;
+    if (setsockopt(xdp.fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(xdp.fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(xdp.fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0 ||
+        setsockopt(xdp.fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0) {
+        fprintf(stderr, "Error in setting XDP rings: %s.\n", strerror(errno));
+        return -1;
+    }
+    struct xdp_mmap_offsets off;
+    socklen_t len = sizeof(off);
+    if (getsockopt(xdp.fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len) < 0) {
+        fprintf(stderr, "Error in XDP_MMAP_OFFSETS: %s.\n", strerror(errno));
+        return -1;
+    }
+    if (driver_xdp_ring_map(&xdp.fill, &off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t)) < 0 ||
+        driver_xdp_ring_map(&xdp.comp, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t)) < 0 ||
+        driver_xdp_ring_map(&xdp.rx, &off.rx, XDP_PGOFF_RX_RING, sizeof(struct xdp_desc)) < 0 ||
+        driver_xdp_ring_map(&xdp.tx, &off.tx, XDP_PGOFF_TX_RING, sizeof(struct xdp_desc)) < 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief 从缓冲池取块补充填充环，供内核写入收到的数据帧，借出的块数不超过DRIVER_XDP_FILL_NUM
+ *
+ */
+static void driver_xdp_refill() {
+    uint32_t prod = *xdp.fill.producer;
+    uint32_t cons = __atomic_load_n(xdp.fill.consumer, __ATOMIC_ACQUIRE);
+    uint64_t *addrs = xdp.fill.desc;
+    for (; prod - cons < DRIVER_XDP_RING_SIZE && xdp.fill_num < DRIVER_XDP_FILL_NUM; prod++) {
+        uint8_t *block = buf_block_get();
+        if (block == NULL)
+            break;  // 缓冲池暂时耗尽，待协议栈释放后再补
+        uint64_t addr = block - xdp.umem;
+        xdp.kernel[driver_xdp_chunk(addr)]++;
+        xdp.fill_num++;
+        addrs[prod % DRIVER_XDP_RING_SIZE] = addr;
+    }
+    __atomic_store_n(xdp.fill.producer, prod, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 回收完成环上内核已发送完毕的块，释放发送时持有的引用
+ *
+ */
+static void driver_xdp_complete() {
+    uint32_t cons = *xdp.comp.consumer;
+    uint32_t prod = __atomic_load_n(xdp.comp.producer, __ATOMIC_ACQUIRE);
+    uint64_t *addrs = xdp.comp.desc;
+    for (; cons != prod; cons++) {
+        uint64_t addr = addrs[cons % DRIVER_XDP_RING_SIZE] & DRIVER_XDP_CHUNK_MASK;
+        xdp.kernel[driver_xdp_chunk(addr)]--;
+        buf_block_put(xdp.umem + addr);
+    }
+    __atomic_store_n(xdp.comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+static void driver_xdp_close();
+
+/**
+ * @brief 打开网卡，以复制模式绑定AF_XDP套接字，并在网卡上以通用模式挂载XDP程序，可用于veth等虚拟网卡
+ *
+ * @param arg 网卡名，为NULL时按本机ip选取网卡
+ * @return int 成功为0，失败为-1
+ */
+static int driver_xdp_open(const char *arg) {
+    char if_name[PCAP_BUF_SIZE];
+    uint32_t mask;
+    if (arg)
+        snprintf(if_name, sizeof(if_name), "%s", arg);
+    else if (driver_find(net_if_ip, if_name, (uint8_t *)&mask) < 0) {
+        fprintf(stderr, "Error in driver find.\n");
+        return -1;
+    }
+    int ifindex = if_nametoindex(if_name);
+    if (ifindex == 0) {
+        fprintf(stderr, "Error in if_nametoindex: %s %s.\n", if_name, strerror(errno));
+        return -1;
+    }
+    printf("Using interface %s, my ip is %s.\n", if_name, iptos(net_if_ip));
+
+    // Step1: 创建套接字，注册UMEM并映射各环
+    memset(&xdp, 0, sizeof(xdp));
+    xdp.map_fd = xdp.prog_fd = xdp.link_fd = -1;
+    xdp.fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (xdp.fd < 0) {
+        fprintf(stderr, "Error in socket(AF_XDP): %s.\n", strerror(errno));
+        return -1;
+    }
+    if (driver_xdp_umem() < 0) {
+        driver_xdp_close();
+        return -1;
+    }
+
+    // Step2: 补满填充环后以复制模式绑定网卡队列
+    driver_xdp_refill();
+    struct sockaddr_xdp addr = {
+        .sxdp_family = AF_XDP,
+        .sxdp_ifindex = ifindex,
+        .sxdp_queue_id = DRIVER_XDP_QUEUE,
+        .sxdp_flags = XDP_COPY,
+    };
+    if (bind(xdp.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Error in bind: %s.\n", strerror(errno));
+        driver_xdp_close();
+        return -1;
+    }
+
+    // Step3: 加载XDP程序，以通用模式挂载到网卡，并把套接字登记到XSKMAP
+    if (driver_xdp_prog() < 0) {
+        driver_xdp_close();
+        return -1;
+    }
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = xdp.prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    xdp.link_fd = driver_xdp_bpf(BPF_LINK_CREATE, &attr);
+    if (xdp.link_fd < 0) {
+        fprintf(stderr, "Error in BPF_LINK_CREATE: %s.\n", strerror(errno));
+        driver_xdp_close();
+        return -1;
+    }
+    uint32_t key = DRIVER_XDP_QUEUE, value = xdp.fd;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = xdp.map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&value;
+    if (driver_xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+        fprintf(stderr, "Error in BPF_MAP_UPDATE_ELEM: %s.\n", strerror(errno));
+        driver_xdp_close();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 试图从接收环批量取出数据帧，数据帧所在的UMEM块直接交给buf，不拷贝
+ *        块的引用随之转给协议栈，释放后回到缓冲池，再由填充环借给内核
+ *
+ * @param bufs 收到的数据包
+ * @param n 最多接收的数据包数
+ * @return int 收到的数据包数，未收到为0
+ */
+static int driver_xdp_recv_burst(buf_t *bufs, int n) {
+    uint32_t cons = *xdp.rx.consumer;
+    uint32_t prod = __atomic_load_n(xdp.rx.producer, __ATOMIC_ACQUIRE);
+    struct xdp_desc *descs = xdp.rx.desc;
+    int num = 0;
+    for (; cons != prod && num < n; cons++, num++) {
+        // 块首到数据帧之间为内核预留的XDP_PACKET_HEADROOM，作为头部空间
+        struct xdp_desc *desc = &descs[cons % DRIVER_XDP_RING_SIZE];
+        uint64_t chunk = desc->addr & DRIVER_XDP_CHUNK_MASK;
+        xdp.kernel[driver_xdp_chunk(chunk)]--;
+        xdp.fill_num--;
+        buf_attach(&bufs[num], xdp.umem + chunk, BUF_MTU_LEN, desc->addr - chunk, desc->len);
+    }
+    __atomic_store_n(xdp.rx.consumer, cons, __ATOMIC_RELEASE);
+    driver_xdp_refill();
+    return num;
+}
+
+/**
+ * @brief 试图从接收环取出一个数据帧
+ *
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0
+ */
+static int driver_xdp_recv(buf_t *buf) {
+    return driver_xdp_recv_burst(buf, 1) ? buf->len : 0;
+}
+
+/**
+ * @brief 将数据帧的描述符写入发送环后通知内核批量发送，不拷贝地交出块的所有权
+ *        未被共享的单段常规块直接发送，持有一个引用直到完成环交还，协议栈之后写入时因块被共享而写时拷贝
+ *        buffer链、被共享的块与其他内存中的数据帧先聚集拷贝进新取的块
+ *
+ * @param bufs 要发送的数据包，可以是buffer链
+ * @param n 数据包数
+ * @return int 发送成功的数据包数，全部失败为-1
+ */
+static int driver_xdp_send_burst(buf_t *bufs, int n) {
+    driver_xdp_complete();
+    uint32_t prod = *xdp.tx.producer;
+    uint32_t cons = __atomic_load_n(xdp.tx.consumer, __ATOMIC_ACQUIRE);
+    struct xdp_desc *descs = xdp.tx.desc;
+    int num = 0;
+    for (; num < n && prod - cons < DRIVER_XDP_RING_SIZE; num++, prod++) {
+        buf_t *buf = &bufs[num];
+        size_t len = buf_chain_len(buf);
+        uint64_t addr;
+        if (buf->next == NULL && buf->payload >= xdp.umem && buf->payload < xdp.umem + xdp.umem_num * BUF_MTU_LEN && !buf_shared(buf)) {
+            buf_block_hold(buf->payload);
+            addr = buf->data - xdp.umem;
+        } else {
+            if (len > BUF_MTU_LEN) {
+                fprintf(stderr, "Error in driver_xdp_send_burst: frame too long %zu.\n", len);
+                break;
+            }
+            uint8_t *block = buf_block_get();
+            if (block == NULL)
+                break;  // 缓冲池耗尽，如同网卡的发送队列溢出
+            uint8_t *p = block;
+            for (buf_t *seg = buf; seg; p += seg->len, seg = seg->next)
+                memcpy(p, seg->data, seg->len);
+            addr = block - xdp.umem;
+        }
+        xdp.kernel[driver_xdp_chunk(addr)]++;
+        descs[prod % DRIVER_XDP_RING_SIZE] = (struct xdp_desc){.addr = addr, .len = len};
+    }
+    __atomic_store_n(xdp.tx.producer, prod, __ATOMIC_RELEASE);
+    // 复制模式下由sendto在系统调用中完成发送
+    if (num && (driver_stat.tx_syscalls++, sendto(xdp.fd, NULL, 0, MSG_DONTWAIT, NULL, 0)) < 0 && errno != EAGAIN && errno != EBUSY && errno != ENOBUFS) {
+        fprintf(stderr, "Error in driver_xdp_send_burst: %s.\n", strerror(errno));
+        return -1;
+    }
+    return num ? num : -1;
+}
+
+/**
+ * @brief 使用网卡发送一个数据包
+ *
+ * @param buf 要发送的数据包，可以是buffer链
+ * @return int 成功为0，失败为-1
+ */
+static int driver_xdp_send(buf_t *buf) {
+    return driver_xdp_send_burst(buf, 1) == 1 ? 0 : -1;
+}
+
+/**
+ * @brief 关闭网卡，卸载XDP程序，内核仍持有的块归还缓冲池
+ *
+ */
+static void driver_xdp_close() {
+    driver_xdp_ring_t *rings[] = {&xdp.fill, &xdp.comp, &xdp.rx, &xdp.tx};
+    for (size_t i = 0; i < sizeof(rings) / sizeof(rings[0]); i++)
+        if (rings[i]->map)
+            munmap(rings[i]->map, rings[i]->map_len);
+    int fds[] = {xdp.link_fd, xdp.prog_fd, xdp.map_fd, xdp.fd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+        if (fds[i] >= 0)
+            close(fds[i]);
+    // 套接字关闭后内核不再访问UMEM
+    for (size_t i = 0; i < xdp.umem_num; i++)
+        for (; xdp.kernel[i]; xdp.kernel[i]--)
+            buf_block_put(xdp.umem + i * BUF_MTU_LEN);
+    memset(&xdp, 0, sizeof(xdp));
+    xdp.fd = xdp.map_fd = xdp.prog_fd = xdp.link_fd = -1;
+}
+
+/**
+ * @brief 获取可用于select/epoll等待的文件描述符，接收环非空时可读
+ *
+ * @return int 文件描述符
+ */
+static int driver_xdp_fd() {
+    return xdp.fd;
+}
+
+/**
+ * @brief Linux AF_XDP驱动，复制模式，UMEM即缓冲池的常规块，收发的数据帧在内核与协议栈间转移块的所有权
+ *
+ */
+const net_driver_ops_t driver_xdp_ops = {
+    .name = "afxdp",
+    .caps = DRIVER_CAP_RECV_BURST | DRIVER_CAP_SEND_BURST | DRIVER_CAP_FD,
+    .open = driver_xdp_open,
+    .recv = driver_xdp_recv,
+    .recv_burst = driver_xdp_recv_burst,
+    .send = driver_xdp_send,
+    .send_burst = driver_xdp_send_burst,
+    .close = driver_xdp_close,
+    .fd = driver_xdp_fd,
+};
+#endif
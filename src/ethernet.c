@@ -4,6 +4,29 @@
 #include "driver.h"
 #include "ip.h"
 #include "utils.h"
+
+/**
+ * @brief 发送队列，持有待发送数据帧的共享引用
+ *
+ */
+static buf_t ethernet_tx_ring[NET_TX_RING_SIZE];
+static int ethernet_tx_num;
+
+/**
+ * @brief 内部函数，将数据帧交给驱动批量发送，只统计实际发出的帧，其余计为丢弃
+ *
+ * @param bufs 要发送的数据帧
+ * @param n 数据帧数
+ */
+static void ethernet_send(buf_t *bufs, int n) {
+    int sent = driver_send_burst(bufs, n);
+    if (sent < 0)
+        sent = 0;
+    net_stat.flush_num++;
+    net_stat.tx_frame_num += sent;
+    net_stat.tx_drop_num += n - sent;
+}
+
 /**
  * @brief 处理一个收到的数据包
  *
@@ -39,12 +62,17 @@ void ethernet_in(buf_t *buf) {
  */
 void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol) {
     // Step1: 数据长度检查与填充
-    if (buf->len < ETHERNET_MIN_TRANSPORT_UNIT) {
-        buf_add_padding(buf, ETHERNET_MIN_TRANSPORT_UNIT - buf->len);
+    // 填充只能加在连续的块上，短帧为buffer链时先合并
+    size_t len = buf_chain_len(buf);
+    if (len < ETHERNET_MIN_TRANSPORT_UNIT) {
+        if (buf_linearize(buf) < 0)
+            return;
+        buf_add_padding(buf, ETHERNET_MIN_TRANSPORT_UNIT - len);
     }
     
     // Step2: 添加以太网包头
-    buf_add_header(buf, sizeof(ether_hdr_t));
+    if (buf_add_header(buf, sizeof(ether_hdr_t)) < 0)
+        return;
     ether_hdr_t *hdr = (ether_hdr_t *)buf->data;
     
     // Step3: 填写目的MAC地址
@@ -57,22 +85,69 @@ void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol) {
     hdr->protocol16 = swap16(protocol);
     
     // Step6: 发送数据帧
-    // 调用驱动层封装好的 driver_send() 发送函数
-    driver_send(buf);
+    // 引用外部内存（buf_ref的应用数据、驱动内存）的帧只在调用期间有效，入队须拷贝，因此先发出队列中的帧再直接发送
+    if (!buf_pooled(buf)) {
+        ethernet_flush();
+        ethernet_send(buf, 1);
+        return;
+    }
+    // 放入发送队列，共享调用者的块，调用者之后的写入会触发写时拷贝
+    buf_clone(&ethernet_tx_ring[ethernet_tx_num], buf, sizeof(buf_t));
+    if (ethernet_tx_ring[ethernet_tx_num].payload == NULL) {
+        net_stat.tx_drop_num++;  // 句柄耗尽，丢弃该帧
+        return;
+    }
+    ethernet_tx_num++;
+    if (ethernet_tx_num > net_stat.tx_depth_max)
+        net_stat.tx_depth_max = ethernet_tx_num;
+    if (ethernet_tx_num == NET_TX_RING_SIZE) {
+        net_stat.flush_full++;
+        ethernet_flush();
+    }
+}
+
+/**
+ * @brief 批量发送发送队列中的全部数据帧，由net_poll每次轮询结束时调用
+ *
+ */
+void ethernet_flush() {
+    if (ethernet_tx_num == 0)
+        return;
+    ethernet_send(ethernet_tx_ring, ethernet_tx_num);
+    for (int i = 0; i < ethernet_tx_num; i++)
+        buf_free(&ethernet_tx_ring[i]);
+    ethernet_tx_num = 0;
 }
 /**
  * @brief 初始化以太网协议
  *
  */
 void ethernet_init() {
-    buf_init(&rxbuf, ETHERNET_MAX_TRANSPORT_UNIT + sizeof(ether_hdr_t));
+    // rxbuf由驱动在接收时装载（拷贝模式取块，原地模式引用驱动内存），不预先占用缓冲池
 }
 
 /**
- * @brief 一次以太网轮询
+ * @brief 一次以太网轮询，批量接收至多NET_POLL_BUDGET个数据帧并逐个处理
+ *        只读视图模式的驱动每次只能交出一帧（下一次接收即失效），因此处理完一批后继续接收，直到预算用完或没有数据帧
+ *        每批处理完即释放rxbuf的块，空闲时不占用缓冲池
  *
+ * @return int 处理的数据帧数，错误为-1
  */
-void ethernet_poll() {
-    if (driver_recv(&rxbuf) > 0)
-        ethernet_in(&rxbuf);
+int ethernet_poll() {
+    int total = 0;
+    while (total < NET_POLL_BUDGET) {
+        int num = driver_recv_burst(rxbuf, NET_POLL_BUDGET - total);
+        if (num <= 0)
+            return (num < 0 && total == 0) ? -1 : total;
+        for (int i = 0; i < num; i++) {
+            // 处理当前帧时预取下一帧的帧头
+            if (i + 1 < num)
+                prefetch(rxbuf[i + 1].data);
+            ethernet_in(&rxbuf[i]);
+        }
+        for (int i = 0; i < num; i++)
+            buf_free(&rxbuf[i]);
+        total += num;
+    }
+    return total;
 }
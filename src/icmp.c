@@ -11,12 +11,14 @@
  */
 static void icmp_resp(buf_t *req_buf, uint8_t *src_ip) {
     // Step1: 初始化并封装数据
-    // 初始化发送缓冲区
-    buf_init(&txbuf, req_buf->len);
+    // 分配只放ICMP报头的首段
+    buf_t *buf = buf_alloc(sizeof(icmp_hdr_t));
+    if (buf == NULL)
+        return;
     // 获取接收到的ICMP报头
     icmp_hdr_t *req_icmp_hdr = (icmp_hdr_t *)req_buf->data;
     // 在发送缓冲区中构造ICMP报头
-    icmp_hdr_t *resp_icmp_hdr = (icmp_hdr_t *)txbuf.data;
+    icmp_hdr_t *resp_icmp_hdr = (icmp_hdr_t *)buf->data;
     // 设置ICMP响应报头字段
     resp_icmp_hdr->type = ICMP_TYPE_ECHO_REPLY;  // 回显应答类型 (0)
     resp_icmp_hdr->code = 0;                     // 代码字段为0
@@ -24,21 +26,25 @@ static void icmp_resp(buf_t *req_buf, uint8_t *src_ip) {
     resp_icmp_hdr->id16 = req_icmp_hdr->id16;        // 复制请求报文的标识符
     resp_icmp_hdr->seq16 = req_icmp_hdr->seq16;      // 复制请求报文的序列号
     
-    // 复制数据部分（从请求报文的数据部分开始）
+    // 数据部分直接引用请求报文的数据部分，与其共享块而不拷贝
     size_t data_len = req_buf->len - sizeof(icmp_hdr_t);
     if (data_len > 0) {
-        memcpy(txbuf.data + sizeof(icmp_hdr_t), 
-               req_buf->data + sizeof(icmp_hdr_t), 
-               data_len);
+        buf_t *slice = buf_slice(req_buf, sizeof(icmp_hdr_t), data_len);
+        if (slice == NULL) {
+            buf_free(buf);
+            return;
+        }
+        buf_chain(buf, slice);
     }
     
     // Step2: 填写校验和
     // 计算整个ICMP报文的校验和
-    resp_icmp_hdr->checksum16 = checksum16((uint16_t *)txbuf.data, txbuf.len);
+    resp_icmp_hdr->checksum16 = buf_checksum16(buf);
     
     // Step3: 发送数据报
     // 调用ip_out函数发送ICMP响应报文
-    ip_out(&txbuf, src_ip, NET_PROTOCOL_ICMP);
+    ip_out(buf, src_ip, NET_PROTOCOL_ICMP);
+    buf_free(buf);
 }
 
 /**
@@ -76,8 +82,9 @@ void icmp_unreachable(buf_t *recv_buf, uint8_t *src_ip, icmp_code_t code) {
     size_t ip_hdr_len = sizeof(ip_hdr_t);
     size_t icmp_data_len = ip_hdr_len + 8; // IP头部 + 前8字节数据
     size_t total_len = sizeof(icmp_hdr_t) + icmp_data_len;
-    // 初始化发送缓冲区
-    buf_init(&txbuf, total_len);
+    // 初始化发送缓冲区，缓冲池耗尽时放弃
+    if (buf_init(&txbuf, total_len) < 0)
+        return;
     // 构造ICMP报头
     icmp_hdr_t *icmp_hdr = (icmp_hdr_t *)txbuf.data;
     icmp_hdr->type = ICMP_TYPE_UNREACH;      // 目标不可达类型
@@ -32,20 +32,12 @@ void ip_in(buf_t *buf, uint8_t *src_mac) {
         return;
     }
     
-    // Step3 校验头部校验和
-    // 先把头部校验和字段用其他变量保存起来
-    uint16_t original_checksum = ip_hdr->hdr_checksum16;
-    // 将该头部校验和字段置为 0
-    ip_hdr->hdr_checksum16 = 0;
-    // 调用 checksum16 函数来计算头部校验和
-    uint16_t calculated_checksum = checksum16((uint16_t *)ip_hdr, sizeof(ip_hdr_t));
-    // 将计算结果与 IP 头部原本的首部校验和字段进行对比
-    if (calculated_checksum != original_checksum) {
-        // 若不一致，说明数据包在传输过程中可能出现损坏，将其丢弃
+    // Step3 校验头部校验和，驱动的BUF_FLAG_CSUM_VERIFIED只涉及传输层，头部总是由软件校验
+    // 连同校验和字段一起计算，结果为0说明头部正确，不修改收到的数据包（可能是驱动内存的只读视图）
+    if (checksum16((uint16_t *)ip_hdr, sizeof(ip_hdr_t)) != 0) {
+        // 若不为0，说明数据包在传输过程中可能出现损坏，将其丢弃
         return;
     }
-    // 若一致，则再将该头部校验和字段恢复成原来的值
-    ip_hdr->hdr_checksum16 = original_checksum;
     
     // Step4 对比目的 IP 地址是否为本机的 IP 地址
     if (memcmp(ip_hdr->dst_ip, net_if_ip, NET_IP_LEN) != 0) {
@@ -97,7 +89,7 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
     // 区分服务（服务类型）
     ip_hdr->tos = 0;
     // 总长度（包括头部和数据，转换为网络字节序）
-    ip_hdr->total_len16 = swap16(buf->len);
+    ip_hdr->total_len16 = swap16(buf_chain_len(buf));
     // 数据包标识（转换为网络字节序）
     ip_hdr->id16 = swap16(id);
     // 设置分片标志和偏移量
@@ -139,18 +131,18 @@ void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol) {
     // Step1 检查从上层传递下来的数据报包长是否大于 IP 协议最大负载包长
     static int packet_id = 0; // 数据包ID，每个数据包递增
     int current_id = packet_id++;
-    if (buf->len <= max_payload) {
-        // 直接发送
+    size_t total_len = buf_chain_len(buf);
+    if (total_len <= max_payload || (buf->flags & BUF_FLAG_GSO_TCP)) {
+        // 直接发送，超长的TCP报文段由驱动/网卡分段
         ip_fragment_out(buf, ip, protocol, current_id, 0, 0);
         return;
     }
     
     // Step2 若数据报包长超过 IP 协议最大负载包长，则需要进行分片发送
 
-    uint16_t remaining_len = buf->len;
+    uint16_t remaining_len = total_len;
     uint16_t data_offset = 0;
     uint16_t fragment_offset = 0; // 分片偏移量（以8字节为单位）
-    buf_t ip_buf;
     
     while (remaining_len > 0) {
         // 计算当前分片的大小
@@ -167,14 +159,19 @@ void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol) {
             mf = 0; // 清除MF标志，表示这是最后一个分片
         }
         
-        // 首先调用 buf_init() 初始化一个 ip_buf
-        buf_init(&ip_buf, fragment_size);
-        
-        // 将数据复制到分片缓冲区
-        memcpy(ip_buf.data, buf->data + data_offset, fragment_size);
+        // 分片由一个只放IP报头的空首段和引用原数据包对应区间的段组成，不拷贝数据
+        buf_t *ip_buf = buf_alloc(0);
+        buf_t *slice = buf_slice(buf, data_offset, fragment_size);
+        if (ip_buf == NULL || slice == NULL) {
+            if (ip_buf)
+                buf_free(ip_buf);
+            return;
+        }
+        buf_chain(ip_buf, slice);
         
         // 调用 ip_fragment_out() 函数发送出去
-        ip_fragment_out(&ip_buf, ip, protocol, current_id, fragment_offset, mf);
+        ip_fragment_out(ip_buf, ip, protocol, current_id, fragment_offset, mf);
+        buf_free(ip_buf);
         
         // 更新偏移和剩余长度
         data_offset += fragment_size;
@@ -1,20 +1,69 @@
 #include "map.h"
 
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#define MAP_SLOT_EMPTY 0               // 索引槽为空
+#define MAP_SLOT_TOMBSTONE UINT32_MAX  // 索引槽对应的键值对已删除，探测时需跳过而不能停止
+
+typedef struct map_link  // 键值对的双向链表节点，时间轮与淘汰顺序各一个，附在每个键值对之后
+{
+    uint32_t prev;  // 前一个键值对的序号+1，0为链表头
+    uint32_t next;  // 后一个键值对的序号+1，0为链表尾
+} map_link_t;
+
+/**
+ * @brief 带超时的map，由map_poll定时清理
+ *
+ */
+static map_t *map_timed[MAP_TIMED_MAX];
+static size_t map_timed_num;
+static size_t map_timed_next;  // 下次轮询开始清理的map，轮流开始以免靠后的map得不到清理
+
+/**
+ * @brief 内部函数，键值对的长度
+ *
+ * @param map 要获取的map
+ * @return size_t 键值对长度，包括键、值、更新时间、时间轮与淘汰顺序的链表节点
+ */
+static inline size_t map_entry_len(map_t *map) {
+    return map->key_len + map->value_len + sizeof(time_t) + 2 * sizeof(map_link_t);
+}
+
+/**
+ * @brief 内部函数，哈希索引，位于数据区的开头
+ *
+ * @param map 要获取的map
+ * @return uint32_t* 索引槽数组，每个槽存放键值对的序号+1
+ */
+static inline uint32_t *map_index(map_t *map) {
+    return (uint32_t *)map->data;
+}
+
+static int map_rehash(map_t *map, size_t capacity);
+
 /**
- * @brief 初始化map
+ * @brief 初始化map，存储空间从MAP_INIT_SIZE开始按需倍增，不再使用时须调用map_destroy释放
+ *        map的原有内容被直接清零，清空使用中的map应调用map_reset，更换参数应先调用map_destroy
  *
- * @param map 要初始化的map
+ * @param map 要初始化的map，未初始化或已map_destroy
  * @param key_len 键的长度
  * @param value_len 值的长度
- * @param max_size 最大容量，为0则根据MAP_MAX_LEN自动设置
+ * @param max_size 最大容量，为0则使用MAP_DEFAULT_MAX_SIZE
  * @param timeout 超时秒数，为0则永不超时
+ * @param policy 满时的淘汰策略，为MAP_EVICT_NONE则插入失败
+ * @param key_compare 形如memcmp的比较函数，为NULL则使用memcmp，须与按字节的相等保持一致
  * @param value_constuctor 形如memcpy的构造函数，用于拷贝值到容器中，为NULL则使用memcpy
+ * @param value_destructor 值的析构函数，在值被覆盖、删除或过期复用时调用，为NULL则不做处理
  */
-void map_init(map_t *map, size_t key_len, size_t value_len, size_t max_size, time_t timeout, map_compare_t key_compare, map_constuctor_t value_constuctor) {
-    if (max_size == 0 || max_size * (key_len + value_len + sizeof(time_t)) > MAP_MAX_LEN)
-        max_size = MAP_MAX_LEN / (key_len + value_len + sizeof(time_t));
+void map_init(map_t *map, size_t key_len, size_t value_len, size_t max_size, time_t timeout, map_policy_t policy, map_compare_t key_compare, map_constuctor_t value_constuctor, map_destructor_t value_destructor) {
+    if (max_size == 0)
+        max_size = MAP_DEFAULT_MAX_SIZE;
+    if (max_size > UINT32_MAX / 2)
+        max_size = UINT32_MAX / 2;  // 索引槽中存放uint32_t的序号
     if (value_constuctor == NULL)
         value_constuctor = (map_constuctor_t)memcpy;
     if (key_compare == NULL)
@@ -25,8 +74,22 @@ void map_init(map_t *map, size_t key_len, size_t value_len, size_t max_size, tim
     map->value_len = value_len;
     map->max_size = max_size;
     map->timeout = timeout;
+    map->policy = policy;
     map->key_compare = key_compare;
     map->value_constuctor = value_constuctor;
+    map->value_destructor = value_destructor;
+    map->wheel_time = net_now();
+    map_rehash(map, max_size < MAP_INIT_SIZE ? max_size : MAP_INIT_SIZE);
+
+    if (timeout) {
+        for (size_t i = 0; i < map_timed_num; i++)
+            if (map_timed[i] == map)
+                return;
+        if (map_timed_num < MAP_TIMED_MAX)
+            map_timed[map_timed_num++] = map;
+        else
+            fprintf(stderr, "Error in map_init: too many timed maps, entries will only expire lazily.\n");
+    }
 }
 
 /**
@@ -40,16 +103,140 @@ size_t map_size(map_t *map) {
 }
 
 /**
- * @brief 内部函数，获取第n个物理位置的键值对
+ * @brief 内部函数，获取第n个键值对，键值对按插入顺序紧凑存放在索引之后
  *
  * @param map 要获取的map
  * @param pos 位置
  * @return void* 键值对指针
  */
 void *map_entry_get(map_t *map, size_t pos) {
-    if (pos >= map->max_size)
+    if (pos >= map->capacity)
         return NULL;
-    return map->data + pos * (map->key_len + map->value_len + sizeof(time_t));
+    return map->data + map->index_cap * sizeof(uint32_t) + pos * map_entry_len(map);
+}
+
+/**
+ * @brief 内部函数，获取键值对的更新时间
+ *
+ * @param map 要获取的map
+ * @param entry 键值对指针
+ * @return time_t* 更新时间指针，为0表示已删除
+ */
+static inline time_t *map_entry_time(map_t *map, const void *entry) {
+    return (time_t *)((uint8_t *)entry + map->key_len + map->value_len);
+}
+
+/**
+ * @brief 内部函数，获取键值对的时间轮链表节点
+ *
+ * @param map 要获取的map
+ * @param entry 键值对指针
+ * @return map_link_t* 链表节点指针
+ */
+static inline map_link_t *map_entry_link(map_t *map, const void *entry) {
+    return (map_link_t *)((uint8_t *)entry + map->key_len + map->value_len + sizeof(time_t));
+}
+
+/**
+ * @brief 内部函数，键值对过期时间在时间轮中对应的槽
+ *
+ * @param map 要计算的map
+ * @param entry 键值对指针
+ * @return uint32_t* 槽指针
+ */
+static inline uint32_t *map_wheel_slot(map_t *map, const void *entry) {
+    // 更新时间+timeout仍然有效，再过1秒才过期
+    return &map->wheel[(*map_entry_time(map, entry) + map->timeout + 1) % MAP_WHEEL_SIZE];
+}
+
+/**
+ * @brief 内部函数，将第pos个键值对按其过期时间挂入时间轮
+ *
+ * @param map 要操作的map
+ * @param pos 键值对位置
+ */
+static void map_wheel_link(map_t *map, size_t pos) {
+    if (!map->timeout)
+        return;
+    uint8_t *entry = map_entry_get(map, pos);
+    uint32_t *head = map_wheel_slot(map, entry);
+    map_link_t *link = map_entry_link(map, entry);
+    link->prev = 0;
+    link->next = *head;
+    if (*head)
+        map_entry_link(map, map_entry_get(map, *head - 1))->prev = pos + 1;
+    *head = pos + 1;
+}
+
+/**
+ * @brief 内部函数，将第pos个键值对从时间轮中摘下，须在修改其更新时间之前调用
+ *
+ * @param map 要操作的map
+ * @param pos 键值对位置
+ */
+static void map_wheel_unlink(map_t *map, size_t pos) {
+    if (!map->timeout)
+        return;
+    uint8_t *entry = map_entry_get(map, pos);
+    map_link_t *link = map_entry_link(map, entry);
+    if (map->wheel_cursor == pos + 1)
+        map->wheel_cursor = link->next;
+    if (link->prev)
+        map_entry_link(map, map_entry_get(map, link->prev - 1))->next = link->next;
+    else
+        *map_wheel_slot(map, entry) = link->next;
+    if (link->next)
+        map_entry_link(map, map_entry_get(map, link->next - 1))->prev = link->prev;
+}
+
+/**
+ * @brief 内部函数，获取键值对的淘汰顺序链表节点
+ *
+ * @param map 要获取的map
+ * @param entry 键值对指针
+ * @return map_link_t* 链表节点指针
+ */
+static inline map_link_t *map_entry_lru(map_t *map, const void *entry) {
+    return map_entry_link(map, entry) + 1;
+}
+
+/**
+ * @brief 内部函数，将第pos个键值对放到淘汰顺序链表头，即最后被淘汰
+ *
+ * @param map 要操作的map
+ * @param pos 键值对位置
+ */
+static void map_lru_link(map_t *map, size_t pos) {
+    if (map->policy == MAP_EVICT_NONE)
+        return;
+    map_link_t *link = map_entry_lru(map, map_entry_get(map, pos));
+    link->prev = 0;
+    link->next = map->lru_head;
+    if (map->lru_head)
+        map_entry_lru(map, map_entry_get(map, map->lru_head - 1))->prev = pos + 1;
+    else
+        map->lru_tail = pos + 1;
+    map->lru_head = pos + 1;
+}
+
+/**
+ * @brief 内部函数，将第pos个键值对从淘汰顺序链表中摘下
+ *
+ * @param map 要操作的map
+ * @param pos 键值对位置
+ */
+static void map_lru_unlink(map_t *map, size_t pos) {
+    if (map->policy == MAP_EVICT_NONE)
+        return;
+    map_link_t *link = map_entry_lru(map, map_entry_get(map, pos));
+    if (link->prev)
+        map_entry_lru(map, map_entry_get(map, link->prev - 1))->next = link->next;
+    else
+        map->lru_head = link->next;
+    if (link->next)
+        map_entry_lru(map, map_entry_get(map, link->next - 1))->prev = link->prev;
+    else
+        map->lru_tail = link->prev;
 }
 
 /**
@@ -60,8 +247,212 @@ void *map_entry_get(map_t *map, size_t pos) {
  * @return int 1为合法，0为不合法
  */
 int map_entry_valid(map_t *map, const void *entry) {
-    time_t entry_time = *(time_t *)((uint8_t *)entry + map->key_len + map->value_len);
-    return entry_time && (!map->timeout || entry_time + map->timeout >= time(NULL));
+    time_t entry_time = *map_entry_time(map, entry);
+    return entry_time && (!map->timeout || entry_time + map->timeout >= net_now());
+}
+
+/**
+ * @brief 内部函数，计算键的哈希值（FNV-1a）
+ *
+ * @param map 要计算的map
+ * @param key 键指针
+ * @return uint32_t 哈希值
+ */
+static uint32_t map_hash(map_t *map, const void *key) {
+    const uint8_t *p = key;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < map->key_len; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief 内部函数，将第pos个键值对插入哈希索引，使用线性探测
+ *
+ * @param map 要操作的map
+ * @param pos 键值对位置
+ */
+static void map_index_insert(map_t *map, size_t pos) {
+    uint32_t *index = map_index(map);
+    size_t mask = map->index_cap - 1;
+    size_t i = map_hash(map, map_entry_get(map, pos)) & mask;
+    while (index[i] != MAP_SLOT_EMPTY && index[i] != MAP_SLOT_TOMBSTONE)
+        i = (i + 1) & mask;
+    if (index[i] == MAP_SLOT_TOMBSTONE)
+        map->tombstones--;
+    index[i] = pos + 1;
+}
+
+/**
+ * @brief 内部函数，在哈希索引中查找键
+ *
+ * @param map 要查找的map
+ * @param key 键指针
+ * @return size_t 索引槽位置，找不到为index_cap
+ */
+static size_t map_index_find(map_t *map, const void *key) {
+    uint32_t *index = map_index(map);
+    size_t mask = map->index_cap - 1;
+    // 最多探测一圈，索引中没有空槽时也能终止
+    for (size_t n = 0, i = map_hash(map, key) & mask; n < map->index_cap; n++, i = (i + 1) & mask) {
+        if (index[i] == MAP_SLOT_EMPTY)
+            break;
+        if (index[i] != MAP_SLOT_TOMBSTONE && !map->key_compare(key, map_entry_get(map, index[i] - 1), map->key_len))
+            return i;
+    }
+    return map->index_cap;
+}
+
+/**
+ * @brief 内部函数，移除索引槽对应的键值对
+ *
+ * @param map 要操作的map
+ * @param slot 索引槽位置
+ */
+static void map_slot_remove(map_t *map, size_t slot) {
+    uint32_t *index = map_index(map);
+    size_t pos = index[slot] - 1;
+    uint8_t *entry = map_entry_get(map, pos);
+    if (map->value_destructor)
+        map->value_destructor(entry + map->key_len);
+    map_wheel_unlink(map, pos);
+    map_lru_unlink(map, pos);
+    *map_entry_time(map, entry) = 0;
+    index[slot] = MAP_SLOT_TOMBSTONE;
+    map->tombstones++;
+    map->size--;
+    while (map->tail && *map_entry_time(map, map_entry_get(map, map->tail - 1)) == 0)
+        map->tail--;  // 回收末尾已删除的位置
+}
+
+/**
+ * @brief 内部函数，回收索引槽对应的已过期键值对，先调用过期回调
+ *
+ * @param map 要操作的map
+ * @param slot 索引槽位置
+ */
+static void map_slot_expire(map_t *map, size_t slot) {
+    uint8_t *entry = map_entry_get(map, map_index(map)[slot] - 1);
+    if (map->expire_handler)
+        map->expire_handler(entry, entry + map->key_len, map_entry_time(map, entry));
+    map_slot_remove(map, slot);
+}
+
+/**
+ * @brief 内部函数，查找键对应的有效键值对，顺带清除已过期的键值对
+ *
+ * @param map 要查找的map
+ * @param key 键指针
+ * @return size_t 索引槽位置，找不到为index_cap
+ */
+static size_t map_find(map_t *map, const void *key) {
+    size_t slot = map_index_find(map, key);
+    if (slot == map->index_cap)
+        return slot;
+    if (!map_entry_valid(map, map_entry_get(map, map_index(map)[slot] - 1))) {
+        map_slot_expire(map, slot);
+        return map->index_cap;
+    }
+    return slot;
+}
+
+/**
+ * @brief 内部函数，重新分配存储空间，清除已删除和已过期的键值对，将剩余键值对按原顺序紧凑排列并重建索引
+ *
+ * @param map 要整理的map
+ * @param capacity 新的键值对容量，须不小于当前有效键值对数
+ * @return int 成功为0，失败为-1
+ */
+static int map_rehash(map_t *map, size_t capacity) {
+    // 索引槽数为2的幂且不少于容量的2倍，使装载因子不超过1/2
+    size_t index_cap = 2;
+    while (index_cap < capacity * 2)
+        index_cap *= 2;
+    size_t entry_len = map_entry_len(map);
+    uint8_t *data = calloc(1, index_cap * sizeof(uint32_t) + capacity * entry_len);
+    if (data == NULL) {
+        fprintf(stderr, "Error in map_rehash: failed to allocate %zu entries.\n", capacity);
+        return -1;
+    }
+    // 记录旧位置到新位置的映射，用于按原顺序重建淘汰顺序链表
+    uint32_t *remap = NULL;
+    if (map->policy != MAP_EVICT_NONE && map->tail) {
+        remap = calloc(map->tail, sizeof(uint32_t));
+        if (remap == NULL) {
+            free(data);
+            fprintf(stderr, "Error in map_rehash: failed to allocate %zu entries.\n", capacity);
+            return -1;
+        }
+    }
+    uint8_t *entries = data + index_cap * sizeof(uint32_t);
+    size_t count = 0;
+    for (size_t i = 0; i < map->tail; i++) {
+        uint8_t *entry = map_entry_get(map, i);
+        if (*map_entry_time(map, entry) == 0)
+            continue;
+        if (!map_entry_valid(map, entry)) {
+            if (map->expire_handler)
+                map->expire_handler(entry, entry + map->key_len, map_entry_time(map, entry));
+            if (map->value_destructor)
+                map->value_destructor(entry + map->key_len);
+            map->size--;
+            continue;
+        }
+        memcpy(entries + count * entry_len, entry, entry_len);
+        if (remap)
+            remap[i] = ++count;
+        else
+            count++;
+    }
+    uint8_t *old_data = map->data;
+    uint32_t old_lru = map->lru_tail;
+    size_t old_entries = map->index_cap * sizeof(uint32_t);
+    map->data = data;
+    map->capacity = capacity;
+    map->index_cap = index_cap;
+    map->tombstones = 0;
+    map->tail = count;
+    memset(map->wheel, 0, sizeof(map->wheel));
+    map->wheel_cursor = 0;
+    for (size_t i = 0; i < count; i++) {
+        map_index_insert(map, i);
+        map_wheel_link(map, i);
+    }
+    // 从旧链表尾向前逐个放到新链表头，保持原有的淘汰顺序
+    map->lru_head = map->lru_tail = 0;
+    for (uint32_t cur = old_lru; remap && cur;) {
+        uint8_t *entry = old_data + old_entries + (cur - 1) * entry_len;
+        if (remap[cur - 1])
+            map_lru_link(map, remap[cur - 1] - 1);
+        cur = map_entry_lru(map, entry)->prev;
+    }
+    free(remap);
+    free(old_data);
+    return 0;
+}
+
+/**
+ * @brief 内部函数，淘汰最早使用或最早更新的键值对，腾出一个位置
+ *
+ * @param map 要操作的map
+ * @return size_t 腾出的键值对位置
+ */
+static size_t map_evict(map_t *map) {
+    size_t pos = map->lru_tail - 1;
+    uint8_t *entry = map_entry_get(map, pos);
+    size_t slot = map_index_find(map, entry);
+    if (!map_entry_valid(map, entry)) {
+        map_slot_expire(map, slot);
+    } else {
+        if (map->evict_handler)
+            map->evict_handler(entry, entry + map->key_len, map_entry_time(map, entry));
+        map_slot_remove(map, slot);
+    }
+    if (pos >= map->tail)
+        pos = map->tail++;  // 末尾的位置已被回收
+    return pos;
 }
 
 /**
@@ -69,17 +460,20 @@ int map_entry_valid(map_t *map, const void *entry) {
  *
  * @param map 要获取的map
  * @param key 键指针
- * @return void* 值指针，找不到为NULL
+ * @return void* 值指针，找不到为NULL，在下一次map_set前有效
  */
 void *map_get(map_t *map, const void *key) {
     if (key == NULL)
         return NULL;
-    for (size_t i = 0; i < map->max_size; i++) {
-        uint8_t *entry = map_entry_get(map, i);
-        if (map_entry_valid(map, entry) && !map->key_compare(key, entry, map->key_len))
-            return entry + map->key_len;
+    size_t slot = map_find(map, key);
+    if (slot == map->index_cap)
+        return NULL;
+    size_t pos = map_index(map)[slot] - 1;
+    if (map->policy == MAP_EVICT_LRU) {
+        map_lru_unlink(map, pos);
+        map_lru_link(map, pos);
     }
-    return NULL;
+    return (uint8_t *)map_entry_get(map, pos) + map->key_len;
 }
 
 /**
@@ -91,26 +485,49 @@ void *map_get(map_t *map, const void *key) {
  * @return int 成功为0，失败为-1
  */
 int map_set(map_t *map, const void *key, const void *value) {
-    uint8_t *old_value = map_get(map, key);
-    if (old_value) {
+    size_t slot = key ? map_find(map, key) : map->index_cap;
+    if (slot != map->index_cap) {
+        size_t pos = map_index(map)[slot] - 1;
+        uint8_t *old_value = (uint8_t *)map_entry_get(map, pos) + map->key_len;
+        if (map->value_destructor)
+            map->value_destructor(old_value);
         map->value_constuctor(old_value, value, map->value_len);
-        *(time_t *)(old_value + map->value_len) = time(NULL);
+        map_wheel_unlink(map, pos);
+        map_lru_unlink(map, pos);
+        *(time_t *)(old_value + map->value_len) = net_now();
+        map_wheel_link(map, pos);
+        map_lru_link(map, pos);
         return 0;
     }
-    if (map->size == map->max_size)
+    // 已删除的槽达到索引的1/4时原容量重建，有效键值对不超过1/2，探测总能遇到空槽而停止
+    // 淘汰与删除后的插入不一定触发扩容，须在此单独检查
+    if (map->tombstones && map->tombstones >= map->index_cap / 4 && map_rehash(map, map->capacity) == -1)
         return -1;
-    for (size_t i = 0; i < map->max_size; i++) {
-        uint8_t *entry = map_entry_get(map, i);
-        if (!map_entry_valid(map, entry)) {
-            memcpy(entry, key, map->key_len);
-            map->value_constuctor(entry + map->key_len, value, map->value_len);
-            *(time_t *)(entry + map->key_len + map->value_len) = time(NULL);
-            map->size++;
-            return 0;
+    size_t pos;
+    if (map->size == map->max_size && map->policy != MAP_EVICT_NONE) {
+        pos = map_evict(map);
+    } else {
+        if (map->tail == map->capacity) {
+            // 有效键值对超过一半时倍增，否则原容量整理即可腾出位置
+            size_t capacity = map->capacity;
+            if (map->size >= capacity / 2 && capacity < map->max_size)
+                capacity = capacity * 2 < map->max_size ? capacity * 2 : map->max_size;
+            if (capacity == 0 || map_rehash(map, capacity) == -1)
+                return -1;
         }
+        if (map->tail == map->capacity)
+            return -1;
+        pos = map->tail++;
     }
-
-    return -1;
+    uint8_t *entry = map_entry_get(map, pos);
+    memcpy(entry, key, map->key_len);
+    map->value_constuctor(entry + map->key_len, value, map->value_len);
+    *map_entry_time(map, entry) = net_now();
+    map_index_insert(map, pos);
+    map_wheel_link(map, pos);
+    map_lru_link(map, pos);
+    map->size++;
+    return 0;
 }
 
 /**
@@ -120,23 +537,161 @@ int map_set(map_t *map, const void *key, const void *value) {
  * @param key 键指针
  */
 void map_delete(map_t *map, const void *key) {
-    uint8_t *value = map_get(map, key);
-    if (value) {
-        *(time_t *)(value + map->value_len) = 0;
-        map->size--;
-    }
+    if (key == NULL)
+        return;
+    size_t slot = map_find(map, key);
+    if (slot != map->index_cap)
+        map_slot_remove(map, slot);
 }
 
 /**
- * @brief 遍历map
+ * @brief 遍历map，按插入顺序访问（淘汰腾出的位置除外），回调中可以删除当前键
  *
  * @param map 要遍历的map
  * @param handler 对每个键值对应用的回调函数，参数为（键指针，值指针，更新时间指针）
  */
 void map_foreach(map_t *map, map_entry_handler_t handler) {
-    for (size_t i = 0; i < map->max_size; i++) {
+    for (size_t i = 0; i < map->tail; i++) {
         uint8_t *entry = map_entry_get(map, i);
         if (map_entry_valid(map, entry))
-            handler(entry, entry + map->key_len, (time_t *)(entry + map->key_len + map->value_len));
+            handler(entry, entry + map->key_len, map_entry_time(map, entry));
     }
 }
+
+/**
+ * @brief 设置map的过期回调，回调中不可修改该map
+ *
+ * @param map 要设置的map
+ * @param handler 过期回调，参数为（键指针，值指针，更新时间指针），为NULL则不做处理
+ */
+void map_set_expire_handler(map_t *map, map_entry_handler_t handler) {
+    map->expire_handler = handler;
+}
+
+/**
+ * @brief 设置map的淘汰回调，回调中不可修改该map
+ *
+ * @param map 要设置的map
+ * @param handler 淘汰回调，参数为（键指针，值指针，更新时间指针），为NULL则不做处理
+ */
+void map_set_evict_handler(map_t *map, map_entry_handler_t handler) {
+    map->evict_handler = handler;
+}
+
+/**
+ * @brief 按时间轮清理map中已过期的键值对
+ *
+ * @param map 要清理的map
+ * @param budget 最多检查的键值对数，用完后下次从中断处继续
+ * @return size_t 实际检查的键值对数
+ */
+size_t map_expire(map_t *map, size_t budget) {
+    if (!map->timeout)
+        return 0;
+    time_t now = net_now();
+    size_t work = 0;
+    // 落后超过一圈时只需把每个槽各清理一遍
+    if (now - map->wheel_time > MAP_WHEEL_SIZE) {
+        map->wheel_time = now - MAP_WHEEL_SIZE;
+        map->wheel_cursor = 0;
+    }
+    while (map->wheel_time < now) {
+        uint32_t *head = &map->wheel[(map->wheel_time + 1) % MAP_WHEEL_SIZE];
+        uint32_t cur = map->wheel_cursor ? map->wheel_cursor : *head;
+        while (cur) {
+            if (work == budget) {
+                map->wheel_cursor = cur;
+                return work;
+            }
+            work++;
+            uint8_t *entry = map_entry_get(map, cur - 1);
+            uint32_t next = map_entry_link(map, entry)->next;
+            // 同一槽中还有过期时间在之后几圈的键值对，留待以后清理
+            if (!map_entry_valid(map, entry))
+                map_slot_expire(map, map_index_find(map, entry));
+            cur = next;
+        }
+        map->wheel_cursor = 0;
+        map->wheel_time++;
+    }
+    return work;
+}
+
+/**
+ * @brief 清理所有带超时的map，由net_poll每次轮询调用一次
+ *
+ * @param budget 本次最多检查的键值对总数
+ */
+void map_poll(size_t budget) {
+    for (size_t i = 0; i < map_timed_num && budget; i++)
+        budget -= map_expire(map_timed[(map_timed_next + i) % map_timed_num], budget);
+    if (map_timed_num)
+        map_timed_next = (map_timed_next + 1) % map_timed_num;
+}
+
+/**
+ * @brief 获取带超时的map中最早需要清理的时间，供事件循环决定最多阻塞多久
+ *        时间轮的槽中可能混有之后几圈才过期的键值对，因此结果只会偏早而不会偏晚
+ *
+ * @return time_t 最早的清理时间，已有待清理的键值对时为当前时间，没有带超时的键值对时为0
+ */
+time_t map_next_expire() {
+    time_t now = net_now(), next = 0;
+    for (size_t i = 0; i < map_timed_num; i++) {
+        map_t *map = map_timed[i];
+        if (map->size == 0)
+            continue;
+        if (map->wheel_cursor || map->wheel_time + 1 < now)
+            return now;  // 上次清理因预算用完而中断，或已落后
+        for (time_t t = map->wheel_time + 1; t <= map->wheel_time + MAP_WHEEL_SIZE; t++)
+            if (map->wheel[t % MAP_WHEEL_SIZE]) {
+                if (next == 0 || t < next)
+                    next = t;
+                break;
+            }
+    }
+    return next && next < now ? now : next;
+}
+
+/**
+ * @brief 内部函数，析构剩余的值并释放存储空间，保留map的参数
+ *
+ * @param map 要释放的map
+ */
+static void map_release(map_t *map) {
+    for (size_t i = 0; i < map->tail; i++) {
+        uint8_t *entry = map_entry_get(map, i);
+        if (*map_entry_time(map, entry) && map->value_destructor)
+            map->value_destructor(entry + map->key_len);
+    }
+    free(map->data);
+    map->data = NULL;
+    map->capacity = map->tail = map->size = map->index_cap = map->tombstones = 0;
+    map->lru_head = map->lru_tail = 0;
+}
+
+/**
+ * @brief 清空map，析构所有的值并回到初始容量，键值长度、超时、淘汰策略与回调保持不变
+ *
+ * @param map 要清空的map，须已初始化
+ * @return int 成功为0，失败为-1
+ */
+int map_reset(map_t *map) {
+    map_release(map);
+    map->wheel_time = net_now();
+    return map_rehash(map, map->max_size < MAP_INIT_SIZE ? map->max_size : MAP_INIT_SIZE);
+}
+
+/**
+ * @brief 销毁map，析构剩余的值并释放存储空间
+ *
+ * @param map 要销毁的map
+ */
+void map_destroy(map_t *map) {
+    map_release(map);
+    for (size_t i = 0; i < map_timed_num; i++)
+        if (map_timed[i] == map) {
+            map_timed[i] = map_timed[--map_timed_num];
+            break;
+        }
+}
@@ -1,3 +1,6 @@
+#ifdef __linux__
+#define _GNU_SOURCE  // sched_setaffinity
+#endif
 #include "net.h"
 
 #include "arp.h"
@@ -8,11 +11,22 @@
 #include "tcp.h"
 #include "udp.h"
 
+#ifdef __linux__
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
 /**
- * @brief 协议表 <协议号,处理程序>的容器
+ * @brief 协议表，IP协议号直接索引，以太网类型由net_dispatch_get映射到下标
  *
  */
-map_t net_table;
+static net_dispatch_t net_ip_table[NET_IP_PROTOCOL_NUM];
+static net_dispatch_t net_ether_table[NET_ETHER_PROTOCOL_NUM];
 
 /**
  * @brief 网卡MAC地址
@@ -30,14 +44,65 @@ uint8_t net_if_ip[NET_IP_LEN] = NET_IF_IP;
  * @brief 网卡接收和发送缓冲区
  *
  */
-buf_t rxbuf, txbuf;  // 一个buf足够单线程使用
+buf_t rxbuf[NET_POLL_BUDGET], txbuf;  // 一次轮询批量接收的数据帧，发送用一个buf足够单线程使用
+
+/**
+ * @brief 轮询统计
+ *
+ */
+net_stat_t net_stat;
+
+static int net_filter_dirty;  // 监听的端口集合或本机ip已变化，待下次轮询时重新生成过滤器
+
+/**
+ * @brief 按环境变量NET_WORKERS创建多个worker进程，须在net_init前调用
+ *        各worker运行独立的协议栈实例，使用相同的ip/mac，驱动将其加入同一个fanout组按流分担接收
+ *        worker依次绑定到各个CPU，父进程为0号worker，负责应答ARP，父进程退出时其余worker随之退出
+ *
+ * @return int 本进程的worker序号，失败为-1
+ */
+int net_fork() {
+    const char *env = getenv("NET_WORKERS");
+    int num = env ? atoi(env) : 1;
+    if (num <= 1)
+        return 0;
+#ifdef __linux__
+    driver_fanout.num = num;
+    driver_fanout.group = getpid() & 0xffff;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 1; i < num; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "Error in net_fork: %s.\n", strerror(errno));
+            return -1;
+        }
+        if (pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            driver_fanout.index = i;
+            break;
+        }
+    }
+    if (cpus > 1) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(driver_fanout.index % cpus, &set);
+        sched_setaffinity(0, sizeof(set), &set);  // 绑定失败不影响正确性
+    }
+    return driver_fanout.index;
+#else
+    fprintf(stderr, "Error in net_fork: multiple workers are only supported on Linux.\n");
+    return -1;
+#endif
+}
 
 /**
  * @brief 初始化协议栈
  *
  */
 int net_init() {
-    map_init(&net_table, sizeof(uint16_t), sizeof(net_handler_t), 0, 0, NULL, NULL);
+    net_clock_update();
+    memset(net_ip_table, 0, sizeof(net_ip_table));
+    memset(net_ether_table, 0, sizeof(net_ether_table));
     if (driver_open() == -1)
         return -1;
     ethernet_init();
@@ -52,9 +117,29 @@ int net_init() {
 #ifdef TCP
     tcp_init();
 #endif
+    net_filter_update();  // 过滤器收窄失败时仍保留驱动打开时的过滤器，协议栈照常工作
     return 0;
 }
 
+/**
+ * @brief 获取协议号对应的协议表项，小于256的为IP协议号，否则为以太网类型
+ *
+ * @param protocol 协议号
+ * @return net_dispatch_t* 协议表项，不支持的以太网类型为NULL
+ */
+static inline net_dispatch_t *net_dispatch_get(uint16_t protocol) {
+    if (protocol < NET_IP_PROTOCOL_NUM)
+        return &net_ip_table[protocol];
+    switch (protocol) {
+        case NET_PROTOCOL_ARP:
+            return &net_ether_table[0];
+        case NET_PROTOCOL_IP:
+            return &net_ether_table[1];
+        default:
+            return NULL;
+    }
+}
+
 /**
  * @brief 向协议栈注册一个协议
  *
@@ -62,7 +147,23 @@ int net_init() {
  * @param handler 该协议的in处理程序
  */
 void net_add_protocol(uint16_t protocol, net_handler_t handler) {
-    map_set(&net_table, &protocol, &handler);
+    net_dispatch_t *dispatch = net_dispatch_get(protocol);
+    if (dispatch == NULL) {
+        fprintf(stderr, "Error in net_add_protocol: unsupported protocol 0x%04x.\n", protocol);
+        return;
+    }
+    dispatch->handler = handler;
+}
+
+/**
+ * @brief 获取已分发给某协议的数据包数
+ *
+ * @param protocol 协议号
+ * @return size_t 分发的数据包数
+ */
+size_t net_protocol_count(uint16_t protocol) {
+    net_dispatch_t *dispatch = net_dispatch_get(protocol);
+    return dispatch ? dispatch->count : 0;
 }
 
 /**
@@ -74,18 +175,196 @@ void net_add_protocol(uint16_t protocol, net_handler_t handler) {
  * @return int 成功为0，失败为-1
  */
 int net_in(buf_t *buf, uint16_t protocol, uint8_t *src) {
-    net_handler_t *handler = map_get(&net_table, &protocol);
-    if (handler) {
-        (*handler)(buf, src);
+    net_dispatch_t *dispatch = net_dispatch_get(protocol);
+    if (dispatch && dispatch->handler) {
+        dispatch->count++;
+        dispatch->handler(buf, src);
         return 0;
     }
     return -1;
 }
 
+/**
+ * @brief 设置本机ip地址，驱动的过滤器随之更新
+ *
+ * @param ip 新的ip地址
+ */
+void net_set_ip(const uint8_t *ip) {
+    memcpy(net_if_ip, ip, NET_IP_LEN);
+    net_filter_changed();
+}
+
+/**
+ * @brief 标记监听的端口集合或本机ip已变化，下次轮询接收前重新生成驱动的过滤器，同一轮中的多次变化只生成一次
+ *
+ */
+void net_filter_changed() {
+    net_filter_dirty = 1;
+}
+
+#if defined(UDP) || defined(TCP)
+/**
+ * @brief 内部函数，向过滤表达式追加发往打开端口的条件
+ *
+ * @param filter_exp 过滤表达式
+ * @param len 已有的长度
+ * @param protocol 传输层协议名，如"udp"
+ * @param ports 打开的端口
+ * @param num 打开的端口数，超过DRIVER_FILTER_MAX_PORTS时放行该协议的全部端口
+ * @return size_t 追加后的长度
+ */
+static size_t net_filter_ports(char *filter_exp, size_t len, const char *protocol, const uint16_t *ports, size_t num) {
+    if (num > DRIVER_FILTER_MAX_PORTS)
+        return len + snprintf(filter_exp + len, DRIVER_FILTER_EXP_LEN - len, " or %s", protocol);
+    for (size_t i = 0; i < num; i++)
+        len += snprintf(filter_exp + len, DRIVER_FILTER_EXP_LEN - len, " or %s dst port %u", protocol, ports[i]);
+    return len;
+}
+#endif
+
+/**
+ * @brief 按本机ip与打开的端口重新生成驱动的过滤器，使内核在拷贝到用户态前丢弃协议栈不会处理的数据帧
+ *        放行ARP、发往本机的ICMP，以及发往打开端口的UDP/TCP
+ *        协议栈不做分片重组，非首个分片不含传输层首部，交给上层只会被误当作首部解析，在内核中一并丢弃
+ *
+ * @return int 成功或驱动不支持过滤为0，失败为-1
+ */
+int net_filter_update() {
+    char filter_exp[DRIVER_FILTER_EXP_LEN], proto_exp[DRIVER_FILTER_EXP_LEN] = "";
+    size_t len = 0;
+    net_filter_dirty = 0;
+    // Step1: 协议栈会处理的上层协议，每项以" or "开头
+#ifdef ICMP
+    len += snprintf(proto_exp + len, sizeof(proto_exp) - len, " or icmp");
+#endif
+#if defined(UDP) || defined(TCP)
+    uint16_t ports[DRIVER_FILTER_MAX_PORTS];
+#endif
+#ifdef UDP
+    len = net_filter_ports(proto_exp, len, "udp", ports, udp_ports(ports, DRIVER_FILTER_MAX_PORTS));
+#endif
+#ifdef TCP
+    len = net_filter_ports(proto_exp, len, "tcp", ports, tcp_ports(ports, DRIVER_FILTER_MAX_PORTS));
+#endif
+    // Step2: 只接收发往本机mac或广播的帧
+    driver_filter_exp(filter_exp, sizeof(filter_exp));
+    size_t exp_len = strlen(filter_exp);
+    // Step3: 其中只接收ARP与发往本机ip、不是非首个分片、属于上述协议的数据包
+    if (len == 0)
+        snprintf(filter_exp + exp_len, sizeof(filter_exp) - exp_len, " and arp");
+    else
+        snprintf(filter_exp + exp_len, sizeof(filter_exp) - exp_len, " and (arp or (dst host %s and ip[6:2] & 0x1fff = 0 and (%s)))",
+                 iptos(net_if_ip), proto_exp + strlen(" or "));
+    return driver_filter(filter_exp);
+}
+
 /**
  * @brief 一次协议栈轮询
  *
+ * @return int 收到的数据帧数，错误为-1
+ */
+int net_poll() {
+    net_clock_update();
+    if (net_filter_dirty)
+        net_filter_update();
+    int num = ethernet_poll();
+    net_stat.poll_num++;
+    if (num > 0) {
+        net_stat.burst_num++;
+        net_stat.frame_num += num;
+    }
+    map_poll(MAP_EXPIRE_BUDGET);
+    ethernet_flush();
+    return num;
+}
+
+/**
+ * @brief 获取单调时钟，单位为微秒，用于判断空闲时长
+ *
+ * @return uint64_t 当前时间
  */
-void net_poll() {
-    ethernet_poll();
-}
\ No newline at end of file
+static uint64_t net_clock_us() {
+    struct timespec ts;
+#ifdef __linux__
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#ifdef __linux__
+/**
+ * @brief 内部函数，阻塞等待驱动的文件描述符可读或下一个协议定时器到期
+ *
+ * @param epfd 监听驱动文件描述符与定时器的epoll
+ * @param timerfd 定时器
+ */
+static void net_block(int epfd, int timerfd) {
+    // Step1: 定时器设为最早需要清理过期键值对的时间，没有时撤销定时器
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = map_next_expire();
+    timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, NULL);
+
+    // Step2: 等待任一事件，定时器到期时读出到期次数以清除可读状态
+    struct epoll_event events[2];
+    int num = epoll_wait(epfd, events, 2, -1);
+    for (int i = 0; i < num; i++)
+        if (events[i].data.fd == timerfd) {
+            uint64_t expired;
+            if (read(timerfd, &expired, sizeof(expired)) < 0 && errno != EAGAIN)
+                fprintf(stderr, "Error in net_block: %s.\n", strerror(errno));
+        }
+    net_stat.block_num++;
+}
+#endif
+
+/**
+ * @brief 协议栈的事件循环，不返回
+ *        有流量时持续轮询，连续空轮询超过NET_IDLE_US微秒后在epoll中阻塞等待驱动的文件描述符与下一个协议定时器
+ *        驱动不提供文件描述符或平台不支持epoll时退化为持续轮询
+ *
+ */
+void net_run() {
+    const char *env = getenv("NET_IDLE_US");
+    uint64_t idle_us = env && *env ? strtoull(env, NULL, 10) : NET_IDLE_US;
+    int epfd = -1, timerfd = -1;
+#ifdef __linux__
+    // Step1: 监听驱动的文件描述符与协议定时器
+    int fd = driver_fd();
+    if (fd >= 0) {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);  // 与协议栈时钟一致，为CLOCK_MONOTONIC
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+        struct epoll_event tev = {.events = EPOLLIN, .data.fd = timerfd};
+        if (epfd < 0 || timerfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &tev) < 0) {
+            fprintf(stderr, "Error in net_run: %s, falling back to busy polling.\n", strerror(errno));
+            if (epfd >= 0)
+                close(epfd);
+            if (timerfd >= 0)
+                close(timerfd);
+            epfd = timerfd = -1;
+        }
+    }
+#endif
+
+    // Step2: 有数据帧时持续轮询，空闲超过阈值后阻塞
+    uint64_t idle_since = 0;
+    while (1) {
+        if (net_poll() > 0) {
+            idle_since = 0;
+            continue;
+        }
+        if (epfd < 0)
+            continue;
+        uint64_t now = net_clock_us();
+        if (idle_since == 0)
+            idle_since = now;
+        else if (now - idle_since >= idle_us) {
+#ifdef __linux__
+            net_block(epfd, timerfd);
+#endif
+            idle_since = 0;
+        }
+    }
+}
@@ -1,16 +1,20 @@
 #include "tcp.h"
 
+#include "driver.h"
 #include "icmp.h"
 #include "ip.h"
+#include "map_typed.h"
 
 #include <assert.h>
 #include <stdbool.h>
 
+MAP_DEFINE(tcp_port_map, uint16_t, tcp_handler_t, map_hash_port, map_eq_port)
+
 /**
  * @brief TCP 处理程序表
  *
  */
-map_t tcp_handler_table;  // dst-port -> handler
+tcp_port_map_t tcp_handler_table;  // dst-port -> handler
 /**
  * @brief TCP 连接表
  *
@@ -101,6 +105,26 @@ static inline void tcp_close_connection(uint8_t remote_ip[NET_IP_LEN], uint16_t
     map_delete(&tcp_conn_table, &key);
 }
 
+/**
+ * @brief 连接表满时被淘汰的 TCP 连接，向对端发送 RST
+ *
+ * @param key       被淘汰连接的三元组键
+ * @param value     被淘汰的 TCP 连接
+ * @param timestamp 连接的更新时间
+ */
+static void tcp_conn_evict(void *key, void *value, time_t *timestamp) {
+    tcp_key_t *tcp_key = key;
+    tcp_conn_t *tcp_conn = value;
+    // 仅在监听状态的连接对端还不知道其存在，无需通知
+    if (tcp_conn->state == TCP_STATE_LISTEN || tcp_conn->state == TCP_STATE_CLOSED)
+        return;
+    buf_t *buf = buf_alloc(0);
+    if (buf == NULL)
+        return;
+    tcp_out(tcp_conn, buf, tcp_key->host_port, tcp_key->remote_ip, tcp_key->remote_port, TCP_FLG_RST | TCP_FLG_ACK);
+    buf_free(buf);
+}
+
 /* =============================== TOOLS =============================== */
 
 /* =============================== COMMON API =============================== */
@@ -132,8 +156,20 @@ void tcp_out(tcp_conn_t *tcp_conn, buf_t *buf, uint16_t src_port, uint8_t *dst_i
     tcp_hdr->uptr = 0;
     
     // Step3: 计算并填充校验和
-    tcp_hdr->checksum16 = 0;
-    tcp_hdr->checksum16 = transport_checksum(NET_PROTOCOL_TCP, buf, net_if_ip, dst_ip);
+    // 超过MTU的报文段在驱动支持TSO时整段交给驱动分段，不再做IP分片
+    // 不会被IP分片的报文段在驱动支持校验和卸载时只填伪头部的和
+    size_t len = buf_chain_len(buf);
+    size_t max_len = ETHERNET_MAX_TRANSPORT_UNIT - sizeof(ip_hdr_t);
+    uint32_t caps = driver_caps();
+    if ((caps & DRIVER_CAP_TSO) && len > max_len && len <= UINT16_MAX - sizeof(ip_hdr_t))
+        buf->flags |= BUF_FLAG_GSO_TCP;
+    if ((caps & DRIVER_CAP_TX_CSUM) && (len <= max_len || (buf->flags & BUF_FLAG_GSO_TCP))) {
+        tcp_hdr->checksum16 = transport_pseudo_checksum(NET_PROTOCOL_TCP, len, net_if_ip, dst_ip);
+        buf->flags |= BUF_FLAG_CSUM_PARTIAL;
+    } else {
+        tcp_hdr->checksum16 = 0;
+        tcp_hdr->checksum16 = transport_checksum(NET_PROTOCOL_TCP, buf, net_if_ip, dst_ip);
+    }
     
     // Step4: 发送TCP数据报
     ip_out(buf, dst_ip, NET_PROTOCOL_TCP);
@@ -154,10 +190,8 @@ void tcp_in(buf_t *buf, uint8_t *src_ip) {
 
     tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
 
-    // 校验checksum
-    uint16_t checksum = hdr->checksum16;
-    hdr->checksum16 = 0;
-    if (transport_checksum(NET_PROTOCOL_TCP, buf, src_ip, net_if_ip) != checksum)
+    // 校验checksum，驱动已确认校验和正确时跳过，连同校验和字段一起计算，结果为0说明正确
+    if (!(buf->flags & BUF_FLAG_CSUM_VERIFIED) && transport_checksum(NET_PROTOCOL_TCP, buf, src_ip, net_if_ip) != 0)
         return;
 
     uint8_t *remote_ip = src_ip;
@@ -212,8 +246,8 @@ void tcp_in(buf_t *buf, uint8_t *src_ip) {
         case TCP_STATE_ESTABLISHED:
             // 未收到顺序包，丢弃并发送重复 ACK
             if (remote_seq != tcp_conn->ack) {
-                buf_init(&txbuf, 0);
-                tcp_out(tcp_conn, &txbuf, host_port, remote_ip, remote_port, TCP_FLG_ACK);
+                if (buf_init(&txbuf, 0) == 0)
+                    tcp_out(tcp_conn, &txbuf, host_port, remote_ip, remote_port, TCP_FLG_ACK);
                 return;
             }
             // 计算接收到的数据长度，更新 ACK
@@ -250,7 +284,7 @@ void tcp_in(buf_t *buf, uint8_t *src_ip) {
     size_t data_len = buf->len - tcp_hdr_sz;
     if (data_len > 0) {
         // 查询处理函数
-        tcp_handler_t *handler = (tcp_handler_t *)map_get(&tcp_handler_table, &host_port);
+        tcp_handler_t *handler = tcp_port_map_get(&tcp_handler_table, &host_port);
         
         if (handler == NULL) {
             // 没有找到对应的处理函数，发送ICMP端口不可达
@@ -275,8 +309,9 @@ void tcp_in(buf_t *buf, uint8_t *src_ip) {
         return;
     }
 
-    // 初始化一个新的缓冲区，发送回复报文
-    buf_init(&txbuf, 0);
+    // 初始化一个新的缓冲区，发送回复报文，缓冲池耗尽时如同回复丢失，等待对方重传
+    if (buf_init(&txbuf, 0) < 0)
+        return;
     tcp_out(tcp_conn, &txbuf, host_port, remote_ip, remote_port, send_flags);
 
     // 更新序列号
@@ -306,11 +341,20 @@ void tcp_send(tcp_conn_t *tcp_conn, uint8_t *data, uint16_t len, uint16_t src_po
     }
 
     // 发送数据包
-    buf_t tx_buf;
-    buf_init(&tx_buf, len);
-    if (data)
-        memcpy(tx_buf.data, data, len);
-    tcp_out(tcp_conn, &tx_buf, src_port, dst_ip, dst_port, TCP_FLG_ACK /* 顺带 ACK */);
+    // 报头放在单独的首段中，数据段直接引用应用数据，不做拷贝
+    buf_t *tx_buf = buf_alloc(data ? 0 : len);
+    if (tx_buf == NULL)
+        return;
+    if (data) {
+        buf_t *seg = buf_ref(data, len);
+        if (seg == NULL) {
+            buf_free(tx_buf);
+            return;
+        }
+        buf_chain(tx_buf, seg);
+    }
+    tcp_out(tcp_conn, tx_buf, src_port, dst_ip, dst_port, TCP_FLG_ACK /* 顺带 ACK */);
+    buf_free(tx_buf);
 
     // 更新序列号
     tcp_conn->seq += bytes_in_flight(len, 0);
@@ -323,11 +367,12 @@ void tcp_send(tcp_conn_t *tcp_conn, uint8_t *data, uint16_t len, uint16_t src_po
  *
  */
 void tcp_init() {
-    map_init(&tcp_handler_table, sizeof(uint16_t), sizeof(tcp_handler_t), 0, 0, NULL, NULL);
-    map_init(&tcp_conn_table, sizeof(tcp_key_t), sizeof(tcp_conn_t), 0, 0, NULL, NULL);
+    tcp_port_map_init(&tcp_handler_table, UINT16_MAX + 1);
+    map_init(&tcp_conn_table, sizeof(tcp_key_t), sizeof(tcp_conn_t), TCP_MAX_CONN_NUM, 0, MAP_EVICT_LRU, NULL, NULL, NULL);
+    map_set_evict_handler(&tcp_conn_table, tcp_conn_evict);
     net_add_protocol(NET_PROTOCOL_TCP, tcp_in);
     // 初始化随机数种子，为生成 TCP 初始序列号提供支持
-    srand(time(NULL));
+    srand(net_now_ms());
 }
 
 /**
@@ -338,7 +383,9 @@ void tcp_init() {
  * @return int      成功为0，失败为-1
  */
 int tcp_open(uint16_t port, tcp_handler_t handler) {
-    return map_set(&tcp_handler_table, &port, &handler);
+    if (tcp_port_map_get(&tcp_handler_table, &port) == NULL)
+        net_filter_changed();  // 监听的端口集合变化，重新生成驱动的过滤器
+    return tcp_port_map_set(&tcp_handler_table, &port, &handler);
 }
 
 static _Thread_local uint16_t close_port;
@@ -354,7 +401,20 @@ static void close_port_fn(void *key, void *value, time_t *timestamp) {
 void tcp_close(uint16_t port) {
     close_port = port;
     map_foreach(&tcp_conn_table, close_port_fn);
-    map_delete(&tcp_handler_table, &port);
+    if (tcp_port_map_get(&tcp_handler_table, &port))
+        net_filter_changed();
+    tcp_port_map_delete(&tcp_handler_table, &port);
+}
+
+/**
+ * @brief 获取已打开的tcp端口，用于生成驱动的过滤器
+ *
+ * @param ports 出口参数，端口号
+ * @param max ports的大小
+ * @return size_t 已打开的端口数，可能大于max，此时只填写前max个
+ */
+size_t tcp_ports(uint16_t *ports, size_t max) {
+    return tcp_port_map_keys(&tcp_handler_table, ports, max);
 }
 
 /* =============================== COMMON API =============================== */
\ No newline at end of file
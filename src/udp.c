@@ -1,13 +1,17 @@
 #include "udp.h"
 
+#include "driver.h"
 #include "icmp.h"
 #include "ip.h"
+#include "map_typed.h"
+
+MAP_DEFINE(udp_port_map, uint16_t, udp_handler_t, map_hash_port, map_eq_port)
 
 /**
  * @brief udp处理程序表
  *
  */
-map_t udp_table;
+udp_port_map_t udp_table;
 
 /**
  * @brief 处理一个收到的udp数据包
@@ -30,13 +34,9 @@ void udp_in(buf_t *buf, uint8_t *src_ip) {
         return;
     }
     
-    // Step2: 重新计算校验和
-    // 保存原始校验和
-    uint16_t received_checksum = udp_hdr->checksum16;
-    udp_hdr->checksum16 = 0;
-    // 重新计算校验和
-    uint16_t calculated_checksum = transport_checksum(NET_PROTOCOL_UDP, buf, src_ip, net_if_ip);
-    if (received_checksum != calculated_checksum) {
+    // Step2: 重新计算校验和，驱动已确认校验和正确时跳过
+    // 连同校验和字段一起计算，结果为0说明校验和正确，不修改收到的数据包
+    if (!(buf->flags & BUF_FLAG_CSUM_VERIFIED) && transport_checksum(NET_PROTOCOL_UDP, buf, src_ip, net_if_ip) != 0) {
         // 校验和不匹配，数据报可能有错误，丢弃
         return;
     }
@@ -44,7 +44,7 @@ void udp_in(buf_t *buf, uint8_t *src_ip) {
     // Step3: 查询处理函数
     uint16_t dst_port = swap16(udp_hdr->dst_port16);
     // 在udp_table中查询对应的处理函数
-    udp_handler_t *handler = (udp_handler_t *)map_get(&udp_table, &dst_port);
+    udp_handler_t *handler = udp_port_map_get(&udp_table, &dst_port);
     
     // Step4: 处理未找到处理函数的情况
     if (handler == NULL) {
@@ -77,11 +77,17 @@ void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port)
     udp_hdr_t *udp_hdr = (udp_hdr_t *)buf->data;
     udp_hdr->src_port16 = swap16(src_port);
     udp_hdr->dst_port16 = swap16(dst_port);
-    udp_hdr->total_len16 = swap16(buf->len);
+    size_t len = buf_chain_len(buf);
+    udp_hdr->total_len16 = swap16(len);
     
-    // Step3: 计算并填充校验和
-    udp_hdr->checksum16 = 0;
-    udp_hdr->checksum16 = transport_checksum(NET_PROTOCOL_UDP, buf, net_if_ip, dst_ip);
+    // Step3: 计算并填充校验和，不会被IP分片的数据报在驱动支持校验和卸载时只填伪头部的和
+    if ((driver_caps() & DRIVER_CAP_TX_CSUM) && len <= ETHERNET_MAX_TRANSPORT_UNIT - sizeof(ip_hdr_t)) {
+        udp_hdr->checksum16 = transport_pseudo_checksum(NET_PROTOCOL_UDP, len, net_if_ip, dst_ip);
+        buf->flags |= BUF_FLAG_CSUM_PARTIAL;
+    } else {
+        udp_hdr->checksum16 = 0;
+        udp_hdr->checksum16 = transport_checksum(NET_PROTOCOL_UDP, buf, net_if_ip, dst_ip);
+    }
     
     // Step4: 发送 UDP 数据报
     ip_out(buf, dst_ip, NET_PROTOCOL_UDP);
@@ -92,7 +98,7 @@ void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port)
  *
  */
 void udp_init() {
-    map_init(&udp_table, sizeof(uint16_t), sizeof(udp_handler_t), 0, 0, NULL, NULL);
+    udp_port_map_init(&udp_table, UINT16_MAX + 1);
     net_add_protocol(NET_PROTOCOL_UDP, udp_in);
 }
 
@@ -104,7 +110,9 @@ void udp_init() {
  * @return int 成功为0，失败为-1
  */
 int udp_open(uint16_t port, udp_handler_t handler) {
-    return map_set(&udp_table, &port, &handler);
+    if (udp_port_map_get(&udp_table, &port) == NULL)
+        net_filter_changed();  // 监听的端口集合变化，重新生成驱动的过滤器
+    return udp_port_map_set(&udp_table, &port, &handler);
 }
 
 /**
@@ -113,7 +121,20 @@ int udp_open(uint16_t port, udp_handler_t handler) {
  * @param port 端口号
  */
 void udp_close(uint16_t port) {
-    map_delete(&udp_table, &port);
+    if (udp_port_map_get(&udp_table, &port))
+        net_filter_changed();
+    udp_port_map_delete(&udp_table, &port);
+}
+
+/**
+ * @brief 获取已打开的udp端口，用于生成驱动的过滤器
+ *
+ * @param ports 出口参数，端口号
+ * @param max ports的大小
+ * @return size_t 已打开的端口数，可能大于max，此时只填写前max个
+ */
+size_t udp_ports(uint16_t *ports, size_t max) {
+    return udp_port_map_keys(&udp_table, ports, max);
 }
 
 /**
@@ -126,7 +147,18 @@ void udp_close(uint16_t port) {
  * @param dst_port 目的端口号
  */
 void udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port) {
-    buf_init(&txbuf, len);
-    memcpy(txbuf.data, data, len);
-    udp_out(&txbuf, src_port, dst_ip, dst_port);
+    // 报头放在单独的首段中，数据段直接引用应用数据，不做拷贝
+    buf_t *buf = buf_alloc(0);
+    if (buf == NULL)
+        return;
+    if (len) {
+        buf_t *seg = buf_ref(data, len);
+        if (seg == NULL) {
+            buf_free(buf);
+            return;
+        }
+        buf_chain(buf, seg);
+    }
+    udp_out(buf, src_port, dst_ip, dst_port);
+    buf_free(buf);
 }
\ No newline at end of file
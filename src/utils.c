@@ -41,6 +41,51 @@ char *timetos(time_t timestamp) {
     return output;
 }
 
+/**
+ * @brief 协议栈时钟，由net_poll每次轮询刷新一次，避免每次查表都读取系统时间
+ *        使用单调时钟，系统时间回拨时map的过期与时间轮不受影响，不表示日历时间
+ *
+ */
+static time_t net_clock_sec;
+static uint64_t net_clock_ms;
+
+/**
+ * @brief 刷新协议栈时钟
+ *
+ */
+void net_clock_update() {
+    struct timespec ts;
+#ifdef __linux__
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    net_clock_sec = ts.tv_sec;
+    net_clock_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief 获取协议栈时钟的当前时间，秒级精度
+ *
+ * @return time_t 上次刷新时的时间戳
+ */
+time_t net_now() {
+    if (net_clock_sec == 0)
+        net_clock_update();
+    return net_clock_sec;
+}
+
+/**
+ * @brief 获取协议栈时钟的当前时间，毫秒级精度
+ *
+ * @return uint64_t 上次刷新时的毫秒时间戳
+ */
+uint64_t net_now_ms() {
+    if (net_clock_sec == 0)
+        net_clock_update();
+    return net_clock_ms;
+}
+
 /**
  * @brief ip前缀匹配
  *
@@ -99,6 +144,43 @@ uint16_t checksum16(uint16_t *data, size_t len) {
     return (uint16_t)(~sum);
 }
 
+/**
+ * @brief 计算buffer链的16位校验和，各段长度可为奇数，总长度为奇数时末尾按补0处理
+ *
+ * @param buf 要计算的buffer链
+ * @return uint16_t 校验和
+ */
+uint16_t buf_checksum16(buf_t *buf) {
+    uint32_t sum = 0;
+    uint8_t word[2];
+    int odd = 0;  // 上一段末尾是否剩余一个未配对的字节，存于word[0]
+    for (; buf; buf = buf->next) {
+        uint8_t *data = buf->data;
+        size_t len = buf->len;
+        if (odd && len) {
+            word[1] = *data++;
+            len--;
+            sum += *(uint16_t *)word;
+            odd = 0;
+        }
+        for (; len >= 2; data += 2, len -= 2)
+            sum += *(uint16_t *)data;
+        if (len) {
+            word[0] = *data;
+            odd = 1;
+        }
+    }
+    if (odd) {
+        word[1] = 0;
+        sum += *(uint16_t *)word;
+    }
+
+    while (sum > 0xFFFF) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)(~sum);
+}
+
 #pragma pack(1)
 typedef struct peso_hdr {
     uint8_t src_ip[4];     // 源IP地址
@@ -110,7 +192,8 @@ typedef struct peso_hdr {
 #pragma pack()
 
 /**
- * @brief 计算传输层协议（如TCP/UDP）的校验和
+ * @brief 计算传输层协议（如TCP/UDP）的校验和，伪头部单独求和，不修改数据包
+ *        校验和字段已填入时结果为0说明校验和正确，接收时据此校验只读的数据包
  *
  * @param protocol  传输层协议号（如NET_PROTOCOL_UDP、NET_PROTOCOL_TCP）
  * @param buf       待计算的数据包缓冲区
@@ -119,41 +202,34 @@ typedef struct peso_hdr {
  * @return uint16_t 计算得到的16位校验和
  */
 uint16_t transport_checksum(uint8_t protocol, buf_t *buf, uint8_t *src_ip, uint8_t *dst_ip) {
-    // Step1: 增加 UDP 伪头部
-    buf_add_header(buf, sizeof(peso_hdr_t));
+    // Step1: 计算伪头部的和
+    uint32_t sum = transport_pseudo_checksum(protocol, buf_chain_len(buf), src_ip, dst_ip);
 
-    // Step2: 暂存 IP 头部
-    // 将被UDP伪头部覆盖的IP头部拷贝出来暂存
-    ip_hdr_t temp_ip_hdr;
-    memcpy(&temp_ip_hdr, buf->data - (sizeof(ip_hdr_t) - sizeof(peso_hdr_t)), sizeof(ip_hdr_t));
-    
-    // Step3: 填写 UDP 伪头部字段
-    peso_hdr_t *peso_hdr = (peso_hdr_t *)buf->data;
-    memcpy(peso_hdr->src_ip, src_ip, NET_IP_LEN);
-    memcpy(peso_hdr->dst_ip, dst_ip, NET_IP_LEN);
-    peso_hdr->protocol = protocol;
-    peso_hdr->placeholder = 0;
-    // UDP长度 = 总数据包长度 - 伪头部长度
-    uint16_t udp_len = buf->len - sizeof(peso_hdr_t);
-    peso_hdr->total_len16 = swap16(udp_len);
-    
-    // Step4: 计算 UDP 校验和
-    // 对包含UDP伪头部、UDP头部和UDP数据的整个数据块进行校验和计算
-    uint16_t checksum;
-    if(buf->len % 2 == 0) {
-        checksum = checksum16((uint16_t *)buf->data, buf->len);
-    } else {
-        buf_add_padding(buf, 1);
-        checksum = checksum16((uint16_t *)buf->data, buf->len);
-        buf_remove_padding(buf, 1);
+    // Step2: 累加头部和数据的和
+    // 数据可能分布在buffer链的多个段中，奇数长度时末尾按补0处理
+    sum += (uint16_t)~buf_checksum16(buf);
+
+    // Step3: 折叠进位并取反
+    while (sum > 0xFFFF) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
     }
-    
-    // Step5: 恢复 IP 头部
-    memcpy(buf->data - (sizeof(ip_hdr_t) - sizeof(peso_hdr_t)), &temp_ip_hdr, sizeof(ip_hdr_t));
-    
-    // Step6: 去掉 UDP 伪头部
-    buf_remove_header(buf, sizeof(peso_hdr_t));
-    
-    // Step7: 返回校验和值
-    return checksum;
-}
\ No newline at end of file
+    return (uint16_t)(~sum);
+}
+/**
+ * @brief 计算传输层伪头部的和，用于校验和卸载，由网卡在此基础上累加报文内容得到最终的校验和
+ *
+ * @param protocol  传输层协议号
+ * @param len       传输层报文长度，包括首部
+ * @param src_ip    源IP地址
+ * @param dst_ip    目的IP地址
+ * @return uint16_t 伪头部折叠后未取反的16位和，直接填入校验和字段
+ */
+uint16_t transport_pseudo_checksum(uint8_t protocol, size_t len, uint8_t *src_ip, uint8_t *dst_ip) {
+    peso_hdr_t peso_hdr;
+    memcpy(peso_hdr.src_ip, src_ip, NET_IP_LEN);
+    memcpy(peso_hdr.dst_ip, dst_ip, NET_IP_LEN);
+    peso_hdr.placeholder = 0;
+    peso_hdr.protocol = protocol;
+    peso_hdr.total_len16 = swap16(len);
+    return ~checksum16((uint16_t *)&peso_hdr, sizeof(peso_hdr));
+}
@@ -67,6 +67,7 @@ int main(int argc, char *argv[]) {
             uint8_t *ip = buf.data + 30;
             // net_protocol_t pro = buf.data[13] ? NET_PROTOCOL_ARP : NET_PROTOCOL_IP;
             arp_out(&buf2, ip);
+            buf_free(&buf2);
         } else {
             ethernet_in(&buf);
         }
@@ -75,8 +76,10 @@ int main(int argc, char *argv[]) {
     if (ret < 0) {
         PRINT_WARN("\nError occur on receive,exiting\n");
     }
+    ethernet_flush();  // 相当于net_poll结束时发送队列中的数据帧
     driver_close();
     PRINT_INFO("\nSample input all processed, checking output\n");
+    PRINT_INFO("buf stat: copy %zu (%zu bytes), clone %zu, cow %zu (%zu bytes)\n", buf_stat.copy_num, buf_stat.copy_bytes, buf_stat.clone_num, buf_stat.cow_num, buf_stat.cow_bytes);
 
     fclose(control_flow);
 
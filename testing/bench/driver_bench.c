@@ -0,0 +1,176 @@
+#include "driver.h"
+#include "utils.h"
+
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BENCH_FRAME_LEN 60          // 测试帧长度，即最短的以太网帧
+#define BENCH_ETHER_TYPE 0x88b5     // 本地实验用的以太网类型
+#define BENCH_TAP_NAME "benchtap0"  // 测量TAP后端时临时创建的网卡
+
+uint8_t net_if_mac[NET_MAC_LEN] = NET_IF_MAC;
+uint8_t net_if_ip[NET_IP_LEN] = NET_IF_IP;
+
+static buf_t bench_bufs[NET_POLL_BUDGET];
+
+/**
+ * @brief 获取单调时钟，单位为纳秒
+ *
+ * @return uint64_t 当前时间
+ */
+static uint64_t bench_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief 填写一个发往本机mac的测试帧
+ *
+ * @param frame 帧缓冲区，至少BENCH_FRAME_LEN字节
+ */
+static void bench_frame(uint8_t *frame) {
+    uint8_t src[NET_MAC_LEN] = {0x02, 0, 0, 0, 0, 0x01};
+    memset(frame, 0, BENCH_FRAME_LEN);
+    memcpy(frame, net_if_mac, NET_MAC_LEN);
+    memcpy(frame + NET_MAC_LEN, src, NET_MAC_LEN);
+    frame[12] = BENCH_ETHER_TYPE >> 8;
+    frame[13] = BENCH_ETHER_TYPE & 0xff;
+}
+
+/**
+ * @brief 在子进程中用普通的packet套接字向网卡持续发送测试帧，作为接收测试的流量源
+ *
+ * @param if_name 发送的网卡
+ * @return pid_t 子进程号，失败为-1
+ */
+static pid_t bench_generator(const char *if_name) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    int fd = socket(AF_PACKET, SOCK_RAW, 0);
+    struct sockaddr_ll addr = {.sll_family = AF_PACKET, .sll_ifindex = if_nametoindex(if_name), .sll_halen = NET_MAC_LEN};
+    uint8_t frame[BENCH_FRAME_LEN];
+    bench_frame(frame);
+    memcpy(addr.sll_addr, frame, NET_MAC_LEN);
+    if (fd < 0 || addr.sll_ifindex == 0) {
+        fprintf(stderr, "Error in bench_generator: cannot open %s.\n", if_name);
+        exit(-1);
+    }
+    for (;;)
+        sendto(fd, frame, sizeof(frame), 0, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+/**
+ * @brief 打开指定后端
+ *
+ * @param spec 形如"名称:参数"的后端描述
+ * @return int 成功为0，失败为-1
+ */
+static int bench_open(const char *spec) {
+    if (driver_select(spec) < 0 || driver_open() < 0) {
+        fprintf(stderr, "%s: skipped, failed to open.\n", spec);
+        return -1;
+    }
+    memset(&driver_stat, 0, sizeof(driver_stat));
+    return 0;
+}
+
+/**
+ * @brief 测量后端的接收速率与每包的系统调用数，流量由gen_if上的子进程产生
+ *
+ * @param spec 后端描述
+ * @param gen_if 流量源网卡，为veth的另一端或TAP网卡本身
+ * @param seconds 测量时长
+ */
+static void bench_rx(const char *spec, const char *gen_if, int seconds) {
+    if (bench_open(spec) < 0)
+        return;
+    pid_t pid = bench_generator(gen_if);
+    size_t frames = 0, bad = 0;
+    uint64_t start = bench_clock_ns(), end = start + (uint64_t)seconds * 1000000000;
+    uint64_t now = start;
+    while (now < end) {
+        int num = driver_recv_burst(bench_bufs, NET_POLL_BUDGET);
+        if (num < 0)
+            break;
+        // 读取帧头，使原地处理与拷贝的后端都实际访问到数据
+        for (int i = 0; i < num; i++)
+            if (bench_bufs[i].len < BENCH_FRAME_LEN || bench_bufs[i].data[12] != BENCH_ETHER_TYPE >> 8)
+                bad++;
+        frames += num;
+        now = bench_clock_ns();
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    driver_close();
+    printf("%-20s rx %10.0f pps, %6.3f syscalls/pkt, %zu unexpected frames\n", spec, frames * 1e9 / (now - start),
+           frames ? (double)driver_stat.rx_syscalls / frames : 0.0, bad);
+}
+
+/**
+ * @brief 测量后端批量发送的速率与每包的系统调用数
+ *
+ * @param spec 后端描述
+ * @param seconds 测量时长
+ */
+static void bench_tx(const char *spec, int seconds) {
+    if (bench_open(spec) < 0)
+        return;
+    for (int i = 0; i < NET_POLL_BUDGET; i++) {
+        buf_init(&bench_bufs[i], BENCH_FRAME_LEN);
+        bench_frame(bench_bufs[i].data);
+    }
+    size_t frames = 0;
+    uint64_t start = bench_clock_ns(), end = start + (uint64_t)seconds * 1000000000;
+    uint64_t now = start;
+    while (now < end) {
+        int num = driver_send_burst(bench_bufs, NET_POLL_BUDGET);
+        if (num < 0)
+            break;
+        frames += num;
+        now = bench_clock_ns();
+    }
+    driver_close();
+    printf("%-20s tx %10.0f pps, %6.3f syscalls/pkt\n", spec, frames * 1e9 / (now - start),
+           frames ? (double)driver_stat.tx_syscalls / frames : 0.0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <tx_if> <rx_if> [seconds]\n", argv[0]);
+        fprintf(stderr, "tx_if and rx_if should be the two ends of a veth pair, e.g.\n");
+        fprintf(stderr, "  ip link add veth0 type veth peer name veth1 && ip link set veth0 up && ip link set veth1 up\n");
+        fprintf(stderr, "TAP backends are measured on a temporary tap device %s.\n", BENCH_TAP_NAME);
+        return -1;
+    }
+    int seconds = argc > 3 ? atoi(argv[3]) : 3;
+    char spec[PCAP_BUF_SIZE];
+    const char *names[] = {"pcap", "afpacket", "afxdp"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        snprintf(spec, sizeof(spec), "%s:%s", names[i], argv[2]);
+        bench_rx(spec, argv[1], seconds);
+        snprintf(spec, sizeof(spec), "%s:%s", names[i], argv[1]);
+        bench_tx(spec, seconds);
+    }
+    // pcap的只读视图模式只影响接收方向
+    snprintf(spec, sizeof(spec), "pcap:%s,view", argv[2]);
+    bench_rx(spec, argv[1], seconds);
+    // TAP网卡的流量源在主机侧向该网卡发送，即进入后端的文件描述符
+    const char *modes[] = {"", ",uring", ",sqpoll"};
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        snprintf(spec, sizeof(spec), "tap:%s%s", BENCH_TAP_NAME, modes[i]);
+        bench_rx(spec, BENCH_TAP_NAME, seconds);
+        bench_tx(spec, seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include "arp.h"
+#include "map.h"
+#include "map_typed.h"
+#include "net.h"
+#include "tcp.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_LOOKUP_NUM (1 << 24)  // 每轮查找次数
+#define BENCH_POLL_BURST 32         // 模拟每次轮询处理的查找次数
+#define BENCH_KEY_NUM 4096          // 比较泛型与静态类型map时的键数
+
+MAP_DEFINE(bench_port_map, uint16_t, uint32_t, map_hash_port, map_eq_port)
+MAP_DEFINE(bench_ip_map, uint32_t, uint32_t, map_hash_ip, map_eq_ip)
+MAP_DEFINE(bench_conn_map, tcp_key_t, uint32_t, tcp_key_hash, tcp_key_eq)
+
+/**
+ * @brief 模拟的arp表，与arp.c中的配置一致
+ *
+ */
+map_t bench_table;
+
+/**
+ * @brief 获取单调时钟，单位为纳秒
+ *
+ * @return uint64_t 当前时间
+ */
+static uint64_t bench_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief 生成第i个测试ip
+ *
+ * @param ip 输出的ip
+ * @param i 序号
+ */
+static void bench_ip(uint8_t *ip, size_t i) {
+    ip[0] = 10;
+    ip[1] = i >> 16;
+    ip[2] = i >> 8;
+    ip[3] = i;
+}
+
+/**
+ * @brief 在满的arp表上做查找
+ *
+ * @param refresh_every 每隔多少次查找刷新一次时钟
+ * @return double 平均每次查找的纳秒数
+ */
+static double bench_lookup(size_t refresh_every) {
+    size_t size = map_size(&bench_table);
+    uint8_t ip[NET_IP_LEN];
+    size_t hit = 0;
+    uint32_t seed = 12345;
+    uint64_t start = bench_clock_ns();
+    for (size_t i = 0; i < BENCH_LOOKUP_NUM; i++) {
+        if (i % refresh_every == 0)
+            net_clock_update();
+        seed = seed * 1103515245 + 12345;
+        bench_ip(ip, (seed >> 8) % size);
+        if (map_get(&bench_table, ip))
+            hit++;
+    }
+    uint64_t end = bench_clock_ns();
+    if (hit != BENCH_LOOKUP_NUM) {
+        fprintf(stderr, "Error in bench_lookup: %zu of %d lookups missed.\n", BENCH_LOOKUP_NUM - hit, BENCH_LOOKUP_NUM);
+        exit(-1);
+    }
+    return (double)(end - start) / BENCH_LOOKUP_NUM;
+}
+
+/**
+ * @brief 在泛型map上查找预先生成的键
+ *
+ * @param map 要查找的map，已插入全部键
+ * @param keys 键数组，共BENCH_KEY_NUM个
+ * @return double 平均每次查找的纳秒数
+ */
+static double bench_generic(map_t *map, const uint8_t *keys) {
+    size_t hit = 0;
+    uint32_t seed = 12345;
+    uint64_t start = bench_clock_ns();
+    for (size_t i = 0; i < BENCH_LOOKUP_NUM; i++) {
+        seed = seed * 1103515245 + 12345;
+        if (map_get(map, keys + (seed >> 8) % BENCH_KEY_NUM * map->key_len))
+            hit++;
+    }
+    uint64_t end = bench_clock_ns();
+    if (hit != BENCH_LOOKUP_NUM)
+        fprintf(stderr, "Error in bench_generic: %zu of %d lookups missed.\n", BENCH_LOOKUP_NUM - hit, BENCH_LOOKUP_NUM);
+    return (double)(end - start) / BENCH_LOOKUP_NUM;
+}
+
+/**
+ * @brief 在静态类型map上查找预先生成的键，与bench_generic的访问序列相同
+ *
+ * @param name MAP_DEFINE生成的前缀
+ * @param map 要查找的map，已插入全部键
+ * @param keys 键数组，共BENCH_KEY_NUM个
+ * @param result 平均每次查找的纳秒数
+ */
+#define BENCH_TYPED(name, map, keys, result)                                          \
+    do {                                                                              \
+        size_t hit = 0;                                                               \
+        uint32_t seed = 12345;                                                        \
+        uint64_t start = bench_clock_ns();                                            \
+        for (size_t i = 0; i < BENCH_LOOKUP_NUM; i++) {                               \
+            seed = seed * 1103515245 + 12345;                                         \
+            if (name##_get(map, &(keys)[(seed >> 8) % BENCH_KEY_NUM]))                \
+                hit++;                                                                \
+        }                                                                             \
+        result = (double)(bench_clock_ns() - start) / BENCH_LOOKUP_NUM;               \
+        if (hit != BENCH_LOOKUP_NUM)                                                  \
+            fprintf(stderr, "Error in " #name ": %zu lookups missed.\n", BENCH_LOOKUP_NUM - hit); \
+    } while (0)
+
+/**
+ * @brief 比较三种固定键类型在泛型map与静态类型map上的查找开销
+ *
+ */
+static void bench_typed() {
+    static uint16_t ports[BENCH_KEY_NUM];
+    static uint32_t ips[BENCH_KEY_NUM];
+    static tcp_key_t conns[BENCH_KEY_NUM];
+    static map_t port_map, ip_map, conn_map;
+    bench_port_map_t port_typed;
+    bench_ip_map_t ip_typed;
+    bench_conn_map_t conn_typed;
+    map_init(&port_map, sizeof(uint16_t), sizeof(uint32_t), 0, 0, MAP_EVICT_NONE, NULL, NULL, NULL);
+    map_init(&ip_map, sizeof(uint32_t), sizeof(uint32_t), 0, 0, MAP_EVICT_NONE, NULL, NULL, NULL);
+    map_init(&conn_map, sizeof(tcp_key_t), sizeof(uint32_t), 0, 0, MAP_EVICT_NONE, NULL, NULL, NULL);
+    bench_port_map_init(&port_typed, 0);
+    bench_ip_map_init(&ip_typed, 0);
+    bench_conn_map_init(&conn_typed, 0);
+    for (uint32_t i = 0; i < BENCH_KEY_NUM; i++) {
+        ports[i] = 1024 + i;
+        bench_ip((uint8_t *)&ips[i], i);
+        bench_ip(conns[i].remote_ip, i % 64);
+        conns[i].remote_port = 30000 + i / 64;
+        conns[i].host_port = 80;
+        map_set(&port_map, &ports[i], &i);
+        map_set(&ip_map, &ips[i], &i);
+        map_set(&conn_map, &conns[i], &i);
+        bench_port_map_set(&port_typed, &ports[i], &i);
+        bench_ip_map_set(&ip_typed, &ips[i], &i);
+        bench_conn_map_set(&conn_typed, &conns[i], &i);
+    }
+    double typed;
+    BENCH_TYPED(bench_port_map, &port_typed, ports, typed);
+    printf("port:     map_t %.1f ns, MAP_DEFINE %.1f ns\n", bench_generic(&port_map, (uint8_t *)ports), typed);
+    BENCH_TYPED(bench_ip_map, &ip_typed, ips, typed);
+    printf("ip:       map_t %.1f ns, MAP_DEFINE %.1f ns\n", bench_generic(&ip_map, (uint8_t *)ips), typed);
+    BENCH_TYPED(bench_conn_map, &conn_typed, conns, typed);
+    printf("tcp_key:  map_t %.1f ns, MAP_DEFINE %.1f ns\n", bench_generic(&conn_map, (uint8_t *)conns), typed);
+    map_destroy(&port_map);
+    map_destroy(&ip_map);
+    map_destroy(&conn_map);
+    bench_port_map_destroy(&port_typed);
+    bench_ip_map_destroy(&ip_typed);
+    bench_conn_map_destroy(&conn_typed);
+}
+
+int main(int argc, char *argv[]) {
+    map_init(&bench_table, NET_IP_LEN, NET_MAC_LEN, 0, ARP_TIMEOUT_SEC, MAP_EVICT_NONE, NULL, NULL, NULL);
+    uint8_t ip[NET_IP_LEN];
+    uint8_t mac[NET_MAC_LEN] = {0x02, 0, 0, 0, 0, 0};
+    for (size_t i = 0; map_set(&bench_table, (bench_ip(ip, i), ip), mac) == 0; i++)
+        ;
+    printf("arp_table: %zu entries\n", map_size(&bench_table));
+
+    // 改动前每次判断键值对是否过期都要读取一次系统时间，相当于每次查找刷新一次时钟
+    double before = bench_lookup(1);
+    // 改动后由net_poll每次轮询刷新一次，一次轮询内的查找共享同一时间
+    double after = bench_lookup(BENCH_POLL_BURST);
+    printf("clock per lookup:    %.1f ns/lookup\n", before);
+    printf("clock per poll (%d): %.1f ns/lookup\n", BENCH_POLL_BURST, after);
+
+    bench_typed();
+    return 0;
+}
@@ -0,0 +1,364 @@
+#include "driver.h"
+#include "ip.h"
+#include "net.h"
+#include "tcp.h"
+#include "udp.h"
+#include "utils.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BENCH_UDP_PORT 7                 // 服务端的UDP回显端口
+#define BENCH_TCP_PORT 9                 // 服务端的TCP接收端口，收到的数据直接丢弃
+#define BENCH_CLIENT_PORT 40000          // 客户端使用的起始端口
+#define BENCH_CONN_WINDOW 16             // 握手测量中同时进行的连接数
+#define BENCH_BULK_WINDOW 44             // 批量传输在途的报文段数，不超过服务端通告的窗口
+#define BENCH_STALL_NS 1000000000ull     // 连接超过该时间没有进展时以RST放弃
+#define BENCH_MAX_SAMPLES 1000000        // 最多记录的往返时延样本数
+#define BENCH_MSS (ETHERNET_MAX_TRANSPORT_UNIT - sizeof(ip_hdr_t) - TCP_HEADER_LEN)  // 不触发IP分片的最大报文段
+
+typedef struct bench_conn  // 客户端的一个TCP连接，协议栈只实现了被动打开，主动打开的一方由测试自行维护
+{
+    tcp_conn_t conn;    // seq为下一个要发送的序号，ack为期望收到的序号
+    uint32_t una;       // 最早的未确认序号
+    uint64_t start_ns;  // 本轮连接开始或最近一次进展的时间
+} bench_conn_t;
+
+static uint8_t server_ip[NET_IP_LEN] = NET_IF_IP;
+static uint64_t bench_rtt[BENCH_MAX_SAMPLES];
+static size_t bench_rtt_num;
+static int bench_udp_got;
+static bench_conn_t bench_conns[BENCH_CONN_WINDOW];
+static int bench_bulk;          // 为1时连接建立后持续发送数据，否则立即关闭
+static size_t bench_closed;     // 完成握手与挥手的连接数
+static size_t bench_aborted;    // 因没有进展而放弃的连接数
+static uint64_t bench_acked;    // 批量传输中已确认的字节数
+static uint8_t bench_data[BENCH_MSS];
+
+/**
+ * @brief 获取单调时钟，单位为纳秒
+ *
+ * @return uint64_t 当前时间
+ */
+static uint64_t bench_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* =============================== 服务端 =============================== */
+
+static void bench_udp_echo(uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port) {
+    udp_send(data, len, BENCH_UDP_PORT, src_ip, src_port);
+}
+
+static void bench_tcp_sink(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port) {
+}
+
+/**
+ * @brief 在子进程中运行服务端协议栈，接入内存连线的端1
+ *
+ * @return pid_t 子进程号，失败为-1
+ */
+static pid_t bench_server() {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    if (driver_select("wire:1") < 0 || net_init() == -1 || udp_open(BENCH_UDP_PORT, bench_udp_echo) == -1 ||
+        tcp_open(BENCH_TCP_PORT, bench_tcp_sink) == -1) {
+        fprintf(stderr, "Error in bench_server: net init failed.\n");
+        exit(-1);
+    }
+    net_run();
+    exit(0);
+}
+
+/* =============================== 客户端 =============================== */
+
+static void bench_udp_reply(uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port) {
+    uint64_t send_ns;
+    if (len < sizeof(send_ns))
+        return;
+    memcpy(&send_ns, data, sizeof(send_ns));
+    if (bench_rtt_num < BENCH_MAX_SAMPLES)
+        bench_rtt[bench_rtt_num++] = bench_clock_ns() - send_ns;
+    bench_udp_got = 1;
+}
+
+/**
+ * @brief 客户端连接发送一个不带数据的报文段
+ *
+ * @param c 连接
+ * @param index 连接序号，决定客户端端口
+ * @param flags TCP标志位
+ */
+static void bench_tcp_out(bench_conn_t *c, int index, uint8_t flags) {
+    buf_init(&txbuf, 0);
+    tcp_out(&c->conn, &txbuf, BENCH_CLIENT_PORT + index, server_ip, BENCH_TCP_PORT, flags);
+    c->conn.seq += TCP_FLG_ISSET(flags, TCP_FLG_SYN | TCP_FLG_FIN);  // SYN与FIN各占一个序号，二者不同时发送
+}
+
+/**
+ * @brief 开始一轮新的连接，发送SYN
+ *
+ * @param index 连接序号
+ */
+static void bench_tcp_connect(int index) {
+    bench_conn_t *c = &bench_conns[index];
+    memset(c, 0, sizeof(*c));
+    c->conn.seq = c->una = rand();
+    c->conn.state = TCP_STATE_SYN_SENT;
+    c->start_ns = bench_clock_ns();
+    bench_tcp_out(c, index, TCP_FLG_SYN);
+}
+
+/**
+ * @brief 客户端的TCP处理程序，替换协议栈的tcp_in，完成主动打开与主动关闭
+ *
+ * @param buf 收到的报文段
+ * @param src_ip 源IP地址
+ */
+static void bench_tcp_in(buf_t *buf, uint8_t *src_ip) {
+    if (buf->len < sizeof(tcp_hdr_t))
+        return;
+    tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
+    int index = swap16(hdr->dst_port16) - BENCH_CLIENT_PORT;
+    if (index < 0 || index >= BENCH_CONN_WINDOW)
+        return;
+    bench_conn_t *c = &bench_conns[index];
+    uint8_t flags = hdr->flags;
+    uint32_t seq = swap32(hdr->seq), ack = swap32(hdr->ack);
+    if (TCP_FLG_ISSET(flags, TCP_FLG_RST)) {
+        bench_aborted++;
+        bench_tcp_connect(index);
+        return;
+    }
+    if (TCP_FLG_ISSET(flags, TCP_FLG_ACK) && (int32_t)(ack - c->una) > 0 && (int32_t)(ack - c->conn.seq) <= 0) {
+        if (c->conn.state == TCP_STATE_ESTABLISHED)
+            bench_acked += ack - c->una;
+        c->una = ack;
+        c->start_ns = bench_clock_ns();
+    }
+
+    switch (c->conn.state) {
+        case TCP_STATE_SYN_SENT:
+            if (!TCP_FLG_ISSET(flags, TCP_FLG_SYN) || !TCP_FLG_ISSET(flags, TCP_FLG_ACK))
+                return;
+            c->conn.ack = seq + 1;
+            bench_tcp_out(c, index, TCP_FLG_ACK);
+            if (bench_bulk) {
+                c->conn.state = TCP_STATE_ESTABLISHED;
+                break;
+            }
+            bench_tcp_out(c, index, TCP_FLG_FIN | TCP_FLG_ACK);
+            c->conn.state = TCP_STATE_FIN_WAIT1;
+            break;
+
+        case TCP_STATE_FIN_WAIT1:
+            if (!TCP_FLG_ISSET(flags, TCP_FLG_FIN))
+                return;
+            // 服务端将FIN与对FIN的确认合并发送，确认后服务端删除连接，同一端口可立即开始下一轮
+            c->conn.ack = seq + 1;
+            bench_tcp_out(c, index, TCP_FLG_ACK);
+            bench_closed++;
+            bench_tcp_connect(index);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief 放弃长时间没有进展的连接，例如握手报文因环满被丢弃
+ *
+ * @param now 当前时间
+ */
+static void bench_tcp_reap(uint64_t now) {
+    for (int i = 0; i < BENCH_CONN_WINDOW; i++) {
+        bench_conn_t *c = &bench_conns[i];
+        if (c->conn.state != TCP_STATE_CLOSED && now - c->start_ns > BENCH_STALL_NS) {
+            bench_tcp_out(c, i, TCP_FLG_RST | TCP_FLG_ACK);
+            bench_aborted++;
+            bench_tcp_connect(i);
+        }
+    }
+}
+
+/**
+ * @brief 打印客户端在一个阶段中每帧的驱动系统调用数
+ *
+ * @param frames 阶段开始时收发的帧数
+ * @param syscalls 阶段开始时的系统调用数
+ */
+static void bench_syscalls(size_t frames, size_t syscalls) {
+    frames = net_stat.frame_num + net_stat.tx_frame_num - frames;
+    syscalls = driver_stat.rx_syscalls + driver_stat.tx_syscalls - syscalls;
+    printf(", %.3f syscalls/frame\n", frames ? (double)syscalls / frames : 0.0);
+}
+
+/**
+ * @brief 测量UDP回显的往返时延，每次只有一个请求在途
+ *
+ * @param seconds 测量时长
+ */
+static void bench_udp(int seconds) {
+    size_t frames = net_stat.frame_num + net_stat.tx_frame_num, syscalls = driver_stat.rx_syscalls + driver_stat.tx_syscalls;
+    size_t sent = 0, lost = 0;
+    bench_rtt_num = 0;
+    uint64_t start = bench_clock_ns(), end = start + (uint64_t)seconds * 1000000000;
+    uint64_t now = start;
+    while (now < end) {
+        uint64_t send_ns = bench_clock_ns();
+        bench_udp_got = 0;
+        udp_send((uint8_t *)&send_ns, sizeof(send_ns), BENCH_CLIENT_PORT, server_ip, BENCH_UDP_PORT);
+        sent++;
+        do {
+            net_poll();
+            now = bench_clock_ns();
+        } while (!bench_udp_got && now - send_ns < BENCH_STALL_NS);
+        lost += !bench_udp_got;
+    }
+    if (bench_rtt_num == 0) {
+        printf("udp echo:  no replies\n");
+        return;
+    }
+    qsort(bench_rtt, bench_rtt_num, sizeof(bench_rtt[0]), bench_cmp);
+    printf("udp echo:  %9.0f rtt/s, p50 %7.2f us, p99 %7.2f us, p999 %7.2f us, %zu/%zu lost",
+           bench_rtt_num * 1e9 / (now - start), bench_rtt[bench_rtt_num / 2] / 1e3, bench_rtt[bench_rtt_num * 99 / 100] / 1e3,
+           bench_rtt[bench_rtt_num * 999 / 1000] / 1e3, lost, sent);
+    bench_syscalls(frames, syscalls);
+}
+
+/**
+ * @brief 测量TCP握手速率：BENCH_CONN_WINDOW个连接反复完成三次握手并立即关闭
+ *
+ * @param seconds 测量时长
+ */
+static void bench_tcp_handshake(int seconds) {
+    size_t frames = net_stat.frame_num + net_stat.tx_frame_num, syscalls = driver_stat.rx_syscalls + driver_stat.tx_syscalls;
+    bench_bulk = 0;
+    bench_closed = bench_aborted = 0;
+    for (int i = 0; i < BENCH_CONN_WINDOW; i++)
+        bench_tcp_connect(i);
+    uint64_t start = bench_clock_ns(), end = start + (uint64_t)seconds * 1000000000;
+    uint64_t now = start;
+    while (now < end) {
+        net_poll();
+        now = bench_clock_ns();
+        bench_tcp_reap(now);
+    }
+    // 结束时以RST撤销进行中的连接，避免残留在服务端的连接表中
+    for (int i = 0; i < BENCH_CONN_WINDOW; i++) {
+        bench_tcp_out(&bench_conns[i], i, TCP_FLG_RST | TCP_FLG_ACK);
+        bench_conns[i].conn.state = TCP_STATE_CLOSED;
+    }
+    net_poll();
+    printf("tcp conn:  %9.0f conn/s, %zu connections, %zu aborted", bench_closed * 1e9 / (now - start), bench_closed, bench_aborted);
+    bench_syscalls(frames, syscalls);
+}
+
+/**
+ * @brief 测量单个TCP连接经tcp_send批量发送的吞吐量，在途数据不超过服务端通告的窗口
+ *
+ * @param seconds 测量时长
+ */
+static void bench_tcp_bulk(int seconds) {
+    bench_bulk = 1;
+    bench_acked = bench_aborted = 0;
+    bench_tcp_connect(0);
+    bench_conn_t *c = &bench_conns[0];
+    for (uint64_t deadline = bench_clock_ns() + BENCH_STALL_NS; c->conn.state != TCP_STATE_ESTABLISHED && bench_clock_ns() < deadline;)
+        net_poll();
+    if (c->conn.state != TCP_STATE_ESTABLISHED) {
+        printf("tcp bulk:  handshake failed\n");
+        return;
+    }
+
+    size_t frames = net_stat.frame_num + net_stat.tx_frame_num, syscalls = driver_stat.rx_syscalls + driver_stat.tx_syscalls;
+    uint64_t start = bench_clock_ns(), end = start + (uint64_t)seconds * 1000000000;
+    uint64_t now = start;
+    while (now < end && now - c->start_ns < BENCH_STALL_NS) {
+        while (c->conn.seq - c->una <= (BENCH_BULK_WINDOW - 1) * BENCH_MSS)
+            tcp_send(&c->conn, bench_data, BENCH_MSS, BENCH_CLIENT_PORT, server_ip, BENCH_TCP_PORT);
+        net_poll();
+        now = bench_clock_ns();
+    }
+    bench_tcp_out(c, 0, TCP_FLG_RST | TCP_FLG_ACK);
+    c->conn.state = TCP_STATE_CLOSED;
+    net_poll();
+    printf("tcp bulk:  %9.1f MB/s, %.1f Gbit/s%s", bench_acked / 1e6 / ((now - start) / 1e9), bench_acked * 8 / (double)(now - start),
+           now < end ? ", stalled" : "");
+    bench_syscalls(frames, syscalls);
+}
+
+/**
+ * @brief 打印网络仿真一个方向的统计
+ *
+ * @param name 方向名
+ * @param stat 统计
+ */
+static void bench_netem_link(const char *name, const driver_netem_link_stat_t *stat) {
+    printf("  %s frames %zu, delivered %zu, lost %zu, overflow %zu, reordered %zu, duplicated %zu\n", name, stat->frames,
+           stat->delivered, stat->lost, stat->overflow, stat->reordered, stat->duplicated);
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 3;
+    if (seconds <= 0) {
+        fprintf(stderr, "Usage: %s [seconds] [netem options]\n", argv[0]);
+        fprintf(stderr, "Connects a client and a server stack through the in-memory wire driver and measures\n");
+        fprintf(stderr, "UDP echo latency, TCP handshake rate and TCP bulk throughput.\n");
+        fprintf(stderr, "Netem options, e.g. delay=10,jitter=1,loss=0.5,rate=100,seed=7, impair the client's side of the wire.\n");
+        return -1;
+    }
+    // 客户端经网络仿真接入连线时，两个方向的损伤都作用于客户端一侧
+    char spec[PCAP_BUF_SIZE] = "wire:0";
+    if (argc > 2)
+        snprintf(spec, sizeof(spec), "netem:wire:0;%s", argv[2]);
+    if (driver_wire_create() < 0)
+        return -1;
+    pid_t pid = bench_server();
+    if (pid < 0)
+        return -1;
+
+    // 客户端与服务端在同一网段，地址与mac的最后一字节不同
+    net_if_ip[3] ^= 0x80;
+    net_if_mac[5] ^= 0x80;
+    int ret = -1;
+    if (driver_select(spec) == 0 && net_init() == 0 && udp_open(BENCH_CLIENT_PORT, bench_udp_reply) == 0) {
+        net_add_protocol(NET_PROTOCOL_TCP, bench_tcp_in);
+        // 预热：等待ARP解析完成
+        for (int i = 0; i < 10 && !bench_udp_got; i++) {
+            uint64_t send_ns = bench_clock_ns();
+            udp_send((uint8_t *)&send_ns, sizeof(send_ns), BENCH_CLIENT_PORT, server_ip, BENCH_UDP_PORT);
+            while (!bench_udp_got && bench_clock_ns() - send_ns < BENCH_STALL_NS / 10)
+                net_poll();
+        }
+        if (bench_udp_got) {
+            bench_udp(seconds);
+            bench_tcp_handshake(seconds);
+            bench_tcp_bulk(seconds);
+            if (argc > 2) {
+                printf("netem %s:\n", argv[2]);
+                bench_netem_link("rx", &driver_netem_stat.rx);
+                bench_netem_link("tx", &driver_netem_stat.tx);
+            }
+            ret = 0;
+        } else
+            fprintf(stderr, "Error in net_bench: server does not reply.\n");
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return ret;
+}
@@ -0,0 +1,254 @@
+#include "driver.h"
+#include "net.h"
+#include "udp.h"
+#include "utils.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BENCH_TAP_NAME "runtap0"  // 测试时由协议栈创建的TAP网卡
+#define BENCH_PORT 60000          // 协议栈的回显端口
+#define BENCH_MAX_SAMPLES 1000000 // 单个阶段最多记录的往返时延样本数
+#define BENCH_LIGHT_GAP_US 1000   // 轻负载下相邻请求的间隔
+#define BENCH_WINDOW 32           // 饱和负载下同时在途的请求数
+
+/**
+ * @brief 请求的内容，协议栈原样回显
+ *
+ */
+typedef struct bench_msg {
+    uint64_t seq;      // 序号
+    uint64_t send_ns;  // 发送时刻
+} bench_msg_t;
+
+static uint64_t bench_rtt[BENCH_MAX_SAMPLES];
+
+/**
+ * @brief 获取单调时钟，单位为纳秒
+ *
+ * @return uint64_t 当前时间
+ */
+static uint64_t bench_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief 读取进程所有线程累计的用户态与内核态时间，单位为时钟滴答
+ *
+ * @param pid 进程号
+ * @return uint64_t 累计时间，失败为0
+ */
+static uint64_t bench_cpu_ticks(pid_t pid) {
+    char path[64], line[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+    size_t len = fread(line, 1, sizeof(line) - 1, fp);
+    fclose(fp);
+    line[len] = '\0';
+    // 进程名可能含空格，从最后一个右括号之后开始数，utime与stime为第14与15项
+    char *p = strrchr(line, ')');
+    unsigned long long utime = 0, stime = 0;
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2)
+        return 0;
+    return utime + stime;
+}
+
+static void bench_echo(uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port) {
+    udp_send(data, len, BENCH_PORT, src_ip, src_port);
+}
+
+/**
+ * @brief 在子进程中运行带回显服务的协议栈
+ *
+ * @param spin 为1时持续调用net_poll，否则使用net_run
+ * @return pid_t 子进程号，失败为-1
+ */
+static pid_t bench_server(int spin) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    setenv("NET_DRIVER", "tap:" BENCH_TAP_NAME, 1);
+    if (net_init() == -1 || udp_open(BENCH_PORT, bench_echo) == -1) {
+        fprintf(stderr, "Error in bench_server: net init failed.\n");
+        exit(-1);
+    }
+    if (spin)
+        while (1)
+            net_poll();
+    net_run();
+    exit(0);
+}
+
+/**
+ * @brief 等待TAP网卡出现后为主机侧配置与协议栈同网段的地址
+ *
+ * @param host_ip 主机侧地址
+ * @return int 成功为0，失败为-1
+ */
+static int bench_host_addr(const uint8_t *host_ip) {
+    for (int i = 0; i < 1000 && if_nametoindex(BENCH_TAP_NAME) == 0; i++)
+        usleep(1000);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct ifreq ifr = {0};
+    strncpy(ifr.ifr_name, BENCH_TAP_NAME, IFNAMSIZ - 1);
+    struct sockaddr_in *addr = (struct sockaddr_in *)&ifr.ifr_addr;
+    addr->sin_family = AF_INET;
+    memcpy(&addr->sin_addr, host_ip, NET_IP_LEN);
+    int ret = fd < 0 || ioctl(fd, SIOCSIFADDR, &ifr) < 0;
+    addr->sin_addr.s_addr = htonl(0xffffff00);
+    ret = ret || ioctl(fd, SIOCSIFNETMASK, &ifr) < 0 || ioctl(fd, SIOCGIFFLAGS, &ifr) < 0;
+    ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+    ret = ret || ioctl(fd, SIOCSIFFLAGS, &ifr) < 0;
+    if (ret)
+        fprintf(stderr, "Error in bench_host_addr: %s.\n", strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return ret ? -1 : 0;
+}
+
+static int bench_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief 收取所有已到达的回显，记录往返时延
+ *
+ * @param fd 客户端套接字
+ * @param timeout_ms 没有回显时最多等待的毫秒数
+ * @param num 已记录的样本数，会被更新
+ * @return int 本次收到的回显数
+ */
+static int bench_collect(int fd, int timeout_ms, size_t *num) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return 0;
+    bench_msg_t msg;
+    int got = 0;
+    while (recv(fd, &msg, sizeof(msg), MSG_DONTWAIT) == sizeof(msg)) {
+        if (*num < BENCH_MAX_SAMPLES)
+            bench_rtt[(*num)++] = bench_clock_ns() - msg.send_ns;
+        got++;
+    }
+    return got;
+}
+
+/**
+ * @brief 测量一个负载阶段并打印结果
+ *
+ * @param name 阶段名
+ * @param pid 协议栈进程
+ * @param fd 已connect到协议栈回显端口的客户端套接字
+ * @param window 同时在途的请求数，0为空闲，1为按固定间隔发送的轻负载，其余为闭环的饱和负载
+ * @param seconds 测量时长
+ */
+static void bench_phase(const char *name, pid_t pid, int fd, int window, int seconds) {
+    size_t num = 0, sent = 0;
+    long inflight = 0;
+    uint64_t ticks = bench_cpu_ticks(pid);
+    uint64_t start = bench_clock_ns(), end = start + (uint64_t)seconds * 1000000000;
+    uint64_t now = start, next = start;
+    while (now < end) {
+        if (window == 0) {
+            usleep(100000);
+        } else if (window == 1) {
+            // 轻负载：固定间隔发送，等待回显直到下一个发送时刻
+            if (now >= next) {
+                bench_msg_t msg = {sent++, bench_clock_ns()};
+                send(fd, &msg, sizeof(msg), 0);
+                next += BENCH_LIGHT_GAP_US * 1000;
+            }
+            int64_t wait_us = ((int64_t)next - (int64_t)bench_clock_ns()) / 1000;
+            bench_collect(fd, wait_us > 0 ? (int)(wait_us / 1000) : 0, &num);
+        } else {
+            // 饱和负载：补足在途的请求后等待回显，丢失的请求在超时后不再计入
+            for (; inflight < window; inflight++) {
+                bench_msg_t msg = {sent++, bench_clock_ns()};
+                send(fd, &msg, sizeof(msg), 0);
+            }
+            int got = bench_collect(fd, 10, &num);
+            inflight = got ? inflight - got : 0;
+        }
+        now = bench_clock_ns();
+    }
+    // 收取尾部的回显
+    while (window && bench_collect(fd, 50, &num))
+        ;
+    double cpu = (bench_cpu_ticks(pid) - ticks) * 100.0 / sysconf(_SC_CLK_TCK) / ((now - start) / 1e9);
+    if (num == 0) {
+        printf("  %-10s cpu %6.1f%%, %zu requests, no replies\n", name, cpu, sent);
+        return;
+    }
+    qsort(bench_rtt, num, sizeof(bench_rtt[0]), bench_cmp);
+    printf("  %-10s cpu %6.1f%%, %8.0f replies/s, rtt p50 %8.1f us, p99 %8.1f us, %zu/%zu replied\n", name, cpu,
+           num * 1e9 / (now - start), bench_rtt[num / 2] / 1e3, bench_rtt[num * 99 / 100] / 1e3, num, sent);
+}
+
+/**
+ * @brief 以一种事件循环运行协议栈，依次测量空闲、轻负载与饱和负载
+ *
+ * @param spin 为1时持续调用net_poll，否则使用net_run
+ * @param seconds 每个阶段的测量时长
+ */
+static void bench_mode(int spin, int seconds) {
+    uint8_t host_ip[NET_IP_LEN] = NET_IF_IP;
+    host_ip[3] = host_ip[3] == 1 ? 2 : 1;
+    printf("%s:\n", spin ? "busy poll" : "net_run");
+    pid_t pid = bench_server(spin);
+    if (pid < 0 || bench_host_addr(host_ip) < 0) {
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+        return;
+    }
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(BENCH_PORT)};
+    memcpy(&addr.sin_addr, (uint8_t[])NET_IF_IP, NET_IP_LEN);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Error in bench_mode: %s.\n", strerror(errno));
+    } else {
+        // 预热：等待ARP解析完成且协议栈开始回显
+        size_t num = 0;
+        for (int i = 0; i < 50 && num == 0; i++) {
+            bench_msg_t msg = {0, bench_clock_ns()};
+            send(fd, &msg, sizeof(msg), 0);
+            bench_collect(fd, 100, &num);
+        }
+        bench_phase("idle", pid, fd, 0, seconds);
+        bench_phase("light", pid, fd, 1, seconds);
+        bench_phase("saturated", pid, fd, BENCH_WINDOW, seconds);
+    }
+    if (fd >= 0)
+        close(fd);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char *argv[]) {
+    int seconds = argc > 1 ? atoi(argv[1]) : 3;
+    if (seconds <= 0) {
+        fprintf(stderr, "Usage: %s [seconds]\n", argv[0]);
+        fprintf(stderr, "Runs the stack with a UDP echo on a temporary tap device %s, needs CAP_NET_ADMIN.\n", BENCH_TAP_NAME);
+        return -1;
+    }
+    bench_mode(1, seconds);
+    bench_mode(0, seconds);
+    return 0;
+}
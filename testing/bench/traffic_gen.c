@@ -0,0 +1,479 @@
+#include "arp.h"
+#include "ethernet.h"
+#include "icmp.h"
+#include "ip.h"
+#include "tcp.h"
+#include "udp.h"
+#include "utils.h"
+
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GEN_PORT 60000      // 协议栈打开的端口，与replay_bench一致
+#define GEN_MAX_SIZES 16    // 帧长分布的最大档数
+#define GEN_MIN_FRAME 60    // 以太网最短帧，不含FCS
+#define GEN_MAX_FRAME 1514  // 以太网最长帧，不含FCS
+
+typedef enum gen_kind {  // 生成的流量类型
+    GEN_ARP,             // 流的源向协议栈发ARP请求
+    GEN_ICMP,            // ICMP回显请求
+    GEN_UDP,             // 发往打开端口的UDP
+    GEN_CLOSED,          // 发往关闭端口的UDP，协议栈回复ICMP端口不可达
+    GEN_TCP,             // 按流推进的TCP连接：握手、数据、关闭
+    GEN_SYN,             // 随机源地址与端口的SYN洪泛，连接永远不会完成
+    GEN_KIND_NUM
+} gen_kind_t;
+
+static const char *gen_kind_names[GEN_KIND_NUM] = {"arp", "icmp", "udp", "closed", "tcp", "syn"};
+
+typedef struct gen_flow  // 一个流的源地址与TCP连接的进度
+{
+    uint8_t mac[NET_MAC_LEN];
+    uint8_t ip[NET_IP_LEN];
+    uint16_t port;
+    uint32_t seq;   // 下一个TCP序号
+    int tcp_step;   // 0为SYN，1为ACK，其后为数据段，最后为FIN与ACK
+    uint16_t icmp_seq;
+} gen_flow_t;
+
+typedef struct gen_config  // 生成参数
+{
+    size_t packets;                   // 数据帧总数
+    size_t flows;                     // 流数
+    size_t sizes[GEN_MAX_SIZES];      // 帧长的各档
+    double size_weights[GEN_MAX_SIZES];
+    int size_num;
+    double mix[GEN_KIND_NUM];         // 各类流量的权重
+    double frag;                      // IP数据报被分成两个分片的比例，协议栈不重组，分片由上层按校验和丢弃
+    int tcp_data;                     // 每个TCP连接的数据段数
+    double rate;                      // 时间戳的速率，每秒帧数
+    uint64_t seed;
+} gen_config_t;
+
+static gen_config_t gen = {
+    .packets = 100000,
+    .flows = 256,
+    .sizes = {64, 576, 1500},  // 简单IMIX
+    .size_weights = {7, 4, 1},
+    .size_num = 3,
+    .mix = {[GEN_ARP] = 1, [GEN_ICMP] = 2, [GEN_UDP] = 4, [GEN_CLOSED] = 1, [GEN_TCP] = 2, [GEN_SYN] = 0},
+    .frag = 0,
+    .tcp_data = 4,
+    .rate = 1000000,
+    .seed = 1,
+};
+
+static uint8_t gen_dst_ip[NET_IP_LEN] = NET_IF_IP;
+static uint8_t gen_dst_mac[NET_MAC_LEN] = NET_IF_MAC;
+static gen_flow_t *gen_flows;
+static pcap_dumper_t *gen_dump;
+static uint64_t gen_ts_ns;                    // 下一帧的时间戳
+static size_t gen_frames;                     // 已写出的帧数
+static size_t gen_counts[GEN_KIND_NUM];       // 各类流量写出的帧数
+static size_t gen_fragments;                  // 其中的IP分片数
+static uint16_t gen_ip_id;
+
+/**
+ * @brief xorshift64*伪随机数，结果只由种子决定，不依赖平台的rand
+ *
+ * @return uint64_t 随机数
+ */
+static uint64_t gen_rand() {
+    gen.seed ^= gen.seed >> 12;
+    gen.seed ^= gen.seed << 25;
+    gen.seed ^= gen.seed >> 27;
+    return gen.seed * 0x2545F4914F6CDD1Dull;
+}
+
+/**
+ * @brief 按权重随机选择一档
+ *
+ * @param weights 各档的权重
+ * @param num 档数
+ * @return int 选中的档
+ */
+static int gen_pick(const double *weights, int num) {
+    double total = 0;
+    for (int i = 0; i < num; i++)
+        total += weights[i];
+    double r = (gen_rand() >> 11) * (1.0 / (1ull << 53)) * total;
+    for (int i = 0; i < num; i++) {
+        if (r < weights[i])
+            return i;
+        r -= weights[i];
+    }
+    return num - 1;
+}
+
+/**
+ * @brief 按帧长分布选取一个帧长
+ *
+ * @return size_t 帧长，不含FCS
+ */
+static size_t gen_frame_size() {
+    return gen.sizes[gen_pick(gen.size_weights, gen.size_num)];
+}
+
+/**
+ * @brief 为以太网帧补足最短长度后写出，时间戳按速率递增
+ *
+ * @param buf 完整的以太网帧
+ */
+static void gen_write(buf_t *buf) {
+    if (buf->len < GEN_MIN_FRAME)
+        buf_add_padding(buf, GEN_MIN_FRAME - buf->len);
+    struct pcap_pkthdr hdr = {.caplen = buf->len, .len = buf->len};
+    hdr.ts.tv_sec = gen_ts_ns / 1000000000;
+    hdr.ts.tv_usec = gen_ts_ns % 1000000000 / 1000;
+    pcap_dump((u_char *)gen_dump, &hdr, buf->data);
+    gen_ts_ns += (uint64_t)(1e9 / gen.rate);
+    gen_frames++;
+}
+
+/**
+ * @brief 添加以太网头并写出
+ *
+ * @param buf 以太网的负载
+ * @param src 源mac
+ * @param dst 目标mac
+ * @param protocol 以太网类型
+ */
+static void gen_ethernet(buf_t *buf, const uint8_t *src, const uint8_t *dst, uint16_t protocol) {
+    buf_add_header(buf, sizeof(ether_hdr_t));
+    ether_hdr_t *hdr = (ether_hdr_t *)buf->data;
+    memcpy(hdr->dst, dst, NET_MAC_LEN);
+    memcpy(hdr->src, src, NET_MAC_LEN);
+    hdr->protocol16 = swap16(protocol);
+    gen_write(buf);
+}
+
+/**
+ * @brief 在buf前添加IP头
+ *
+ * @param buf IP的负载
+ * @param src_ip 源ip
+ * @param protocol 上层协议
+ * @param id 标识
+ * @param flags_fragment 标志与分片偏移，偏移以8字节为单位
+ */
+static void gen_ip_hdr(buf_t *buf, const uint8_t *src_ip, uint8_t protocol, uint16_t id, uint16_t flags_fragment) {
+    buf_add_header(buf, sizeof(ip_hdr_t));
+    ip_hdr_t *hdr = (ip_hdr_t *)buf->data;
+    hdr->version = IP_VERSION_4;
+    hdr->hdr_len = sizeof(ip_hdr_t) / IP_HDR_LEN_PER_BYTE;
+    hdr->tos = 0;
+    hdr->total_len16 = swap16(buf->len);
+    hdr->id16 = swap16(id);
+    hdr->flags_fragment16 = swap16(flags_fragment);
+    hdr->ttl = 64;
+    hdr->protocol = protocol;
+    hdr->hdr_checksum16 = 0;
+    memcpy(hdr->src_ip, src_ip, NET_IP_LEN);
+    memcpy(hdr->dst_ip, gen_dst_ip, NET_IP_LEN);
+    hdr->hdr_checksum16 = checksum16((uint16_t *)hdr, sizeof(ip_hdr_t));
+}
+
+/**
+ * @brief 将一个IP负载封装后写出，按分片比例可能拆成多个分片
+ *
+ * @param buf IP的负载，含传输层头
+ * @param flow 源
+ * @param protocol 上层协议
+ */
+static void gen_ip(buf_t *buf, gen_flow_t *flow, uint8_t protocol) {
+    uint16_t id = gen_ip_id++;
+    size_t len = buf->len;
+    // 负载不超过8字节时无法再分
+    if (len <= IP_HDR_OFFSET_PER_BYTE || (gen_rand() >> 11) * (1.0 / (1ull << 53)) >= gen.frag) {
+        gen_ip_hdr(buf, flow->ip, protocol, id, 0);
+        gen_ethernet(buf, flow->mac, gen_dst_mac, NET_PROTOCOL_IP);
+        return;
+    }
+    // 前一半按8字节对齐作为第一个分片，其余作为最后一个分片
+    size_t first = (len / 2 + IP_HDR_OFFSET_PER_BYTE - 1) / IP_HDR_OFFSET_PER_BYTE * IP_HDR_OFFSET_PER_BYTE;
+    buf_t frag = {0};
+    for (size_t offset = 0; offset < len; offset += first) {
+        size_t frag_len = len - offset < first ? len - offset : first;
+        buf_init(&frag, frag_len);
+        memcpy(frag.data, buf->data + offset, frag_len);
+        uint16_t mf = offset + frag_len < len ? IP_MORE_FRAGMENT : 0;
+        gen_ip_hdr(&frag, flow->ip, protocol, id, mf | offset / IP_HDR_OFFSET_PER_BYTE);
+        gen_ethernet(&frag, flow->mac, gen_dst_mac, NET_PROTOCOL_IP);
+        gen_fragments++;
+    }
+    buf_free(&frag);
+}
+
+/**
+ * @brief 为负载分配buf，长度由帧长减去各层头部得到
+ *
+ * @param buf 出口参数
+ * @param headers 负载之前的各层头部长度之和，含以太网头
+ * @param min 负载的最小长度
+ */
+static void gen_payload(buf_t *buf, size_t headers, size_t min) {
+    size_t size = gen_frame_size();
+    size_t len = size > headers + min ? size - headers : min;
+    buf_init(buf, len);
+    for (size_t i = 0; i < len; i++)
+        buf->data[i] = (uint8_t)i;
+}
+
+static void gen_arp(gen_flow_t *flow, buf_t *buf) {
+    buf_init(buf, sizeof(arp_pkt_t));
+    arp_pkt_t *arp = (arp_pkt_t *)buf->data;
+    memset(arp, 0, sizeof(*arp));
+    arp->hw_type16 = swap16(ARP_HW_ETHER);
+    arp->pro_type16 = swap16(NET_PROTOCOL_IP);
+    arp->hw_len = NET_MAC_LEN;
+    arp->pro_len = NET_IP_LEN;
+    arp->opcode16 = swap16(ARP_REQUEST);
+    memcpy(arp->sender_mac, flow->mac, NET_MAC_LEN);
+    memcpy(arp->sender_ip, flow->ip, NET_IP_LEN);
+    memcpy(arp->target_ip, gen_dst_ip, NET_IP_LEN);
+    gen_ethernet(buf, flow->mac, ether_broadcast_mac, NET_PROTOCOL_ARP);
+}
+
+static void gen_icmp(gen_flow_t *flow, buf_t *buf) {
+    gen_payload(buf, sizeof(ether_hdr_t) + sizeof(ip_hdr_t) + sizeof(icmp_hdr_t), 0);
+    buf_add_header(buf, sizeof(icmp_hdr_t));
+    icmp_hdr_t *hdr = (icmp_hdr_t *)buf->data;
+    hdr->type = ICMP_TYPE_ECHO_REQUEST;
+    hdr->code = 0;
+    hdr->id16 = swap16(flow->port);
+    hdr->seq16 = swap16(flow->icmp_seq);
+    flow->icmp_seq++;
+    hdr->checksum16 = 0;
+    hdr->checksum16 = checksum16((uint16_t *)buf->data, buf->len);
+    gen_ip(buf, flow, NET_PROTOCOL_ICMP);
+}
+
+static void gen_udp(gen_flow_t *flow, buf_t *buf, uint16_t dst_port) {
+    gen_payload(buf, sizeof(ether_hdr_t) + sizeof(ip_hdr_t) + sizeof(udp_hdr_t), 0);
+    buf_add_header(buf, sizeof(udp_hdr_t));
+    udp_hdr_t *hdr = (udp_hdr_t *)buf->data;
+    hdr->src_port16 = swap16(flow->port);
+    hdr->dst_port16 = swap16(dst_port);
+    hdr->total_len16 = swap16(buf->len);
+    hdr->checksum16 = 0;
+    hdr->checksum16 = transport_checksum(NET_PROTOCOL_UDP, buf, flow->ip, gen_dst_ip);
+    gen_ip(buf, flow, NET_PROTOCOL_UDP);
+}
+
+/**
+ * @brief 写出一个TCP报文段
+ *
+ * @param flow 源，seq按报文段占用的序号空间推进
+ * @param buf 负载，长度可为0
+ * @param flags TCP标志位
+ */
+static void gen_tcp_segment(gen_flow_t *flow, buf_t *buf, uint8_t flags) {
+    size_t len = buf->len;
+    buf_add_header(buf, sizeof(tcp_hdr_t));
+    tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
+    hdr->src_port16 = swap16(flow->port);
+    hdr->dst_port16 = swap16(GEN_PORT);
+    hdr->seq = swap32(flow->seq);
+    hdr->ack = 0;  // 协议栈不检查确认号，生成器也不知道协议栈的初始序号
+    hdr->doff = TCP_HEADER_LEN / 4 << 4;
+    hdr->flags = flags;
+    hdr->win = swap16(TCP_MAX_WINDOW_SIZE);
+    hdr->uptr = 0;
+    hdr->checksum16 = 0;
+    hdr->checksum16 = transport_checksum(NET_PROTOCOL_TCP, buf, flow->ip, gen_dst_ip);
+    flow->seq += len + TCP_FLG_ISSET(flags, TCP_FLG_SYN | TCP_FLG_FIN);
+    gen_ip(buf, flow, NET_PROTOCOL_TCP);
+}
+
+/**
+ * @brief 推进流的TCP连接一步：SYN、ACK、tcp_data个数据段、FIN、ACK，然后开始下一个连接
+ *
+ * @param flow 源
+ * @param buf 临时buf
+ */
+static void gen_tcp(gen_flow_t *flow, buf_t *buf) {
+    int step = flow->tcp_step++;
+    if (step == 0) {
+        flow->seq = (uint32_t)gen_rand();
+        buf_init(buf, 0);
+        gen_tcp_segment(flow, buf, TCP_FLG_SYN);
+    } else if (step == 1) {
+        buf_init(buf, 0);
+        gen_tcp_segment(flow, buf, TCP_FLG_ACK);
+    } else if (step < 2 + gen.tcp_data) {
+        gen_payload(buf, sizeof(ether_hdr_t) + sizeof(ip_hdr_t) + sizeof(tcp_hdr_t), 1);
+        gen_tcp_segment(flow, buf, TCP_FLG_ACK | TCP_FLG_PSH);
+    } else if (step == 2 + gen.tcp_data) {
+        buf_init(buf, 0);
+        gen_tcp_segment(flow, buf, TCP_FLG_FIN | TCP_FLG_ACK);
+    } else {
+        buf_init(buf, 0);
+        gen_tcp_segment(flow, buf, TCP_FLG_ACK);
+        flow->tcp_step = 0;
+    }
+}
+
+/**
+ * @brief 写出一个随机源地址与端口的SYN，使协议栈为每个SYN新建一个半开连接
+ *
+ * @param buf 临时buf
+ */
+static void gen_syn(buf_t *buf) {
+    uint64_t r = gen_rand();
+    gen_flow_t spoof = {.mac = {0x02, 0xff}, .ip = {172, 16 + (r & 0xf), r >> 8, r >> 16}, .port = 1024 + (r >> 24) % 64512, .seq = (uint32_t)(r >> 32)};
+    memcpy(spoof.mac + 2, spoof.ip, NET_IP_LEN);
+    buf_init(buf, 0);
+    gen_tcp_segment(&spoof, buf, TCP_FLG_SYN);
+}
+
+/**
+ * @brief 解析"名称:权重,..."形式的列表
+ *
+ * @param list 列表
+ * @param names 可用的名称，为NULL时名称为数字，写入values
+ * @param values 出口参数，按名称为数字时的各个数值
+ * @param weights 出口参数，各项的权重
+ * @param max 最多的项数
+ * @return int 项数，格式错误为-1
+ */
+static int gen_parse_list(char *list, const char **names, size_t *values, double *weights, int max) {
+    int num = 0;
+    for (char *item = strtok(list, ","); item; item = strtok(NULL, ",")) {
+        char *colon = strchr(item, ':');
+        if (colon == NULL)
+            return -1;
+        *colon = '\0';
+        int index = num;
+        if (names) {
+            for (index = 0; index < max && strcmp(names[index], item); index++)
+                ;
+        } else if (num < max)
+            values[num] = strtoull(item, NULL, 10);
+        if (index >= max)
+            return -1;
+        weights[index] = atof(colon + 1);
+        num++;
+    }
+    return num;
+}
+
+/**
+ * @brief 解析一个"键=值"参数
+ *
+ * @param arg 参数
+ * @return int 成功为0，失败为-1
+ */
+static int gen_parse(char *arg) {
+    char *val = strchr(arg, '=');
+    if (val == NULL)
+        return -1;
+    *val++ = '\0';
+    if (strcmp(arg, "packets") == 0)
+        gen.packets = strtoull(val, NULL, 10);
+    else if (strcmp(arg, "flows") == 0)
+        gen.flows = strtoull(val, NULL, 10);
+    else if (strcmp(arg, "frag") == 0)
+        gen.frag = atof(val);
+    else if (strcmp(arg, "tcpdata") == 0)
+        gen.tcp_data = atoi(val);
+    else if (strcmp(arg, "rate") == 0)
+        gen.rate = atof(val);
+    else if (strcmp(arg, "seed") == 0)
+        gen.seed = strtoull(val, NULL, 10);
+    else if (strcmp(arg, "sizes") == 0) {
+        gen.size_num = gen_parse_list(val, NULL, gen.sizes, gen.size_weights, GEN_MAX_SIZES);
+        if (gen.size_num <= 0)
+            return -1;
+        for (int i = 0; i < gen.size_num; i++)
+            gen.sizes[i] = gen.sizes[i] < GEN_MIN_FRAME ? GEN_MIN_FRAME : gen.sizes[i] > GEN_MAX_FRAME ? GEN_MAX_FRAME : gen.sizes[i];
+    } else if (strcmp(arg, "mix") == 0) {
+        memset(gen.mix, 0, sizeof(gen.mix));
+        if (gen_parse_list(val, gen_kind_names, NULL, gen.mix, GEN_KIND_NUM) <= 0)
+            return -1;
+    } else
+        return -1;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <out.pcap> [packets=N] [flows=N] [sizes=64:7,576:4,1500:1]\n", argv[0]);
+        fprintf(stderr, "       [mix=arp:1,icmp:2,udp:4,closed:1,tcp:2,syn:0] [frag=RATIO] [tcpdata=N] [rate=PPS] [seed=N]\n");
+        fprintf(stderr, "Frames are addressed to the stack's test address and UDP/TCP port %d, see replay_bench.\n", GEN_PORT);
+        return -1;
+    }
+    for (int i = 2; i < argc; i++)
+        if (gen_parse(argv[i]) < 0) {
+            fprintf(stderr, "Error in traffic_gen: bad option %s.\n", argv[i]);
+            return -1;
+        }
+    double mix_total = 0;
+    for (int i = 0; i < GEN_KIND_NUM; i++)
+        mix_total += gen.mix[i];
+    if (gen.flows == 0 || gen.flows > (1 << 24) || gen.rate <= 0 || gen.seed == 0 || mix_total <= 0) {
+        fprintf(stderr, "Error in traffic_gen: flows must be in 1..2^24, rate, seed and mix must be positive.\n");
+        return -1;
+    }
+
+    // Step1: 打开输出文件
+    FILE *fp = fopen(argv[1], "wb");
+    pcap_t *dead = pcap_open_dead(DLT_EN10MB, GEN_MAX_FRAME);
+    gen_dump = fp && dead ? pcap_dump_fopen(dead, fp) : NULL;
+    gen_flows = calloc(gen.flows, sizeof(gen_flow_t));
+    if (gen_dump == NULL || gen_flows == NULL) {
+        fprintf(stderr, "Error in traffic_gen: cannot open %s.\n", argv[1]);
+        return -1;
+    }
+
+    // Step2: 流的源地址为10.0.0.0/8中的不同地址，mac由地址得到
+    for (size_t i = 0; i < gen.flows; i++) {
+        gen_flow_t *flow = &gen_flows[i];
+        uint32_t host = i + 1;
+        uint8_t ip[NET_IP_LEN] = {10, host >> 16, host >> 8, host};
+        memcpy(flow->ip, ip, NET_IP_LEN);
+        flow->mac[0] = 0x02;
+        memcpy(flow->mac + 2, ip, NET_IP_LEN);
+        flow->port = 1024 + i % 64512;
+    }
+
+    // Step3: 逐个选取流量类型与流，直到写满帧数
+    buf_t buf = {0};
+    gen_ts_ns = 1000000000;
+    while (gen_frames < gen.packets) {
+        gen_kind_t kind = gen_pick(gen.mix, GEN_KIND_NUM);
+        gen_flow_t *flow = &gen_flows[gen_rand() % gen.flows];
+        size_t before = gen_frames;
+        switch (kind) {
+            case GEN_ARP:
+                gen_arp(flow, &buf);
+                break;
+            case GEN_ICMP:
+                gen_icmp(flow, &buf);
+                break;
+            case GEN_UDP:
+                gen_udp(flow, &buf, GEN_PORT);
+                break;
+            case GEN_CLOSED:
+                gen_udp(flow, &buf, GEN_PORT + 1 + gen_rand() % 1000);
+                break;
+            case GEN_TCP:
+                gen_tcp(flow, &buf);
+                break;
+            default:
+                gen_syn(&buf);
+                break;
+        }
+        gen_counts[kind] += gen_frames - before;
+    }
+    buf_free(&buf);
+    pcap_dump_close(gen_dump);
+    pcap_close(dead);
+    free(gen_flows);
+
+    printf("%s: %zu frames, %zu flows, %zu ip fragments\n", argv[1], gen_frames, gen.flows, gen_fragments);
+    for (int i = 0; i < GEN_KIND_NUM; i++)
+        printf("  %-7s %zu\n", gen_kind_names[i], gen_counts[i]);
+    return 0;
+}
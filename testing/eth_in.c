@@ -13,7 +13,6 @@ extern FILE *out_log;
 int check_log();
 FILE *open_file(char *path, char *name, char *mode);
 
-buf_t buf;
 int main(int argc, char *argv[]) {
     int ret;
     pcap_in = open_file(argv[1], "in.pcap", "r");
@@ -41,16 +40,21 @@ int main(int argc, char *argv[]) {
     net_init();
     int i = 1;
     PRINT_INFO("Feeding input %02d", i);
-    while ((ret = driver_recv(&buf)) > 0) {
-        printf("\b\b%02d", i);
-        fprintf(control_flow, "\nRound %02d -----------------------------\n", i++);
-        ethernet_in(&buf);
+    // 按net_poll的方式批量接收，逐帧处理
+    while ((ret = driver_recv_burst(rxbuf, NET_POLL_BUDGET)) > 0) {
+        for (int j = 0; j < ret; j++) {
+            printf("\b\b%02d", i);
+            fprintf(control_flow, "\nRound %02d -----------------------------\n", i++);
+            ethernet_in(&rxbuf[j]);
+        }
     }
     if (ret < 0) {
         PRINT_WARN("\nError occur on loading input,exiting\n");
     }
+    ethernet_flush();  // 相当于net_poll结束时发送队列中的数据帧
     driver_close();
     PRINT_INFO("\nSample input all processed, checking output\n");
+    PRINT_INFO("dispatch: arp %zu, ip %zu\n", net_protocol_count(NET_PROTOCOL_ARP), net_protocol_count(NET_PROTOCOL_IP));
 
     fclose(ip_fout);
 
@@ -36,7 +36,7 @@ void arp_out(buf_t *buf, uint8_t *ip) {
 }
 
 void arp_init() {
-    map_init(&arp_table, NET_IP_LEN, NET_MAC_LEN, 0, ARP_TIMEOUT_SEC, NULL, NULL);
-    map_init(&arp_buf, NET_IP_LEN, sizeof(buf_t), 0, ARP_MIN_INTERVAL, NULL, buf_copy);
+    map_init(&arp_table, NET_IP_LEN, NET_MAC_LEN, 0, ARP_TIMEOUT_SEC, MAP_EVICT_LRU, NULL, NULL, NULL);
+    map_init(&arp_buf, NET_IP_LEN, sizeof(buf_t), 0, ARP_MIN_INTERVAL, MAP_EVICT_NONE, NULL, buf_clone, (map_destructor_t)buf_free);
     net_add_protocol(NET_PROTOCOL_ARP, arp_in);
 }
\ No newline at end of file
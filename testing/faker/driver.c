@@ -1,5 +1,6 @@
 #include "buf.h"
 #include "config.h"
+#include "driver.h"
 
 #include <pcap.h>
 #include <string.h>
@@ -14,7 +15,7 @@ extern FILE *control_flow;
 
 #ifdef _WIN32
 #include <tchar.h>
-BOOL LoadNpcapDlls() {
+static BOOL LoadNpcapDlls() {
     _TCHAR npcap_dir[512];
     UINT len;
     len = GetSystemDirectory(npcap_dir, 480);
@@ -31,7 +32,7 @@ BOOL LoadNpcapDlls() {
 }
 #endif
 
-int driver_open() {
+static int driver_pcapfile_open(const char *arg) {
 #ifdef _WIN32
     /* Load Npcap and its functions. */
     if (!LoadNpcapDlls()) {
@@ -55,7 +56,7 @@ int driver_open() {
     return 0;
 }
 
-int driver_recv(buf_t *buf) {
+static int driver_pcapfile_recv(buf_t *buf) {
     struct pcap_pkthdr *pkt_hdr;
     const uint8_t *pkt_data;
     int ret = pcap_next_ex(pcap, &pkt_hdr, &pkt_data);
@@ -63,16 +64,41 @@ int driver_recv(buf_t *buf) {
         // printf("meet end of file\n");
         return 0;
     } else if (ret == 1) {
-        buf_init(buf, pkt_hdr->len);
-        memcpy(buf->data, pkt_data, pkt_hdr->len);
-        return pkt_hdr->len;
+        // 以只读视图交出数据帧，经协议栈的写时拷贝路径处理
+        buf_view(buf, pkt_data, pkt_hdr->caplen);
+        return pkt_hdr->caplen;
     } else {
         fprintf(stderr, "Error in driver_recv: %s\n", pcap_geterr(pcap));
         return -1;
     }
 }
 
-int driver_send(buf_t *buf) {
+typedef struct driver_burst {
+    buf_t *bufs;
+    int num;
+} driver_burst_t;
+
+static void driver_burst_handler(u_char *user, const struct pcap_pkthdr *pkt_hdr, const u_char *pkt_data) {
+    driver_burst_t *burst = (driver_burst_t *)user;
+    buf_t *buf = &burst->bufs[burst->num];
+    if (buf_init(buf, pkt_hdr->caplen) < 0)
+        return;
+    memcpy(buf->data, pkt_data, pkt_hdr->caplen);
+    burst->num++;
+}
+
+static int driver_pcapfile_recv_burst(buf_t *bufs, int n) {
+    driver_burst_t burst = {bufs, 0};
+    if (pcap_dispatch(pcap, n, driver_burst_handler, (u_char *)&burst) == PCAP_ERROR) {
+        fprintf(stderr, "Error in driver_recv_burst: %s\n", pcap_geterr(pcap));
+        return -1;
+    }
+    return burst.num;
+}
+
+static int driver_pcapfile_send(buf_t *buf) {
+    if (buf_linearize(buf) < 0)
+        return -1;
     struct pcap_pkthdr header;
     memset(&header.ts, 0, sizeof(header.ts));
     header.caplen = buf->len;
@@ -81,8 +107,27 @@ int driver_send(buf_t *buf) {
     return 0;
 }
 
-void driver_close() {
+static int driver_pcapfile_send_burst(buf_t *bufs, int n) {
+    for (int i = 0; i < n; i++)
+        if (driver_pcapfile_send(&bufs[i]) < 0)
+            return i ? i : -1;
+    return n;
+}
+
+static void driver_pcapfile_close() {
     fprintf(control_flow, "\ndriver closed\n");
     pcap_dump_close(pdump);
     pcap_close(pcap);
 }
+
+// 回放测试数据in.pcap，发出的数据帧写入out.pcap，文件由测试程序打开
+const net_driver_ops_t driver_pcapfile_ops = {
+    .name = "pcapfile",
+    .caps = DRIVER_CAP_RECV_BURST | DRIVER_CAP_SEND_BURST,
+    .open = driver_pcapfile_open,
+    .recv = driver_pcapfile_recv,
+    .recv_burst = driver_pcapfile_recv_burst,
+    .send = driver_pcapfile_send,
+    .send_burst = driver_pcapfile_send_burst,
+    .close = driver_pcapfile_close,
+};
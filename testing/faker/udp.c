@@ -31,6 +31,10 @@ void udp_close(uint16_t port) {
     fprintf(udp_fout, "udp_close: port:%d\n", port);
 }
 
+size_t udp_ports(uint16_t *ports, size_t max) {
+    return 0;
+}
+
 void udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port) {
     fprintf(udp_fout, "udp_send:\n\tlen:%d\n", len);
     fprintf(udp_fout, "\tsrc_port:%d\n", src_port);
@@ -70,6 +70,7 @@ int main(int argc, char *argv[]) {
             memset(buf2.data, 0, sizeof(len));
             buf_remove_header(&buf2, len);
             ip_out(&buf2, ip, pro);
+            buf_free(&buf2);
         } else {
             ethernet_in(&buf);
         }
@@ -78,6 +79,7 @@ int main(int argc, char *argv[]) {
     if (ret < 0) {
         PRINT_WARN("\nError occur on loading input,exiting\n");
     }
+    ethernet_flush();  // 相当于net_poll结束时发送队列中的数据帧
     driver_close();
     PRINT_INFO("\nSample input all processed, checking output\n");
 
@@ -22,14 +22,13 @@ int main(int argc, char *argv[]) {
         return -1;
     }
     arp_fout = control_flow;
-    uint8_t *p = buf.payload + 1000;
-    buf.data = p;
-    buf.len = 0;
-    char c;
-    while (fread(&c, 1, 1, in)) {
-        *p = c;
-        p++;
-        buf.len++;
+    fseek(in, 0, SEEK_END);
+    long len = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    if (buf_init(&buf, len) < 0 || fread(buf.data, 1, len, in) != len) {
+        fclose(in);
+        fclose(control_flow);
+        return -1;
     }
     PRINT_INFO("Feeding input.\n");
     ip_out(&buf, net_if_ip, NET_PROTOCOL_TCP);
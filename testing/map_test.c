@@ -0,0 +1,122 @@
+#include "map.h"
+#include "testing/log.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define MAP_TEST_ROUNDS 100000  // 插入删除的轮数，远多于索引槽数
+#define MAP_TEST_LIVE 100        // 同时保留的键数
+#define MAP_TEST_EVICT_MAX 256   // 淘汰测试的最大容量，与arp_buf一致
+#define MAP_TEST_TIMEOUT 10      // 探测不终止时由SIGALRM结束测试
+
+/**
+ * @brief 反复插入并删除互不相同的键，每轮查找一个不存在的键
+ *
+ * @return int 成功为0
+ */
+static int map_test_churn() {
+    map_t map;
+    map_init(&map, sizeof(uint32_t), sizeof(uint32_t), 0, 0, MAP_EVICT_NONE, NULL, NULL, NULL);
+    int ret = 0;
+    for (uint32_t i = 0; i < MAP_TEST_ROUNDS && ret == 0; i++) {
+        uint32_t key = i + MAP_TEST_LIVE, missing = i + MAP_TEST_ROUNDS * 2;
+        if (i < MAP_TEST_LIVE)
+            map_set(&map, &i, &i);  // 始终有效的键，重建索引后仍须可查
+        if (map_set(&map, &key, &i) != 0 || map_get(&map, &missing) != NULL)
+            ret = -1;
+        map_delete(&map, &key);
+        if (map_get(&map, &key) != NULL)
+            ret = -1;
+    }
+    for (uint32_t i = 0; i < MAP_TEST_LIVE && ret == 0; i++) {
+        uint32_t *value = map_get(&map, &i);
+        if (value == NULL || *value != i)
+            ret = -1;
+    }
+    if (map_size(&map) != MAP_TEST_LIVE)
+        ret = -1;
+    map_destroy(&map);
+    return ret;
+}
+
+/**
+ * @brief 满容量时每次插入淘汰一个最早的键，如同洪泛下的arp_buf
+ *
+ * @return int 成功为0
+ */
+static int map_test_evict() {
+    map_t map;
+    map_init(&map, sizeof(uint32_t), sizeof(uint32_t), MAP_TEST_EVICT_MAX, 0, MAP_EVICT_OLDEST, NULL, NULL, NULL);
+    int ret = 0;
+    for (uint32_t i = 0; i < MAP_TEST_ROUNDS && ret == 0; i++) {
+        uint32_t missing = i + MAP_TEST_ROUNDS * 2;
+        if (map_set(&map, &i, &i) != 0 || map_get(&map, &missing) != NULL)
+            ret = -1;
+    }
+    // 剩下的是最后插入的MAP_TEST_EVICT_MAX个键
+    for (uint32_t i = MAP_TEST_ROUNDS - MAP_TEST_EVICT_MAX; i < MAP_TEST_ROUNDS && ret == 0; i++) {
+        uint32_t *value = map_get(&map, &i);
+        if (value == NULL || *value != i)
+            ret = -1;
+    }
+    if (map_size(&map) != MAP_TEST_EVICT_MAX)
+        ret = -1;
+    map_destroy(&map);
+    return ret;
+}
+
+static int map_test_freed;  // map_test_reset中被析构的值的数量
+
+/**
+ * @brief 记录析构次数的值析构函数
+ *
+ * @param value 值指针
+ */
+static void map_test_destructor(void *value) {
+    map_test_freed++;
+}
+
+/**
+ * @brief 清空使用中的map后继续使用，被清空的值须全部析构
+ *
+ * @return int 成功为0
+ */
+static int map_test_reset() {
+    map_t map;
+    map_init(&map, sizeof(uint32_t), sizeof(uint32_t), 0, 0, MAP_EVICT_LRU, NULL, NULL, map_test_destructor);
+    int ret = 0;
+    for (uint32_t i = 0; i < MAP_TEST_EVICT_MAX; i++)
+        map_set(&map, &i, &i);
+    map_test_freed = 0;
+    if (map_reset(&map) != 0 || map_size(&map) != 0 || map_test_freed != MAP_TEST_EVICT_MAX)
+        ret = -1;
+    for (uint32_t i = 0; i < MAP_TEST_LIVE && ret == 0; i++) {
+        uint32_t *value;
+        if (map_get(&map, &i) != NULL || map_set(&map, &i, &i) != 0 || (value = map_get(&map, &i)) == NULL || *value != i)
+            ret = -1;
+    }
+    map_destroy(&map);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    PRINT_INFO("Test begin.\n");
+    alarm(MAP_TEST_TIMEOUT);
+    int ret = 0;
+    if (map_test_churn() != 0) {
+        PRINT_ERROR("Insert/delete churn failed.\n");
+        ret = -1;
+    }
+    if (map_test_evict() != 0) {
+        PRINT_ERROR("Eviction churn failed.\n");
+        ret = -1;
+    }
+    if (map_test_reset() != 0) {
+        PRINT_ERROR("Reset of a live map failed.\n");
+        ret = -1;
+    }
+    if (ret == 0)
+        PRINT_PASS("Test passed.\n");
+    return ret;
+}